@@ -0,0 +1,122 @@
+#include "AudioEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+AudioEngine::AudioEngine(unsigned int sampleRate, double frequency, int16_t amplitude, unsigned int latency)
+    : sampleRate(std::max(1u, sampleRate)),
+      latency(latency),
+      // Events further ahead than this mean the clocks drifted apart
+      maxLead(static_cast<int64_t>(latency) + sampleRate / 4),
+      phaseStep(static_cast<uint32_t>(std::llround(frequency / this->sampleRate * 4294967296.0))) {
+    const double pi = std::acos(-1.0);
+    for (size_t i = 0; i < wavetable.size(); i++) {
+        wavetable[i] = static_cast<int16_t>(std::lround(amplitude * std::sin(2.0 * pi * i / wavetable.size())));
+    }
+}
+
+void AudioEngine::setBuzzer(uint64_t sample, bool on) {
+    if (on == queuedOn) return;
+    // A full queue keeps the old state, the next call tries again
+    if (events.push({sample, on})) {
+        queuedOn = on;
+    }
+}
+
+void AudioEngine::render(int16_t *out, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        int64_t now = static_cast<int64_t>(position + done);
+        size_t span = count - done;
+
+        // Apply the events that are due and stop the span at the next one
+        while (hasNext || events.pop(next)) {
+            hasNext = true;
+            int64_t at = static_cast<int64_t>(next.sample) + offset;
+            if (at < now || at > now + maxLead) {
+                // Late, or too far ahead: line the clocks up again
+                offset = now + latency - static_cast<int64_t>(next.sample);
+                at = now + latency;
+            }
+            if (at > now) {
+                span = std::min(span, static_cast<size_t>(at - now));
+                break;
+            }
+            // Start every tone at the same phase, so renders are repeatable
+            if (next.on && gain == 0) phase = 0;
+            gate = next.on;
+            hasNext = false;
+        }
+
+        renderSpan(out + done, span);
+        done += span;
+    }
+    position += count;
+}
+
+void AudioEngine::renderSpan(int16_t *out, size_t count) {
+    constexpr unsigned int shift = 32 - TABLE_BITS;
+    size_t i = 0;
+
+    // Fade in or out first
+    int target = gate ? RAMP_SAMPLES : 0;
+    for (; i < count && gain != target; i++) {
+        gain += gate ? 1 : -1;
+        out[i] = static_cast<int16_t>(wavetable[phase >> shift] * gain / RAMP_SAMPLES);
+        phase += phaseStep;
+    }
+
+    if (gain == 0) {
+        std::fill(out + i, out + count, 0);
+        return;
+    }
+    for (; i < count; i++) {
+        out[i] = wavetable[phase >> shift];
+        phase += phaseStep;
+    }
+}
+
+namespace {
+
+void put(std::ofstream &file, uint32_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        file.put(static_cast<char>(value >> (i * 8)));
+    }
+}
+
+} // namespace
+
+bool AudioEngine::writeWAV(const std::string &filename, const std::vector<int16_t> &samples,
+                           unsigned int sampleRate) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not write WAV file " << filename << std::endl;
+        return false;
+    }
+
+    // RIFF header with a single PCM format chunk: mono, 16 bits per sample
+    uint32_t dataSize = static_cast<uint32_t>(samples.size() * sizeof(int16_t));
+    file.write("RIFF", 4);
+    put(file, 36 + dataSize, 4);
+    file.write("WAVEfmt ", 8);
+    put(file, 16, 4);
+    put(file, 1, 2);
+    put(file, 1, 2);
+    put(file, sampleRate, 4);
+    put(file, sampleRate * 2, 4);
+    put(file, 2, 2);
+    put(file, 16, 2);
+    file.write("data", 4);
+    put(file, dataSize, 4);
+    for (int16_t sample: samples) {
+        put(file, static_cast<uint16_t>(sample), 2);
+    }
+
+    if (!file) {
+        std::cerr << "Error: Could not write WAV file " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SpscQueue.h"
+
+// Renders the buzzer. The emulation thread reports when the buzzer turns on or
+// off, stamped with the sample where that happens in emulated time, and the
+// audio thread plays a tone from a precomputed wavetable that follows those
+// events to the sample. The events pass through a lock-free queue, so neither
+// thread ever waits for the other.
+class AudioEngine {
+public:
+    // latency is how far behind the render position events are placed when
+    // the emulated and audio clocks have to be lined up again, usually one
+    // device buffer. Offline rendering, where both clocks are the same, uses 0.
+    explicit AudioEngine(unsigned int sampleRate = 44100, double frequency = 440.0, int16_t amplitude = 8000,
+                         unsigned int latency = 0);
+
+    // Emulation thread: the buzzer is on or off from the given sample on. Only
+    // changes are queued.
+    void setBuzzer(uint64_t sample, bool on);
+    // Audio thread: write the next count samples
+    void render(int16_t *out, size_t count);
+
+    unsigned int getSampleRate() const { return sampleRate; }
+    // First sample of a 60Hz emulated frame
+    uint64_t frameStart(uint64_t frame) const { return frame * sampleRate / 60; }
+
+    // Write 16-bit mono samples as a WAV file
+    static bool writeWAV(const std::string &filename, const std::vector<int16_t> &samples, unsigned int sampleRate);
+
+private:
+    struct Event {
+        uint64_t sample;
+        bool on;
+    };
+
+    // One cycle of the tone, indexed by the top bits of the phase
+    static constexpr unsigned int TABLE_BITS = 8;
+    // Samples over which the tone fades in and out, so gating doesn't click
+    static constexpr int RAMP_SAMPLES = 64;
+
+    void renderSpan(int16_t *out, size_t count);
+
+    unsigned int sampleRate;
+    int64_t latency;
+    int64_t maxLead;
+    std::array<int16_t, 1 << TABLE_BITS> wavetable{};
+    uint32_t phaseStep;
+
+    // Emulation thread
+    SpscQueue<Event, 256> events;
+    bool queuedOn{false};
+
+    // Audio thread
+    uint64_t position{0};
+    int64_t offset{0};  // Added to event samples to get render positions
+    Event next{};
+    bool hasNext{false};
+    bool gate{false};
+    int gain{0};  // 0 to RAMP_SAMPLES
+    uint32_t phase{0};
+};
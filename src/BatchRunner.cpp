@@ -0,0 +1,168 @@
+#include "BatchRunner.h"
+
+#include "Chip8.h"
+#include "Chip8Jit.h"
+#include "FrameRecorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Job indices owned by one worker. The owner pops from the back, thieves take
+// from the front, so both ends are rarely contended at the same time.
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+
+    bool popBack(size_t &job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (jobs.empty()) return false;
+        job = jobs.back();
+        jobs.pop_back();
+        return true;
+    }
+
+    bool stealFront(size_t &job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (jobs.empty()) return false;
+        job = jobs.front();
+        jobs.pop_front();
+        return true;
+    }
+};
+
+} // namespace
+
+BatchRunner::BatchRunner(unsigned int threadCount)
+    : threadCount(threadCount != 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency())) {
+}
+
+// A worker's Chip8, reused from job to job, and what is loaded in it
+struct BatchRunner::Instance {
+    // Instances are about 40 KB, too much to keep on a worker's stack
+    std::unique_ptr<Chip8> chip8;
+    std::span<const uint8_t> rom;
+    QuirkProfile quirks{};
+};
+
+BatchResult BatchRunner::runJob(const BatchJob &job, Instance &instance) {
+    BatchResult result;
+
+    // Jobs of the same ROM only need a reset, which restores just the memory
+    // the previous job wrote
+    bool loaded = instance.chip8 && instance.quirks == job.quirks && instance.rom.data() == job.rom.data() &&
+                  instance.rom.size() == job.rom.size();
+    if (loaded) {
+        instance.chip8->reset(job.seed);
+    } else {
+        instance.chip8 = std::make_unique<Chip8>(job.seed);
+        instance.chip8->setQuirks(job.quirks);
+        if (job.rom.empty() || !instance.chip8->loadROM(job.rom.data(), job.rom.size())) {
+            instance.chip8.reset();
+            result.error = "could not load ROM";
+            return result;
+        }
+        instance.rom = job.rom;
+        instance.quirks = job.quirks;
+    }
+    Chip8 *chip8 = instance.chip8.get();
+    // A new recompiler per job, as reset() may have changed code it compiled
+    std::unique_ptr<Chip8Jit> jit = job.useJit ? std::make_unique<Chip8Jit>(*chip8) : nullptr;
+
+    FrameRecorder video;
+    if (!job.videoPath.empty()) {
+        if (!video.open(job.videoPath)) {
+            result.error = "could not open video file";
+            return result;
+        }
+        chip8->setFrameSink(&video);
+    }
+
+    size_t nextEvent = 0;
+    uint64_t chain = 0;
+    try {
+        for (uint64_t frame = 0; frame < job.frames; frame++) {
+            // Apply every input change scheduled up to this frame
+            while (nextEvent < job.input.size() && job.input[nextEvent].frame <= frame) {
+                chip8->setKeys(job.input[nextEvent].keys);
+                nextEvent++;
+            }
+
+            if (jit) {
+                jit->run(job.cyclesPerFrame);
+            } else {
+                chip8->run(job.cyclesPerFrame);
+            }
+            chip8->tickTimers();
+            result.cycles += job.cyclesPerFrame;
+            result.frames++;
+
+            if (job.checkpointInterval != 0) {
+                chain = (std::rotl(chain, 23) ^ chip8->checkpointHash()) * 0x9E3779B97F4A7C15;
+                if (result.frames % job.checkpointInterval == 0) result.checkpoints.push_back(chain);
+            }
+        }
+    } catch (const std::exception &e) {
+        result.error = e.what();
+    }
+    if (!job.videoPath.empty()) {
+        chip8->setFrameSink(nullptr);
+        if (!video.close(result.frames) && result.error.empty()) result.error = "could not write video file";
+    }
+
+    result.displayHash = chip8->displayHash();
+    result.registers = chip8->getRegisters();
+    result.index = chip8->getIndex();
+    result.pc = chip8->getPC();
+    return result;
+}
+
+std::vector<BatchResult> BatchRunner::run(const std::vector<BatchJob> &jobs) {
+    std::vector<BatchResult> results(jobs.size());
+    std::vector<WorkQueue> queues(threadCount);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        queues[i % threadCount].jobs.push_back(i);
+    }
+
+    std::atomic<uint64_t> totalCycles{0};
+    auto worker = [&](unsigned int self) {
+        uint64_t cycles = 0;
+        Instance instance;
+        size_t job;
+        while (true) {
+            bool found = queues[self].popBack(job);
+            for (unsigned int i = 1; !found && i < threadCount; i++) {
+                found = queues[(self + i) % threadCount].stealFront(job);
+            }
+            // Queues only shrink once run() starts, so if every queue is
+            // empty there is nothing left to do
+            if (!found) break;
+
+            results[job] = runJob(jobs[job], instance);
+            cycles += results[job].cycles;
+        }
+        totalCycles += cycles;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < threadCount; i++) {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    instructionsPerSecond = seconds > 0 ? totalCycles / seconds : 0;
+    return results;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Quirks.h"
+
+// Keypad state applied from the given frame onwards. Bit N of keys is key N.
+struct KeyEvent {
+    uint64_t frame;
+    uint16_t keys;
+};
+
+// One independent run of a ROM
+struct BatchJob {
+    std::span<const uint8_t> rom;      // ROM image, shared by any number of jobs
+    QuirkProfile quirks{QuirkProfile::Modern};
+    unsigned int seed{};               // Seed for CXNN
+    uint64_t frames{};                 // Frame budget
+    uint64_t cyclesPerFrame{11};
+    std::vector<KeyEvent> input;       // Sorted by frame
+    uint64_t checkpointInterval{};     // Frames between checkpoints, 0 for none
+    std::string videoPath;             // Record the changed frames here (see FrameRecorder.h), empty for none
+    bool useJit{};                     // Run through Chip8Jit, which falls back to the interpreter where it must
+};
+
+struct BatchResult {
+    uint64_t displayHash{};
+    std::array<uint8_t, 16> registers{};
+    uint16_t index{};
+    uint16_t pc{};
+    uint64_t cycles{};
+    uint64_t frames{};
+    std::string error; // Empty unless the ROM failed to load or crashed
+    // Chip8::checkpointHash() of every frame so far, chained, after every
+    // checkpointInterval frames
+    std::vector<uint64_t> checkpoints;
+};
+
+// Runs many Chip8 instances in parallel on a work-stealing thread pool. Jobs
+// are dealt round robin to per-thread queues; a thread that runs out of work
+// takes jobs from the front of another thread's queue, so long-running jobs
+// don't leave cores idle at the end of a batch.
+class BatchRunner {
+public:
+    // threadCount 0 uses every hardware thread
+    explicit BatchRunner(unsigned int threadCount = 0);
+
+    std::vector<BatchResult> run(const std::vector<BatchJob> &jobs);
+
+    unsigned int getThreadCount() const { return threadCount; }
+    // Aggregate emulated instructions per second of the last run()
+    double getInstructionsPerSecond() const { return instructionsPerSecond; }
+
+private:
+    struct Instance;
+
+    static BatchResult runJob(const BatchJob &job, Instance &instance);
+
+    unsigned int threadCount;
+    double instructionsPerSecond{};
+};
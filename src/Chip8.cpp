@@ -1,334 +1,1406 @@
 #include "Chip8.h"
 
+#include "Debugger.h"
+#include "Profiler.h"
+#include "Trace.h"
+
 #include <fstream>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <iterator>
+#include <random>
 
-Chip8::Chip8() : randGen(std::random_device{}()), randByte(0, 255) {
-    // Load font sprites to memory
-    uint8_t fontset[FONT_ADDRESS] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-        0x20, 0x60, 0x20, 0x20, 0x70, // 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
-    std::copy(std::begin(fontset), std::end(fontset), memory.begin() + FONT_ADDRESS);
+namespace {
+
+// Font sprites, loaded to memory at FONT_ADDRESS
+constexpr uint8_t FONTSET[16 * 5] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+// SUPER-CHIP 8x10 digits, with the XO-CHIP letters A-F, at BIG_FONT_ADDRESS
+constexpr uint8_t BIG_FONTSET[16 * 10] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+// Page stamps are unique over all instances and threads. Each thread
+// reserves them from the shared counter in blocks, so writes don't contend.
+uint64_t newStamps(uint64_t count) {
+    constexpr uint64_t BLOCK = 1 << 16;
+    static std::atomic<uint64_t> nextBlock{1};
+    thread_local uint64_t next = 0;
+    thread_local uint64_t end = 0;
+    if (end - next < count) {
+        uint64_t size = std::max(BLOCK, count);
+        next = nextBlock.fetch_add(size, std::memory_order_relaxed);
+        end = next + size;
+    }
+    uint64_t first = next;
+    next += count;
+    return first;
 }
 
-void Chip8::cycle() {
-    // Fetch instruction from memory at the current PC (program counter)
-    // opcodes are 16-bit so we use bitwise operators
-    opcode = (static_cast<uint16_t>(memory[pc]) << 8) | memory[pc + 1];
+} // namespace
+
+Chip8::Chip8() : Chip8(std::random_device{}()) {
+}
+
+Chip8::Chip8(unsigned int seed) {
+    seedRandom(seed);
+    setQuirks(QuirkProfile::Modern);
+    std::copy(std::begin(FONTSET), std::end(FONTSET), memory.begin() + FONT_ADDRESS);
+    std::copy(std::begin(BIG_FONTSET), std::end(BIG_FONTSET), memory.begin() + BIG_FONT_ADDRESS);
+}
+
+void Chip8::seedRandom(unsigned int seed) {
+    // Spread the seed over all bits (murmur3 finalizer), so that consecutive
+    // seeds don't start with similar sequences. xorshift can't start at 0.
+    uint32_t z = seed + 0x9E3779B9u;
+    z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+    z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+    z ^= z >> 16;
+    randState = z != 0 ? z : 1;
+}
+
+// GCC and Clang can jump straight from one handler to the next through a table
+// of label addresses ("threaded" dispatch), which saves the bounds check and
+// the shared indirect branch of a switch. Other compilers use the switch.
+#if defined(__GNUC__) || defined(__clang__)
+#define CHIP8_COMPUTED_GOTO 1
+#endif
+
+// The AVX2 version of checkpointHash() is compiled with a target attribute and
+// picked at runtime, so the library still runs on hosts without AVX2
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CHIP8_AVX2_HASH 1
+#define CHIP8_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Memory, stack and keypad accesses of the run loop. Checked ones throw
+// std::out_of_range like at(), unchecked ones wrap around, which needs no
+// branch since every array size is a power of two.
+template <bool CHECKED, typename T, size_t N>
+T &element(std::array<T, N> &array, size_t i) {
+    static_assert((N & (N - 1)) == 0);
+    if constexpr (CHECKED) {
+        return array.at(i);
+    } else {
+        return array[i & (N - 1)];
+    }
+}
+
+// Same for memory, whose size is only known to the profile
+template <bool CHECKED, size_t N, typename T>
+T &element(std::vector<T> &vector, size_t i) {
+    static_assert((N & (N - 1)) == 0);
+    if constexpr (CHECKED) {
+        return vector.at(i);
+    } else {
+        return vector[i & (N - 1)];
+    }
+}
+
+// Place a sprite row at column x of a 128 pixel hi-res row. bits has the
+// sprite's leftmost pixel in the top bit. Pixels past the right edge are
+// dropped, or with WRAP continue at the left edge.
+template <bool WRAP>
+Chip8::Row placeSpriteRow(uint64_t bits, unsigned int x) {
+    if (x < 64) {
+        // Sprites are at most 16 pixels wide, so they can't wrap from here
+        return {bits >> x, x != 0 ? bits << (64 - x) : 0};
+    }
+    return {WRAP && x > 64 ? bits << (128 - x) : 0, bits >> (x - 64)};
+}
+
+// What FX55 and FX65 do to I after the transfer
+template <typename Quirks>
+void advanceIndex(uint16_t &index, uint8_t x) {
+    if constexpr (Quirks::INDEX_INCREMENT == IndexIncrement::ByX) {
+        index += x;
+    } else if constexpr (Quirks::INDEX_INCREMENT == IndexIncrement::ByXPlusOne) {
+        index += x + 1;
+    }
+}
 
-    // TEMPORARY DEBUG: Print what the CPU sees
-    // printf("PC: 0x%04X | Opcode: 0x%04X\n", pc, opcode);
+} // namespace
 
-    pc += 2; // move pc to next instruction
+template <typename Quirks>
+Chip8::Instruction Chip8::decode(uint16_t opcode) {
+    Instruction inst;
+    inst.x = (opcode & 0x0F00) >> 8;
+    inst.y = (opcode & 0x00F0) >> 4;
+    inst.nn = opcode & 0x00FF;
+    inst.nnn = opcode & 0x0FFF;
+    inst.opcode = opcode;
 
-    // Decode and execute opcode
     switch (opcode & 0xF000) {
         case 0x0000:
-            // opcode: 0x0___
-            switch (opcode) {
-                case 0x00e0:
-                    // opcode: 0x00e0
-                    // Clear the display
-                    for (auto &row: display)
-                        std::fill(row.begin(), row.end(), 0);
-                    break;
-                case 0x00ee:
-                    // opcode: 0x00EE
-                    // Return from subroutine
-                    pc = stack.at(--sp);
-                    break;
-            }
+            if (opcode == 0x00E0) inst.op = Op::ClearScreen;
+            else if (opcode == 0x00EE) inst.op = Op::Return;
+            else if (Quirks::SCHIP_OPCODES && (opcode & 0xFFF0) == 0x00C0) inst.op = Op::ScrollDown;
+            else if (Quirks::XO_CHIP_OPCODES && (opcode & 0xFFF0) == 0x00D0) inst.op = Op::ScrollUp;
+            else if (Quirks::SCHIP_OPCODES && opcode == 0x00FB) inst.op = Op::ScrollRight;
+            else if (Quirks::SCHIP_OPCODES && opcode == 0x00FC) inst.op = Op::ScrollLeft;
+            else if (Quirks::SCHIP_OPCODES && opcode == 0x00FD) inst.op = Op::Exit;
+            else if (Quirks::SCHIP_OPCODES && opcode == 0x00FE) inst.op = Op::LowRes;
+            else if (Quirks::SCHIP_OPCODES && opcode == 0x00FF) inst.op = Op::HighRes;
+            else inst.op = Op::Unknown;
             break;
-        case 0x1000: // opcode: 0x1NNN
-            // Jump to address NNN
-            pc = opcode & 0x0FFF;
+        case 0x1000: inst.op = Op::Jump; break;
+        case 0x2000: inst.op = Op::Call; break;
+        case 0x3000: inst.op = Op::SkipEqualImm; break;
+        case 0x4000: inst.op = Op::SkipNotEqualImm; break;
+        case 0x5000:
+            if (Quirks::XO_CHIP_OPCODES && (opcode & 0x000F) == 0x2) inst.op = Op::StoreRange;
+            else if (Quirks::XO_CHIP_OPCODES && (opcode & 0x000F) == 0x3) inst.op = Op::LoadRange;
+            else inst.op = Op::SkipEqualReg;
             break;
-        case 0x2000: // opcode: 0x2NNN
-            // Call subroutine at NNN
-            stack.at(sp++) = pc;
-            pc = opcode & 0x0FFF;
-            break;
-        case 0x3000: // opcode: 0x3XNN
-            // Skip next instruction if VX == NN
-            if (registers.at((opcode & 0x0F00) >> 8) == (opcode & 0x00FF)) {
-                pc += 2;
+        case 0x6000: inst.op = Op::SetImm; break;
+        case 0x7000: inst.op = Op::AddImm; break;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0: inst.op = Op::Move; break;
+                case 0x1: inst.op = Op::Or; break;
+                case 0x2: inst.op = Op::And; break;
+                case 0x3: inst.op = Op::Xor; break;
+                case 0x4: inst.op = Op::Add; break;
+                case 0x5: inst.op = Op::Sub; break;
+                case 0x6: inst.op = Op::ShiftRight; break;
+                case 0x7: inst.op = Op::SubReverse; break;
+                case 0xE: inst.op = Op::ShiftLeft; break;
+                default: inst.op = Op::Unknown; break;
             }
             break;
-        case 0x4000: // opcode: 0x4XNN
-            // Skip next instruction if VX != NN
-            if (registers.at((opcode & 0x0F00) >> 8) != (opcode & 0x00FF)) {
-                pc += 2;
-            }
+        case 0x9000: inst.op = Op::SkipNotEqualReg; break;
+        case 0xA000: inst.op = Op::SetIndex; break;
+        case 0xB000: inst.op = Op::JumpOffset; break;
+        case 0xC000: inst.op = Op::Random; break;
+        case 0xD000: inst.op = Op::Draw; break;
+        case 0xE000:
+            if ((opcode & 0x00FF) == 0x9E) inst.op = Op::SkipKey;
+            else if ((opcode & 0x00FF) == 0xA1) inst.op = Op::SkipNotKey;
+            else inst.op = Op::Unknown;
             break;
-        case 0x5000: // opcode: 0x5XY0
-            // Skip next instruction if VX == VY
-            if (registers.at((opcode & 0x0F00) >> 8) == registers.at((opcode & 0x00F0) >> 4)) {
-                pc += 2;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x07: inst.op = Op::GetDelay; break;
+                case 0x0A: inst.op = Op::WaitKey; break;
+                case 0x15: inst.op = Op::SetDelay; break;
+                case 0x18: inst.op = Op::SetSound; break;
+                case 0x1E: inst.op = Op::AddIndex; break;
+                case 0x29: inst.op = Op::FontChar; break;
+                case 0x33: inst.op = Op::StoreBCD; break;
+                case 0x55: inst.op = Op::StoreRegisters; break;
+                case 0x65: inst.op = Op::LoadRegisters; break;
+                case 0x30: inst.op = Quirks::SCHIP_OPCODES ? Op::BigFontChar : Op::Unknown; break;
+                case 0x75: inst.op = Quirks::SCHIP_OPCODES ? Op::StoreFlags : Op::Unknown; break;
+                case 0x85: inst.op = Quirks::SCHIP_OPCODES ? Op::LoadFlags : Op::Unknown; break;
+                case 0x00: inst.op = Quirks::XO_CHIP_OPCODES && opcode == 0xF000 ? Op::SetIndexLong : Op::Unknown; break;
+                case 0x01: inst.op = Quirks::XO_CHIP_OPCODES ? Op::SelectPlanes : Op::Unknown; break;
+                case 0x02: inst.op = Quirks::XO_CHIP_OPCODES && opcode == 0xF002 ? Op::LoadAudio : Op::Unknown; break;
+                case 0x3A: inst.op = Quirks::XO_CHIP_OPCODES ? Op::SetPitch : Op::Unknown; break;
+                default: inst.op = Op::Unknown; break;
             }
             break;
-        case 0x6000: // opcode: 0x6XNN
-            // Set register VX to NN
-            registers.at((opcode & 0x0F00) >> 8) = opcode & 0x00FF;
+    }
+    return inst;
+}
+
+template <typename Quirks, bool CHECKED>
+void Chip8::writeMemory(size_t address, uint8_t value) {
+    element<CHECKED, Quirks::MEMORY_SIZE>(memory, address) = value;
+    // The byte is the high half of the instruction at address and the low half
+    // of the one starting right before it
+    address &= Quirks::MEMORY_SIZE - 1;
+    decoded[address].op = Op::Decode;
+    decoded[(address - 1) & (Quirks::MEMORY_SIZE - 1)].op = Op::Decode;
+}
+
+template <typename Quirks>
+void Chip8::stampWrites(size_t address, size_t count) {
+    // Instructions write at most 17 bytes, so together with the byte before
+    // them they span the page of the first and the page of the last
+    size_t first = (address - 1) & (Quirks::MEMORY_SIZE - 1);
+    size_t last = (address + count - 1) & (Quirks::MEMORY_SIZE - 1);
+    if (writeStamp == 0) writeStamp = newStamps(1);
+    if (pageStamps[first >> PAGE_SHIFT] != writeStamp) pageStamps[first >> PAGE_SHIFT] = writeStamp;
+    if (pageStamps[last >> PAGE_SHIFT] != writeStamp) pageStamps[last >> PAGE_SHIFT] = writeStamp;
+}
+
+void Chip8::cycle() {
+    run(1);
+}
+
+void Chip8::run(uint64_t cycles) {
+    NoProfiling hooks;
+    (this->*runLoop)(cycles, hooks);
+}
+
+void Chip8::run(uint64_t cycles, Profiler &profiler) {
+    (this->*profiledRunLoop)(cycles, profiler);
+}
+
+void Chip8::run(uint64_t cycles, TraceWriter &trace) {
+    (this->*tracedRunLoop)(cycles, trace);
+    trace.endRun();
+}
+
+void Chip8::run(uint64_t cycles, Debugger &debugger) {
+    debugger.beginRun();
+    (this->*debuggedRunLoop)(cycles, debugger);
+    debugger.endRun();
+}
+
+void Chip8::setQuirks(QuirkProfile profile, bool checked) {
+    switch (profile) {
+        case QuirkProfile::CosmacVip:
+            checked ? selectRunLoops<CosmacVipQuirks, true>() : selectRunLoops<CosmacVipQuirks, false>();
             break;
-        case 0x7000: // opcode: 0x7XNN
-            // Add NN to register VX
-            registers.at((opcode & 0x0F00) >> 8) += opcode & 0x00FF;
+        case QuirkProfile::Chip48:
+            checked ? selectRunLoops<Chip48Quirks, true>() : selectRunLoops<Chip48Quirks, false>();
             break;
-        case 0x8000: {
-            // opcode: 0x8___
-            switch (opcode & 0x000F) {
-                case 0x0000: // opcode: 0x8XY0
-                    // Set VX to VY
-                    registers.at((opcode & 0x0F00) >> 8) = registers.at((opcode & 0x00F0) >> 4);
-                    break;
-                case 0x0001: // opcode: 0x8XY1
-                    // Set VX to VX OR VY
-                    registers.at((opcode & 0x0F00) >> 8) |= registers.at((opcode & 0x00F0) >> 4);
-                    break;
-                case 0x0002: // opcode: 0x8XY2
-                    // Set VX to VX AND VY
-                    registers.at((opcode & 0x0F00) >> 8) &= registers.at((opcode & 0x00F0) >> 4);
-                    break;
-                case 0x0003: // opcode: 0x8XY3
-                    // Set VX to VX XOR VY
-                    registers.at((opcode & 0x0F00) >> 8) ^= registers.at((opcode & 0x00F0) >> 4);
-                    break;
-                case 0x0004: {
-                    // opcode: 0x8XY4
-                    // Adds VY to VX. If there is an overflow set VF 1 and 0 if not
-                    uint8_t vx = registers.at((opcode & 0x0F00) >> 8);
-                    uint8_t vy = registers.at((opcode & 0x00F0) >> 4);
-                    int tempResult = vx + vy;
-                    registers.at((opcode & 0x0f00) >> 8) += vy;
-                    registers.at(15) = 0; // Set VF to 0
-                    if (tempResult > UINT8_MAX) {
-                        registers.at(15) = 1;
-                    }
-                    break;
+        case QuirkProfile::Schip:
+            checked ? selectRunLoops<SchipQuirks, true>() : selectRunLoops<SchipQuirks, false>();
+            break;
+        case QuirkProfile::XoChip:
+            checked ? selectRunLoops<XoChipQuirks, true>() : selectRunLoops<XoChipQuirks, false>();
+            break;
+        default:
+            profile = QuirkProfile::Modern;
+            checked ? selectRunLoops<ModernQuirks, true>() : selectRunLoops<ModernQuirks, false>();
+            break;
+    }
+    quirks = profile;
+    this->checked = checked;
+}
+
+template <typename Quirks, bool CHECKED>
+void Chip8::selectRunLoops() {
+    // Instructions decode differently per profile, so the cache starts over
+    if (bootMemory && bootMemory->size() != Quirks::MEMORY_SIZE) {
+        auto boot = std::make_shared<std::vector<uint8_t>>(*bootMemory);
+        boot->resize(Quirks::MEMORY_SIZE);
+        bootMemory = std::move(boot);
+        bootStamp = newStamps(Quirks::MEMORY_SIZE >> PAGE_SHIFT);
+    }
+    memory.resize(Quirks::MEMORY_SIZE);
+    decoded.assign(Quirks::MEMORY_SIZE, Instruction{});
+    pageStamps.resize(Quirks::MEMORY_SIZE >> PAGE_SHIFT);
+    restampPages();
+    if (!Quirks::SCHIP_OPCODES && hires) setHires(false);
+    if (!Quirks::XO_CHIP_OPCODES) planeMask = 1;
+    runLoop = &Chip8::execute<Quirks, CHECKED, NoProfiling>;
+    profiledRunLoop = &Chip8::execute<Quirks, CHECKED, Profiler>;
+    tracedRunLoop = &Chip8::execute<Quirks, CHECKED, TraceWriter>;
+    debuggedRunLoop = &Chip8::execute<Quirks, CHECKED, Debugger>;
+}
+
+// Report the instruction about to run, unless it still has to be decoded (it
+// is reported once the decode handler dispatches it again)
+#define CHIP8_HOOK_INSTRUCTION()                                    \
+    do {                                                            \
+        if constexpr (Hooks::ENABLED) {                             \
+            if (inst->op != Op::Decode) hooks.instruction(pc, inst->opcode); \
+        }                                                           \
+    } while (0)
+
+// Return before the instruction if the debugger stops there. The check is
+// only compiled into the debugged run loop.
+#define CHIP8_HOOK_BREAK()                                          \
+    do {                                                            \
+        if constexpr (Hooks::BREAKS) {                              \
+            if (hooks.shouldBreak(pc & (Quirks::MEMORY_SIZE - 1))) return; \
+        }                                                           \
+    } while (0)
+
+// Skip the next instruction. The XO-CHIP F000 NNNN is four bytes long, so
+// skipping it takes one more step.
+#define CHIP8_SKIP()                                                \
+    do {                                                            \
+        pc += 2;                                                    \
+        if constexpr (Quirks::XO_CHIP_OPCODES) {                    \
+            unsigned int next = pc & (Quirks::MEMORY_SIZE - 1);     \
+            if (memory[next] == 0xF0 &&                             \
+                memory[(next + 1) & (Quirks::MEMORY_SIZE - 1)] == 0x00) { \
+                pc += 2;                                            \
+            }                                                       \
+        }                                                           \
+    } while (0)
+
+// Instructions with effects beyond V0-VF, I and the PC forget the loop that
+// was being watched for idling (see Jump). Profiled runs count every
+// instruction, so they never skip any.
+#define CHIP8_SIDE_EFFECT()                                         \
+    do {                                                            \
+        if constexpr (!Hooks::ENABLED) loopJump = NO_LOOP;          \
+    } while (0)
+
+template <typename Quirks, bool CHECKED, typename Hooks>
+void Chip8::execute(uint64_t cycles, Hooks &hooks) {
+    const Instruction *inst;
+    // Stamps can only be shared, by a fork or a copy, between run() calls
+    writeStamp = 0;
+
+    if constexpr (Quirks::DISPLAY_WAIT) {
+        // Still waiting for the tick after the last draw
+        if (waitingForTick) {
+            idleCycles += cycles;
+            return;
+        }
+    }
+
+    // The last backward jump taken, with the cycles left and the registers at that point
+    constexpr uint16_t NO_LOOP = 0xFFFF;
+    [[maybe_unused]] uint16_t loopJump = NO_LOOP;
+    [[maybe_unused]] uint64_t loopCycles = 0;
+    [[maybe_unused]] std::array<uint8_t, REGISTER_COUNT> loopRegisters;
+    [[maybe_unused]] uint16_t loopIndex = 0;
+
+#ifdef CHIP8_COMPUTED_GOTO
+    // Must list the handlers in the same order as the Op enum
+    static void *const dispatchTable[] = {
+        &&op_Decode, &&op_Unknown,
+        &&op_ClearScreen, &&op_Return, &&op_Jump, &&op_Call, &&op_SkipEqualImm, &&op_SkipNotEqualImm,
+        &&op_SkipEqualReg, &&op_SetImm, &&op_AddImm,
+        &&op_Move, &&op_Or, &&op_And, &&op_Xor, &&op_Add, &&op_Sub, &&op_ShiftRight, &&op_SubReverse,
+        &&op_ShiftLeft, &&op_SkipNotEqualReg,
+        &&op_SetIndex, &&op_JumpOffset, &&op_Random, &&op_Draw, &&op_SkipKey, &&op_SkipNotKey,
+        &&op_GetDelay, &&op_WaitKey, &&op_SetDelay, &&op_SetSound, &&op_AddIndex, &&op_FontChar,
+        &&op_StoreBCD, &&op_StoreRegisters, &&op_LoadRegisters,
+        &&op_ScrollDown, &&op_ScrollRight, &&op_ScrollLeft, &&op_Exit, &&op_LowRes, &&op_HighRes,
+        &&op_BigFontChar, &&op_StoreFlags, &&op_LoadFlags,
+        &&op_ScrollUp, &&op_StoreRange, &&op_LoadRange, &&op_SetIndexLong, &&op_SelectPlanes,
+        &&op_LoadAudio, &&op_SetPitch,
+    };
+    static_assert(std::size(dispatchTable) == static_cast<size_t>(Op::Count));
+
+// Fetch the next cached instruction, move pc past it and jump to its handler
+#define DISPATCH()                                                  \
+    do {                                                            \
+        if (cycles == 0) return;                                    \
+        CHIP8_HOOK_BREAK();                                         \
+        cycles--;                                                   \
+        inst = &decoded[pc & (Quirks::MEMORY_SIZE - 1)];            \
+        CHIP8_HOOK_INSTRUCTION();                                   \
+        pc += 2;                                                    \
+        goto *dispatchTable[static_cast<uint8_t>(inst->op)];        \
+    } while (0)
+#define TARGET(name) op_##name:
+
+    DISPATCH();
+#else
+#define DISPATCH() goto dispatch
+#define TARGET(name) case Op::name:
+
+dispatch:
+    if (cycles == 0) return;
+    CHIP8_HOOK_BREAK();
+    cycles--;
+    inst = &decoded[pc & (Quirks::MEMORY_SIZE - 1)];
+    CHIP8_HOOK_INSTRUCTION();
+    pc += 2;
+    switch (inst->op) {
+#endif
+
+    TARGET(Decode) {
+        // Fetch instruction from memory at the current PC (program counter)
+        // opcodes are 16-bit so we use bitwise operators
+        uint16_t address = (pc - 2) & (Quirks::MEMORY_SIZE - 1);
+        uint16_t opcode = (static_cast<uint16_t>(memory[address]) << 8) |
+                          memory[(address + 1) & (Quirks::MEMORY_SIZE - 1)];
+        decoded[address] = decode<Quirks>(opcode);
+
+        // Run the freshly decoded instruction without counting a second cycle
+        pc -= 2;
+        cycles++;
+        DISPATCH();
+    }
+    TARGET(Unknown) {
+        // Unsupported opcodes are ignored
+        DISPATCH();
+    }
+    TARGET(ClearScreen) {
+        // opcode: 0x00E0
+        // Clear the display (XO-CHIP: the selected planes)
+        clearPlanes();
+        hooks.clear();
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(Return) {
+        // opcode: 0x00EE
+        // Return from subroutine
+        pc = element<CHECKED>(stack, --sp);
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(Jump) {
+        // opcode: 0x1NNN
+        // Jump to address NNN
+        uint16_t from = pc - 2;
+        pc = inst->nnn;
+        if constexpr (!Hooks::ENABLED) {
+            if (pc <= from && skipIdle) {
+                // Back at the same jump, with nothing but registers touched
+                // since and the registers as they were: the loop only depends
+                // on the timers and keys, which can't change before run()
+                // returns, so every further pass would be the same. Skip the
+                // passes that fit in the cycles left.
+                if (loopJump == from && loopIndex == index && loopRegisters == registers) {
+                    uint64_t length = loopCycles - cycles;
+                    uint64_t skipped = cycles - cycles % length;
+                    cycles -= skipped;
+                    idleCycles += skipped;
                 }
-                case 0x0005: {
-                    // opcode: 0x8XY5
-                    // Subtracts VY from VX. If there is an underflow set VF
-                    // to 0 and 1 if not
-                    uint8_t vx = registers.at((opcode & 0x0F00) >> 8);
-                    uint8_t vy = registers.at((opcode & 0x00F0) >> 4);
-                    registers.at((opcode & 0x0F00) >> 8) -= vy;
-                    registers.at(15) = 0;
-                    if (vx >= vy) {
-                        registers.at(15) = 1;
-                    }
+                loopJump = from;
+                loopCycles = cycles;
+                loopRegisters = registers;
+                loopIndex = index;
+            }
+        }
+        DISPATCH();
+    }
+    TARGET(Call) {
+        // opcode: 0x2NNN
+        // Call subroutine at NNN
+        element<CHECKED>(stack, sp++) = pc;
+        pc = inst->nnn;
+        hooks.call(sp);
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(SkipEqualImm) {
+        // opcode: 0x3XNN
+        // Skip next instruction if VX == NN
+        if (registers[inst->x] == inst->nn) {
+            CHIP8_SKIP();
+        }
+        DISPATCH();
+    }
+    TARGET(SkipNotEqualImm) {
+        // opcode: 0x4XNN
+        // Skip next instruction if VX != NN
+        if (registers[inst->x] != inst->nn) {
+            CHIP8_SKIP();
+        }
+        DISPATCH();
+    }
+    TARGET(SkipEqualReg) {
+        // opcode: 0x5XY0
+        // Skip next instruction if VX == VY
+        if (registers[inst->x] == registers[inst->y]) {
+            CHIP8_SKIP();
+        }
+        DISPATCH();
+    }
+    TARGET(SetImm) {
+        // opcode: 0x6XNN
+        // Set register VX to NN
+        registers[inst->x] = inst->nn;
+        DISPATCH();
+    }
+    TARGET(AddImm) {
+        // opcode: 0x7XNN
+        // Add NN to register VX
+        registers[inst->x] += inst->nn;
+        DISPATCH();
+    }
+    TARGET(Move) {
+        // opcode: 0x8XY0
+        // Set VX to VY
+        registers[inst->x] = registers[inst->y];
+        DISPATCH();
+    }
+    TARGET(Or) {
+        // opcode: 0x8XY1
+        // Set VX to VX OR VY
+        registers[inst->x] |= registers[inst->y];
+        if constexpr (Quirks::VF_RESET) registers[15] = 0;
+        DISPATCH();
+    }
+    TARGET(And) {
+        // opcode: 0x8XY2
+        // Set VX to VX AND VY
+        registers[inst->x] &= registers[inst->y];
+        if constexpr (Quirks::VF_RESET) registers[15] = 0;
+        DISPATCH();
+    }
+    TARGET(Xor) {
+        // opcode: 0x8XY3
+        // Set VX to VX XOR VY
+        registers[inst->x] ^= registers[inst->y];
+        if constexpr (Quirks::VF_RESET) registers[15] = 0;
+        DISPATCH();
+    }
+    TARGET(Add) {
+        // opcode: 0x8XY4
+        // Adds VY to VX. If there is an overflow set VF 1 and 0 if not
+        int tempResult = registers[inst->x] + registers[inst->y];
+        registers[inst->x] = tempResult;
+        registers[15] = tempResult > UINT8_MAX;
+        DISPATCH();
+    }
+    TARGET(Sub) {
+        // opcode: 0x8XY5
+        // Subtracts VY from VX. If there is an underflow set VF
+        // to 0 and 1 if not
+        uint8_t vx = registers[inst->x];
+        uint8_t vy = registers[inst->y];
+        registers[inst->x] = vx - vy;
+        registers[15] = vx >= vy;
+        DISPATCH();
+    }
+    TARGET(ShiftRight) {
+        // opcode: 0x8XY6
+        // Shift VX (or VY with the shift quirk) to the right by 1, store
+        // the result in VX and the shifted bit into VF
+        uint8_t value = registers[Quirks::SHIFT_VY ? inst->y : inst->x];
+        registers[inst->x] = value >> 1;
+        registers[15] = value & 0x1;
+        DISPATCH();
+    }
+    TARGET(SubReverse) {
+        // opcode: 0x8XY7
+        // Set VX to VY - VX. If there is an underflow set VF to
+        // 0 and 1 if not
+        uint8_t vx = registers[inst->x];
+        uint8_t vy = registers[inst->y];
+        registers[inst->x] = vy - vx;
+        registers[15] = vy >= vx;
+        DISPATCH();
+    }
+    TARGET(ShiftLeft) {
+        // opcode: 0x8XYE
+        // Shift VX (or VY with the shift quirk) to the left by 1, store
+        // the result in VX and the shifted bit into VF
+        uint8_t value = registers[Quirks::SHIFT_VY ? inst->y : inst->x];
+        registers[inst->x] = value << 1;
+        registers[15] = (value & 0x80) >> 7;
+        DISPATCH();
+    }
+    TARGET(SkipNotEqualReg) {
+        // opcode: 0x9XY0
+        // Skip next instruction if VX != VY
+        if (registers[inst->x] != registers[inst->y]) {
+            CHIP8_SKIP();
+        }
+        DISPATCH();
+    }
+    TARGET(SetIndex) {
+        // opcode: 0xANNN
+        // Sets index register I to address NNN
+        index = inst->nnn;
+        DISPATCH();
+    }
+    TARGET(JumpOffset) {
+        // opcode: 0xBNNN
+        // Jumps to the address NNN plus V0, or with the jump quirk (BXNN)
+        // to XNN plus VX
+        pc = inst->nnn + registers[Quirks::JUMP_VX ? inst->x : 0];
+        DISPATCH();
+    }
+    TARGET(Random) {
+        // opcode: 0xCXNN
+        // Sets VX to a random number between 0 and 255 with a mask NN
+        registers[inst->x] = randomByte() & inst->nn;
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(Draw) {
+        // opcode: 0xDXYN
+        // Draw sprite to coordinate (VX, VY) with a width of 8 pixels and a
+        // height of N pixels. Sprite starts at memory location I. X and y
+        // are the top left corner of the sprite. SUPER-CHIP draws a 16x16
+        // sprite of two bytes per row for DXY0, and XO-CHIP draws one sprite
+        // per selected plane, each following the previous one in memory.
+        unsigned int width = SCREEN_WIDTH;
+        unsigned int screenHeight = SCREEN_HEIGHT;
+        unsigned int height = inst->nn & 0x0F;
+        unsigned int bytesPerRow = 1;
+        if constexpr (Quirks::SCHIP_OPCODES) {
+            if (hires) {
+                width = HIRES_WIDTH;
+                screenHeight = HIRES_HEIGHT;
+            }
+            if (height == 0) {
+                height = 16;
+                bytesPerRow = 2;
+            }
+        }
+        unsigned int x = registers[inst->x] % width;
+        unsigned int y = registers[inst->y] % screenHeight;
+
+        // Each sprite row is placed at the top of a 64-bit word and shifted
+        // right to column x. Bits shifted past the right edge are dropped,
+        // which clips the sprite, unless the wrap quirk rotates them around
+        // to the left edge. Rows below the screen likewise end the sprite or
+        // wrap to the top. Hi-res rows span two words.
+        uint64_t collision = 0;
+        uint64_t rows = 0;
+        uint16_t address = index;
+        constexpr unsigned int planes = Quirks::XO_CHIP_OPCODES ? PLANES : 1;
+        for (unsigned int plane = 0; plane < planes; plane++) {
+            if (!((planeMask >> plane) & 1)) continue;
+            Plane &target = display[plane];
+            for (unsigned int row = 0; row < height; row++) {
+                unsigned int line = y + row;
+                if constexpr (Quirks::WRAP_SPRITES) {
+                    line %= screenHeight;
+                } else if (line >= screenHeight) {
                     break;
                 }
-                case 0x0006: {
-                    // opcode: 0x8XY6
-                    // Shift VX to the right by 1, and store the shifted bit
-                    // into VF
-                    uint8_t vx = registers.at((opcode & 0x0F00) >> 8);
-                    registers.at((opcode & 0x0F00) >> 8) >>= 1;
-                    registers.at(15) = vx & 0x1;
-                    break;
+                uint64_t bits;
+                if (bytesPerRow == 1) {
+                    bits = static_cast<uint64_t>(element<CHECKED, Quirks::MEMORY_SIZE>(memory, address + row)) << 56;
+                } else {
+                    bits = (static_cast<uint64_t>(element<CHECKED, Quirks::MEMORY_SIZE>(memory, address + row * 2)) << 56) |
+                           (static_cast<uint64_t>(element<CHECKED, Quirks::MEMORY_SIZE>(memory, address + row * 2 + 1)) << 48);
                 }
-                case 0x0007: {
-                    // opcode: 0x8XY7
-                    // Set VX to VY - VX. If there is an underflow set VF to
-                    // 0 and 1 if not
-                    uint8_t vx = registers.at((opcode & 0x0F00) >> 8);
-                    uint8_t vy = registers.at((opcode & 0x00F0) >> 4);
-                    registers.at((opcode & 0x0F00) >> 8) = vy - vx;
-                    registers.at(15) = 0;
-                    if (vy >= vx) {
-                        registers.at(15) = 1;
-                    }
-                    break;
+                Row &pixels = target[line];
+                if (!Quirks::SCHIP_OPCODES || !hires) {
+                    uint64_t spriteRow = Quirks::WRAP_SPRITES ? std::rotr(bits, x) : bits >> x;
+                    collision |= pixels[0] & spriteRow;
+                    // XOR the pixels in the display with the sprite
+                    pixels[0] ^= spriteRow;
+                    // Only rows with sprite pixels change
+                    rows |= static_cast<uint64_t>(spriteRow != 0) << line;
+                } else {
+                    Row spriteRow = placeSpriteRow<Quirks::WRAP_SPRITES>(bits, x);
+                    collision |= (pixels[0] & spriteRow[0]) | (pixels[1] & spriteRow[1]);
+                    pixels[0] ^= spriteRow[0];
+                    pixels[1] ^= spriteRow[1];
+                    rows |= static_cast<uint64_t>((spriteRow[0] | spriteRow[1]) != 0) << line;
                 }
-                case 0x000E: {
-                    // opcode: 0x8XYE
-                    // Shift VX to the left by 1, and store the shifted bit
-                    // into VF
-                    uint8_t vx = registers.at((opcode & 0x0F00) >> 8);
-                    registers.at((opcode & 0x0F00) >> 8) <<= 1;
-                    registers.at(15) = (vx & 0x80) >> 7;
+            }
+            address += height * bytesPerRow;
+        }
+        registers[15] = collision != 0; // VF set to 1 if any pixel was turned off
+        markDirty(rows);
+        hooks.draw(collision != 0);
+        CHIP8_SIDE_EFFECT();
+        if constexpr (Quirks::DISPLAY_WAIT) {
+            // The original interpreter waits for the next 60Hz interrupt
+            // before drawing, so the rest of the frame is spent waiting
+            waitingForTick = true;
+            idleCycles += cycles;
+            cycles = 0;
+        }
+        DISPATCH();
+    }
+    TARGET(SkipKey) {
+        // opcode: 0xEX9E
+        // Skip next instruction if key VX is pressed
+        if (element<CHECKED>(keypad, registers[inst->x])) {
+            CHIP8_SKIP();
+        }
+        DISPATCH();
+    }
+    TARGET(SkipNotKey) {
+        // opcode: 0xEXA1
+        // Skip next instruction if key VX is not pressed
+        if (!element<CHECKED>(keypad, registers[inst->x])) {
+            CHIP8_SKIP();
+        }
+        DISPATCH();
+    }
+    TARGET(GetDelay) {
+        // opcode: 0xFX07
+        // Set VX to the value of the delay timer
+        registers[inst->x] = delayTimer;
+        hooks.readDelay(pc - 2, delayTimer);
+        DISPATCH();
+    }
+    TARGET(WaitKey) {
+        // opcode: 0xFX0A
+        // Wait for a key input and store in VX
+        bool wasWaitingForPress = waitingForKeyPress;
+        CHIP8_SIDE_EFFECT();
+        if (waitingForKeyPress) {
+            // Check if any key is currently pressed.
+            for (size_t i = 0; i < keypad.size(); ++i) {
+                if (keypad[i]) {
+                    waitingForKeyPress = false;
+                    keyPressed = static_cast<int8_t>(i);
+                    registers[inst->x] = keyPressed;
                     break;
                 }
             }
-            break;
+        } else {
+            // We have to wait for realese
+            // If the previously pressed key is now released, we can go to next instruction.
+            if (!keypad[keyPressed]) {
+                waitingForKeyPress = true;
+                keyPressed = -1;
+                DISPATCH();
+            }
         }
-        case 0x9000: // opcode: 0x9XY0
-            // Skip next instruction if VX != VY
-            if (registers.at((opcode & 0x0F00) >> 8) != registers.at((opcode & 0x00F0) >> 4)) {
-                pc += 2;
+
+        // If key not pressed and then released, continue waiting
+        pc -= 2;
+        hooks.waitKey();
+        if constexpr (!Hooks::ENABLED) {
+            // Nothing changed, and the keys stay the same until run()
+            // returns, so the rest of the cycles would all wait here
+            if (skipIdle && waitingForKeyPress == wasWaitingForPress) {
+                idleCycles += cycles;
+                cycles = 0;
             }
-            break;
-        case 0xA000: // opcode: 0xANNN
-            // Sets index register I to address NNN
-            index = opcode & 0x0FFF;
-            break;
-        case 0xB000: // opcode: 0xBNNN
-            // Jumps to the address NNN
-            pc = (opcode & 0x0FFF) + registers.at(0);
-            break;
-        case 0xC000: {
-            // opcode: 0xCXNN
-            // Sets VX to a random number between 0 and 255 with a mask NN
-            registers.at((opcode & 0x0F00) >> 8) = randByte(randGen) & (opcode & 0x00FF);
-            break;
         }
-        case 0xD000: {
-            // opcode: 0xDXYN
-            // Draw sprite to coordinate (VX, VY) with a width of 8 pixels and a
-            // height of N pixels. Sprite starts at memory location I. X and y
-            // are the top left corner of the sprite.
-            uint8_t x = registers.at((opcode & 0x0F00) >> 8) % SCREEN_WIDTH;
-            uint8_t y = registers.at((opcode & 0x00F0) >> 4) % SCREEN_HEIGHT;
-            uint8_t height = opcode & 0x000F;
-
-            registers.at(15) = 0; // Clear the collision flag before drawing
-            // Iterate through each row of the sprite
-            for (uint8_t row = 0; row < height && y + row < SCREEN_HEIGHT; row++) {
-                // Iterate through each pixel in the row
-                uint8_t spriteByte = memory.at(index + row);
-                for (uint8_t col = 0; col < 8 && x + col < SCREEN_WIDTH; col++) {
-                    // Check if the pixel in the sprite is set to 1
-                    if ((spriteByte & (0x80 >> col)) != 0) {
-                        // Check if the pixel in the display is also set to 1
-                        if (display.at(y + row).at(x + col) == 1) {
-                            registers.at(15) = 1; // VF set to 1 (collision)
-                        }
-                        // XOR the pixel in the display with the sprite
-                        display.at(y + row).at(x + col) ^= 1;
-                    }
-                }
+        DISPATCH();
+    }
+    TARGET(SetDelay) {
+        // opcode: 0xFX15
+        // Set dalay timer to VX
+        delayTimer = registers[inst->x];
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(SetSound) {
+        // opcode: 0xFX18
+        // Set sound timer to VX
+        soundTimer = registers[inst->x];
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(AddIndex) {
+        // opcode: 0xFX1E
+        // Add VX to index register I
+        index += registers[inst->x];
+        DISPATCH();
+    }
+    TARGET(FontChar) {
+        // opcode: 0xFX29
+        // Set index register I to address of hexadecimal character in VX
+        index = FONT_ADDRESS + (registers[inst->x] * 5);
+        DISPATCH();
+    }
+    TARGET(StoreBCD) {
+        // opcode: 0xFX33
+        // Store VX as a three decimal digit with each digit in a
+        // separate memory location at I
+        // ex. if vx contains 156 (0x86), it would put the number 1,
+        // at address in I, 5 in address I+1, and 6 in address I+2
+        int vx = registers[inst->x];
+        stampWrites<Quirks>(index, 3);
+        writeMemory<Quirks, CHECKED>(index, vx / 100);
+        writeMemory<Quirks, CHECKED>(index + 1, (vx / 10) % 10);
+        writeMemory<Quirks, CHECKED>(index + 2, vx % 10);
+        hooks.write(index, vx / 100);
+        hooks.write(index + 1, (vx / 10) % 10);
+        hooks.write(index + 2, vx % 10);
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(StoreRegisters) {
+        // opcode: 0xFX55
+        // Stores from V0 to VX (inclusive) in memory starting at
+        // address I. Each register gets its own memory address
+        stampWrites<Quirks>(index, inst->x + 1);
+        for (uint8_t i = 0; i <= inst->x; i++) {
+            writeMemory<Quirks, CHECKED>(index + i, registers[i]);
+            hooks.write(index + i, registers[i]);
+        }
+        advanceIndex<Quirks>(index, inst->x);
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(LoadRegisters) {
+        // opcode: 0xFX65
+        // Fills from V0 to VX (inclusive) with values from memory,
+        // starting at address I.
+        for (uint8_t i = 0; i <= inst->x; i++) {
+            registers[i] = element<CHECKED, Quirks::MEMORY_SIZE>(memory, index + i);
+        }
+        advanceIndex<Quirks>(index, inst->x);
+        DISPATCH();
+    }
+
+    TARGET(ScrollDown) {
+        // opcode: 0x00CN
+        // Scroll the display down by N pixels
+        scroll(0, inst->nn & 0x0F);
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(ScrollRight) {
+        // opcode: 0x00FB
+        // Scroll the display right by 4 pixels
+        scroll(4, 0);
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(ScrollLeft) {
+        // opcode: 0x00FC
+        // Scroll the display left by 4 pixels
+        scroll(-4, 0);
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(Exit) {
+        // opcode: 0x00FD
+        // Exit the interpreter. The program stays on this instruction for good.
+        pc -= 2;
+        if constexpr (!Hooks::ENABLED) {
+            if (skipIdle) {
+                idleCycles += cycles;
+                cycles = 0;
             }
+        }
+        DISPATCH();
+    }
+    TARGET(LowRes) {
+        // opcode: 0x00FE
+        // Switch to 64x32 and clear the display
+        setHires(false);
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(HighRes) {
+        // opcode: 0x00FF
+        // Switch to 128x64 and clear the display
+        setHires(true);
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(BigFontChar) {
+        // opcode: 0xFX30
+        // Set index register I to the 8x10 sprite of the digit in VX
+        index = BIG_FONT_ADDRESS + (registers[inst->x] & 0x0F) * 10;
+        DISPATCH();
+    }
+    TARGET(StoreFlags) {
+        // opcode: 0xFX75
+        // Store V0 to VX (inclusive) in the flag registers
+        std::copy_n(registers.begin(), inst->x + 1, flags.begin());
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(LoadFlags) {
+        // opcode: 0xFX85
+        // Fill V0 to VX (inclusive) from the flag registers
+        std::copy_n(flags.begin(), inst->x + 1, registers.begin());
+        DISPATCH();
+    }
+    TARGET(ScrollUp) {
+        // opcode: 0x00DN
+        // Scroll the display up by N pixels
+        scroll(0, -(inst->nn & 0x0F));
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(StoreRange) {
+        // opcode: 0x5XY2
+        // Store VX to VY in memory starting at I, in descending order if
+        // X > Y. I is left unchanged.
+        int step = inst->x <= inst->y ? 1 : -1;
+        stampWrites<Quirks>(index, (step > 0 ? inst->y - inst->x : inst->x - inst->y) + 1);
+        for (int i = 0, reg = inst->x;; i++, reg += step) {
+            writeMemory<Quirks, CHECKED>(index + i, registers[reg]);
+            hooks.write(index + i, registers[reg]);
+            if (reg == inst->y) break;
+        }
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(LoadRange) {
+        // opcode: 0x5XY3
+        // Fill VX to VY from memory starting at I, in descending order if
+        // X > Y. I is left unchanged.
+        int step = inst->x <= inst->y ? 1 : -1;
+        for (int i = 0, reg = inst->x;; i++, reg += step) {
+            registers[reg] = element<CHECKED, Quirks::MEMORY_SIZE>(memory, index + i);
+            if (reg == inst->y) break;
+        }
+        DISPATCH();
+    }
+    TARGET(SetIndexLong) {
+        // opcode: 0xF000 NNNN
+        // Set index register I to the 16-bit address in the next two bytes
+        index = static_cast<uint16_t>((element<CHECKED, Quirks::MEMORY_SIZE>(memory, pc) << 8) |
+                                      element<CHECKED, Quirks::MEMORY_SIZE>(memory, size_t{pc} + 1));
+        pc += 2;
+        DISPATCH();
+    }
+    TARGET(SelectPlanes) {
+        // opcode: 0xFN01
+        // Select the planes N (bit 0: plane 0, bit 1: plane 1) that
+        // drawing, clearing and scrolling affect
+        planeMask = inst->x & 0x3;
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(LoadAudio) {
+        // opcode: 0xF002
+        // Load the 16-byte audio pattern from memory starting at I
+        for (unsigned int i = 0; i < audioPattern.size(); i++) {
+            audioPattern[i] = element<CHECKED, Quirks::MEMORY_SIZE>(memory, index + i);
+        }
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+    TARGET(SetPitch) {
+        // opcode: 0xFX3A
+        // Set the playback pitch of the audio pattern to VX
+        pitch = registers[inst->x];
+        CHIP8_SIDE_EFFECT();
+        DISPATCH();
+    }
+
+#ifndef CHIP8_COMPUTED_GOTO
+        case Op::Count:
             break;
+    }
+    goto dispatch;
+#endif
+
+#undef DISPATCH
+#undef TARGET
+}
+#undef CHIP8_HOOK_INSTRUCTION
+#undef CHIP8_HOOK_BREAK
+#undef CHIP8_SKIP
+#undef CHIP8_SIDE_EFFECT
+
+void Chip8::toARGB(uint32_t *pixels, size_t pitch, const Palette &palette) const {
+    unsigned int width = getWidth();
+    for (unsigned int y = 0; y < getHeight(); y++) {
+        rowToARGB(display, y, width, pixels + y * pitch, palette);
+    }
+}
+
+void Chip8::toARGB(uint32_t *pixels, size_t pitch, uint32_t onColor, uint32_t offColor) const {
+    toARGB(pixels, pitch, Palette{offColor, onColor, onColor, onColor});
+}
+
+void Chip8::rowToARGB(const std::array<Plane, PLANES> &planes, unsigned int y, unsigned int width,
+                      uint32_t *line, const Palette &palette) {
+    for (unsigned int x = 0; x < width; x++) {
+        line[x] = palette[pixelColor(planes, y, x)];
+    }
+}
+
+void Chip8::markDirty(uint64_t rows) {
+    dirtyRows |= rows;
+    displayGeneration += rows != 0;
+}
+
+void Chip8::scroll(int dx, int dy) {
+    unsigned int height = getHeight();
+    uint64_t heightMask = height == 64 ? ~0ull : (1ull << height) - 1;
+    uint64_t rows = 0;
+    for (unsigned int plane = 0; plane < PLANES; plane++) {
+        if (!((planeMask >> plane) & 1)) continue;
+        Plane &target = display[plane];
+
+        // Rows that have pixels before the scroll, or get them from it, are
+        // the ones that can change
+        uint64_t occupied = 0;
+        for (unsigned int y = 0; y < height; y++) {
+            occupied |= static_cast<uint64_t>((target[y][0] | target[y][1]) != 0) << y;
         }
-        case 0xE000: {
-            // opcode: 0xEX__
-            switch (opcode & 0x00FF) {
-                case 0x009E: {
-                    // opcode: 0xEX9E
-                    // Skip next instruction if key VX is pressed
-                    int key = registers.at((opcode & 0x0F00) >> 8);
-                    if (keypad.at(key)) {
-                        pc += 2;
-                    }
-                    break;
-                }
-                case 0x00A1: {
-                    // opcode: 0xEXA1
-                    // Skip next instruction if key VX is not pressed
-                    int key = registers.at((opcode & 0x0F00) >> 8);
-                    if (!keypad.at(key)) {
-                        pc += 2;
-                    }
-                    break;
+        rows |= occupied;
+
+        // Rows move with a memmove, and sideways each row shifts as one word
+        // (lo-res) or a pair of words (hi-res)
+        if (dy > 0) {
+            unsigned int distance = std::min<unsigned int>(dy, height);
+            std::copy_backward(target.begin(), target.begin() + (height - distance), target.begin() + height);
+            std::fill(target.begin(), target.begin() + distance, Row{});
+            rows |= (occupied << distance) & heightMask;
+        } else if (dy < 0) {
+            unsigned int distance = std::min<unsigned int>(-dy, height);
+            std::copy(target.begin() + distance, target.begin() + height, target.begin());
+            std::fill(target.begin() + (height - distance), target.begin() + height, Row{});
+            rows |= occupied >> distance;
+        }
+        if (dx != 0) {
+            unsigned int distance = dx > 0 ? dx : -dx;
+            for (unsigned int y = 0; y < height; y++) {
+                Row &row = target[y];
+                if (!hires) {
+                    row[0] = dx > 0 ? row[0] >> distance : row[0] << distance;
+                } else if (dx > 0) {
+                    row[1] = (row[1] >> distance) | (row[0] << (64 - distance));
+                    row[0] >>= distance;
+                } else {
+                    row[0] = (row[0] << distance) | (row[1] >> (64 - distance));
+                    row[1] <<= distance;
                 }
             }
-            break;
         }
-        case 0xF000: {
-            // opcode: 0xF___
-            switch (opcode & 0x00FF) {
-                case 0x0007: // opcode: 0xFX07
-                    // Set VX to the value of the delay timer
-                    registers.at((opcode & 0x0F00) >> 8) = delayTimer;
-                    break;
-                case 0x000A: { // opcode: 0xFX0A
-                    // Wait for a key input and store in VX
-                    static bool waitingForKeyPress = true;
-                    static int keyPressed = -1;
-
-                    if (waitingForKeyPress) {
-                        // Check if any key is currently pressed.
-                        for (int i = 0; i < keypad.size(); ++i) {
-                            if (keypad.at(i)) {
-                                waitingForKeyPress = false;
-                                keyPressed = i;
-                                registers.at((opcode & 0x0F00) >> 8) = keyPressed;
-                                break;
-                            }
-                        }
-                    } else {
-                        // We have to wait for realese
-                        // If the previously pressed key is now released, we can go to next instruction.
-                        if (!keypad.at(keyPressed)) {
-                            waitingForKeyPress = true;
-                            keyPressed = -1;
-                            break;
-                        }
-                    }
-
-                    // If key not pressed and then released, continue waiting
-                    pc -= 2;
-                    break;
-                }
-                case 0x0015: // opcode: 0xFX15
-                    // Set dalay timer to VX
-                    delayTimer = registers.at((opcode & 0x0F00) >> 8);
-                    break;
-                case 0x0018: // opcode: 0xFX18
-                    // Set sound timer to VX
-                    soundTimer = registers.at((opcode & 0x0F00) >> 8);
-                    break;
-                case 0x001E: // opcode: 0xFX1E
-                    // Add VX to index register I
-                    index += registers.at((opcode & 0x0F00) >> 8);
-                    break;
-                case 0x0029: // opcode: 0xFX29
-                    // Set index register I to address of hexadecimal character in VX
-                    index = FONT_ADDRESS + (registers.at((opcode & 0x0F00) >> 8) * 5);
-                    break;
-                case 0x0033: {
-                    // opcode: 0xFX33
-                    // Store VX as a three decimal digit with each digit in a
-                    // separate memory location at I
-                    // ex. if vx contains 156 (0x86), it would put the number 1,
-                    // at address in I, 5 in address I+1, and 6 in address I+2
-                    int vx = registers.at((opcode & 0x0F00) >> 8);
-                    memory.at(index) = vx / 100;
-                    memory.at(index + 1) = (vx / 10) % 10;
-                    memory.at(index + 2) = vx % 10;
-                    break;
-                }
-                case 0x0055: {
-                    // opcode: 0xFX55
-                    // Stores from V0 to VX (inclusive) in memory starting at
-                    // address I. Each register gets its own memory address
-                    uint8_t x = (opcode & 0x0F00) >> 8;
-                    for (uint8_t i = 0; i <= x; i++) {
-                        memory.at(index + i) = registers.at(i);
-                    }
-                    break;
-                }
-                case 0x0065: {
-                    // opcode: 0xFX65
-                    // Fills from V0 to VX (inclusive) with values from memory,
-                    // starting at address I.
-                    uint8_t x = (opcode & 0x0F00) >> 8;
-                    for (uint8_t i = 0; i <= x; i++) {
-                        registers.at(i) = memory.at(index + i);
-                    }
-                    break;
-                }
+    }
+    markDirty(rows);
+}
+
+void Chip8::clearPlanes() {
+    uint64_t rows = 0;
+    for (unsigned int plane = 0; plane < PLANES; plane++) {
+        if (!((planeMask >> plane) & 1)) continue;
+        for (unsigned int y = 0; y < HIRES_HEIGHT; y++) {
+            Row &row = display[plane][y];
+            rows |= static_cast<uint64_t>((row[0] | row[1]) != 0) << y;
+            row = Row{};
+        }
+    }
+    markDirty(rows);
+}
+
+void Chip8::setHires(bool enabled) {
+    // Both SUPER-CHIP and XO-CHIP clear every plane when switching
+    uint64_t rows = 0;
+    for (Plane &plane: display) {
+        for (unsigned int y = 0; y < HIRES_HEIGHT; y++) {
+            rows |= static_cast<uint64_t>((plane[y][0] | plane[y][1]) != 0) << y;
+            plane[y] = Row{};
+        }
+    }
+    if (enabled != hires) rows = ~0ull;
+    hires = enabled;
+    markDirty(rows);
+}
+
+uint64_t Chip8::displayHash() const {
+    uint64_t hash = 0xcbf29ce484222325;
+    auto mix = [&hash](uint64_t word) {
+        for (int i = 0; i < 8; i++) {
+            hash ^= (word >> (i * 8)) & 0xFF;
+            hash *= 0x100000001b3;
+        }
+    };
+    for (unsigned int y = 0; y < SCREEN_HEIGHT; y++) mix(display[0][y][0]);
+
+    // The hi-res half and plane 1 only count once used, so a plain CHIP-8
+    // screen hashes the same as it did before they existed
+    if (hires) mix(0xFF);
+    for (unsigned int plane = 0; plane < PLANES; plane++) {
+        for (unsigned int y = 0; y < HIRES_HEIGHT; y++) {
+            for (unsigned int word = 0; word < 2; word++) {
+                if (plane == 0 && y < SCREEN_HEIGHT && word == 0) continue;
+                uint64_t value = display[plane][y][word];
+                if (value == 0) continue;
+                mix((plane << 16) | (y << 8) | word);
+                mix(value);
             }
-            break;
         }
     }
+    return hash;
+}
+
+namespace {
+
+// Words of the display, the input of checkpointHash()
+constexpr size_t DISPLAY_WORDS = Chip8::PLANES * Chip8::HIRES_HEIGHT * 2;
+
+// One random key per display word (splitmix64)
+constexpr std::array<uint64_t, DISPLAY_WORDS> makeHashKeys() {
+    std::array<uint64_t, DISPLAY_WORDS> keys{};
+    uint64_t state = 0x43384B4559534545;
+    for (uint64_t &key: keys) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        key = z ^ (z >> 31);
+    }
+    return keys;
+}
+constexpr std::array<uint64_t, DISPLAY_WORDS> HASH_KEYS = makeHashKeys();
+
+// NH universal hash: every word plus its key, as two 32-bit halves, and the
+// halves multiplied to 64 bits and summed. There is no dependency from one
+// word to the next, so it runs four words per AVX2 instruction.
+uint64_t nhGeneric(const uint64_t *words) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < DISPLAY_WORDS; i++) {
+        uint32_t low = static_cast<uint32_t>(words[i]) + static_cast<uint32_t>(HASH_KEYS[i]);
+        uint32_t high = static_cast<uint32_t>(words[i] >> 32) + static_cast<uint32_t>(HASH_KEYS[i] >> 32);
+        sum += static_cast<uint64_t>(low) * high;
+    }
+    return sum;
+}
+
+#ifdef CHIP8_AVX2_HASH
+CHIP8_TARGET_AVX2 uint64_t nhAvx2(const uint64_t *words) {
+    __m256i sum = _mm256_setzero_si256();
+    for (size_t i = 0; i < DISPLAY_WORDS; i += 4) {
+        __m256i word = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i));
+        __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(HASH_KEYS.data() + i));
+        __m256i halves = _mm256_add_epi32(word, key);
+        sum = _mm256_add_epi64(sum, _mm256_mul_epu32(halves, _mm256_srli_epi64(halves, 32)));
+    }
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+// murmur3 finalizer
+uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 33)) * 0xFF51AFD7ED558CCD;
+    z = (z ^ (z >> 33)) * 0xC4CEB9FE1A85EC53;
+    return z ^ (z >> 33);
+}
+
+} // namespace
+
+uint64_t Chip8::checkpointHash() const {
+    static_assert(sizeof(display) == DISPLAY_WORDS * sizeof(uint64_t));
+    const uint64_t *words = display[0][0].data();
+#ifdef CHIP8_AVX2_HASH
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    uint64_t hash = avx2 ? nhAvx2(words) : nhGeneric(words);
+#else
+    uint64_t hash = nhGeneric(words);
+#endif
+
+    // Registers in little-endian order, so hashes are the same on every host
+    uint64_t low = 0;
+    uint64_t high = 0;
+    for (unsigned int i = 0; i < 8; i++) {
+        low |= static_cast<uint64_t>(registers[i]) << (i * 8);
+        high |= static_cast<uint64_t>(registers[i + 8]) << (i * 8);
+    }
+    hash = mix64(hash ^ hires);
+    hash = mix64(hash ^ low);
+    hash = mix64(hash ^ high);
+    return mix64(hash ^ ((static_cast<uint64_t>(index) << 16) | pc));
+}
+
+uint64_t Chip8::stateHash() const {
+    uint64_t hash = displayHash();
+    auto mix = [&hash](unsigned int byte) {
+        hash ^= byte & 0xFF;
+        hash *= 0x100000001b3;
+    };
+    for (uint8_t value: registers) mix(value);
+    mix(index);
+    mix(index >> 8);
+    mix(pc);
+    mix(pc >> 8);
+    mix(delayTimer);
+    mix(soundTimer);
+    return hash;
+}
+
+uint16_t Chip8::getKeys() const {
+    uint16_t keys = 0;
+    for (unsigned int key = 0; key < keypad.size(); key++) {
+        keys |= keypad[key] << key;
+    }
+    return keys;
+}
+
+void Chip8::setKeys(uint16_t keys) {
+    for (unsigned int key = 0; key < keypad.size(); key++) {
+        keypad[key] = (keys >> key) & 1;
+    }
+}
+
+void Chip8::tickTimers() {
+    if (delayTimer > 0) delayTimer--;
+    if (soundTimer > 0) soundTimer--;
+    waitingForTick = false;
+
+    if (frameSink) {
+        if (displayGeneration != sinkGeneration) {
+            sinkGeneration = displayGeneration;
+            frameSink->frame(sinkFrame, *this);
+        }
+        sinkFrame++;
+    }
+}
+
+void Chip8::setFrameSink(FrameSink *sink) {
+    frameSink = sink;
+    sinkFrame = 0;
+    // Generations start at 1, so the first frame always goes out
+    sinkGeneration = 0;
+}
+
+uint8_t Chip8::randomByte() {
+    randState ^= randState << 13;
+    randState ^= randState >> 17;
+    randState ^= randState << 5;
+    return static_cast<uint8_t>(randState >> 24);
+}
+
+namespace {
+
+constexpr char STATE_MAGIC[4] = {'C', '8', 'S', 'S'};
+constexpr uint16_t STATE_VERSION = 2;
+
+// Little-endian writer and reader for save states, each call advances the pointer
+template <typename T>
+void put(uint8_t *&out, T value) {
+    for (size_t i = 0; i < sizeof(T); i++) {
+        *out++ = static_cast<uint8_t>(static_cast<uint64_t>(value) >> (i * 8));
+    }
+}
+
+template <typename T>
+T get(const uint8_t *&in) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        value |= static_cast<uint64_t>(*in++) << (i * 8);
+    }
+    return static_cast<T>(value);
+}
+
+} // namespace
+
+void Chip8::saveState(uint8_t *out) const {
+    std::memcpy(out, STATE_MAGIC, sizeof(STATE_MAGIC));
+    out += sizeof(STATE_MAGIC);
+    put<uint16_t>(out, STATE_VERSION);
+
+    put<uint32_t>(out, static_cast<uint32_t>(memory.size()));
+    std::memcpy(out, memory.data(), memory.size());
+    out += memory.size();
+    std::memcpy(out, registers.data(), REGISTER_COUNT);
+    out += REGISTER_COUNT;
+    put<uint8_t>(out, hires);
+    put<uint8_t>(out, planeMask);
+    for (const Plane &plane: display) {
+        for (const Row &row: plane) {
+            put<uint64_t>(out, row[0]);
+            put<uint64_t>(out, row[1]);
+        }
+    }
+    for (uint16_t address: stack) put<uint16_t>(out, address);
+
+    put<uint16_t>(out, index);
+    put<uint16_t>(out, pc);
+    put<uint8_t>(out, sp);
+    put<uint8_t>(out, delayTimer);
+    put<uint8_t>(out, soundTimer);
+
+    put<uint16_t>(out, getKeys());
+    put<uint8_t>(out, static_cast<uint8_t>(waitingForKeyPress | (waitingForTick << 1)));
+    put<int8_t>(out, keyPressed);
+    put<uint32_t>(out, randState);
+
+    std::memcpy(out, flags.data(), flags.size());
+    out += flags.size();
+    std::memcpy(out, audioPattern.data(), audioPattern.size());
+    out += audioPattern.size();
+    put<uint8_t>(out, pitch);
+}
+
+std::vector<uint8_t> Chip8::saveState() const {
+    std::vector<uint8_t> state(stateSize());
+    saveState(state.data());
+    return state;
+}
+
+bool Chip8::loadState(const uint8_t *data, size_t size) {
+    if (size < STATE_FIXED_SIZE || std::memcmp(data, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0) {
+        std::cerr << "Error: Not a save state." << std::endl;
+        return false;
+    }
+    const uint8_t *in = data + sizeof(STATE_MAGIC);
+    if (get<uint16_t>(in) != STATE_VERSION) {
+        std::cerr << "Error: Unsupported save state version." << std::endl;
+        return false;
+    }
+    if (get<uint32_t>(in) != memory.size() || size != stateSize()) {
+        std::cerr << "Error: Save state is for a different memory size." << std::endl;
+        return false;
+    }
+    // Check the stack pointer and the key being waited on before anything
+    // changes, as the run loop indexes the stack and keypad with them
+    const uint8_t *counters = in + memory.size() + REGISTER_COUNT + 2 + sizeof(display) + sizeof(stack) + 4;
+    uint8_t savedSp = counters[0];
+    auto savedKey = static_cast<int8_t>(counters[6]);
+    if (savedSp > stack.size() || savedKey < -1 || savedKey >= static_cast<int8_t>(keypad.size())) {
+        std::cerr << "Error: Save state is damaged." << std::endl;
+        return false;
+    }
+
+    // Only touch the bytes that differ, which keeps the rest of the decoded
+    // instruction cache valid
+    size_t mask = memory.size() - 1;
+    uint64_t stamp = 0;
+    for (size_t address = 0; address < memory.size(); address++) {
+        if (memory[address] == in[address]) continue;
+        size_t previous = (address - 1) & mask;
+        memory[address] = in[address];
+        decoded[address].op = Op::Decode;
+        decoded[previous].op = Op::Decode;
+        if (stamp == 0) stamp = newStamps(1);
+        pageStamps[address >> PAGE_SHIFT] = stamp;
+        pageStamps[previous >> PAGE_SHIFT] = stamp;
+    }
+    in += memory.size();
+    std::memcpy(registers.data(), in, REGISTER_COUNT);
+    in += REGISTER_COUNT;
+    bool wasHires = hires;
+    hires = get<uint8_t>(in) & 1;
+    planeMask = get<uint8_t>(in) & 3;
+    uint64_t rows = hires != wasHires ? ~0ull : 0;
+    for (Plane &plane: display) {
+        for (unsigned int y = 0; y < HIRES_HEIGHT; y++) {
+            Row row;
+            row[0] = get<uint64_t>(in);
+            row[1] = get<uint64_t>(in);
+            rows |= static_cast<uint64_t>(row != plane[y]) << y;
+            plane[y] = row;
+        }
+    }
+    markDirty(rows);
+    for (uint16_t &address: stack) address = get<uint16_t>(in);
+
+    index = get<uint16_t>(in);
+    pc = get<uint16_t>(in);
+    sp = get<uint8_t>(in);
+    delayTimer = get<uint8_t>(in);
+    soundTimer = get<uint8_t>(in);
+
+    setKeys(get<uint16_t>(in));
+    uint8_t waitFlags = get<uint8_t>(in);
+    waitingForKeyPress = waitFlags & 1;
+    waitingForTick = waitFlags & 2;
+    keyPressed = get<int8_t>(in);
+    randState = get<uint32_t>(in);
+
+    std::memcpy(flags.data(), in, flags.size());
+    in += flags.size();
+    std::memcpy(audioPattern.data(), in, audioPattern.size());
+    in += audioPattern.size();
+    pitch = get<uint8_t>(in);
+    return true;
 }
 
 bool Chip8::loadROM(const std::string &filename) {
@@ -342,21 +1414,127 @@ bool Chip8::loadROM(const std::string &filename) {
     }
 
     // Get the size of the file and reposition the file pointer to the beginning.
-    std::streampos size = file.tellg();
+    std::streamoff size = file.tellg();
     file.seekg(0, std::ios::beg);
 
-    if (size > MEMORY_SIZE - ROM_OFFSET) {
-        std::cerr << "Error: ROM file is too large." << std::endl;
+    // Check the size before allocating; tellg() gives -1 if it failed
+    if (size < 0 || static_cast<uint64_t>(size) > memory.size() - ROM_OFFSET) {
+        std::cerr << "Error: ROM file is too large or could not be read." << std::endl;
         return false;
     }
 
-    // Read the ROM data into the Chip-8's memory.
+    // Read the ROM data into a buffer and copy it into the Chip-8's memory.
     // reinterpret_cast<char*> takes forces the datatype to be "relabeled as char*"
     // without changing the data.
     // .data() gives us a raw pointer to the underlying array.
-    file.read(reinterpret_cast<char *>(memory.data() + ROM_OFFSET), size);
+    std::vector<uint8_t> rom(static_cast<size_t>(size));
+    file.read(reinterpret_cast<char *>(rom.data()), size);
 
     file.close();
 
+    return loadROM(rom.data(), rom.size());
+}
+
+bool Chip8::loadROM(const uint8_t *data, size_t size) {
+    if (size > memory.size() - ROM_OFFSET) {
+        std::cerr << "Error: ROM file is too large." << std::endl;
+        return false;
+    }
+
+    std::copy(data, data + size, memory.begin() + ROM_OFFSET);
+
+    // Drop anything decoded from the previous contents of memory
+    std::fill(decoded.begin(), decoded.end(), Instruction{});
+
+    // Keep this state for reset(), and let forks of this instance share it
+    bootMemory = std::make_shared<const std::vector<uint8_t>>(memory);
+    bootStamp = newStamps(pageStamps.size());
+    for (size_t page = 0; page < pageStamps.size(); page++) pageStamps[page] = bootStamp + page;
+
     return true;
 }
+
+void Chip8::restampPages() {
+    uint64_t first = newStamps(pageStamps.size());
+    for (size_t page = 0; page < pageStamps.size(); page++) pageStamps[page] = first + page;
+}
+
+void Chip8::reset(unsigned int seed) {
+    constexpr size_t PAGE_SIZE = size_t{1} << PAGE_SHIFT;
+    if (bootMemory) {
+        for (size_t page = 0; page < pageStamps.size(); page++) {
+            if (pageStamps[page] == bootStamp + page) continue;
+            size_t start = page << PAGE_SHIFT;
+            std::copy_n(bootMemory->begin() + start, PAGE_SIZE, memory.begin() + start);
+            std::fill_n(decoded.begin() + start, PAGE_SIZE, Instruction{});
+            pageStamps[page] = bootStamp + page;
+        }
+    } else {
+        // No ROM loaded, only the fonts
+        std::fill(memory.begin(), memory.end(), 0);
+        std::copy(std::begin(FONTSET), std::end(FONTSET), memory.begin() + FONT_ADDRESS);
+        std::copy(std::begin(BIG_FONTSET), std::end(BIG_FONTSET), memory.begin() + BIG_FONT_ADDRESS);
+        std::fill(decoded.begin(), decoded.end(), Instruction{});
+        restampPages();
+    }
+
+    registers = {};
+    index = 0;
+    pc = ROM_OFFSET;
+    stack = {};
+    sp = 0;
+    hires = false;
+    planeMask = 1;
+    flags = {};
+    audioPattern = {};
+    pitch = 64;
+    display = {};
+    keypad = {};
+    delayTimer = 0;
+    soundTimer = 0;
+    waitingForKeyPress = true;
+    keyPressed = -1;
+    waitingForTick = false;
+    idleCycles = 0;
+    seedRandom(seed);
+    markDirty(~0ull);
+}
+
+void Chip8::forkFrom(const Chip8 &parent) {
+    if (&parent == this) return;
+    if (quirks != parent.quirks || checked != parent.checked) {
+        setQuirks(parent.quirks, parent.checked);
+    }
+
+    constexpr size_t PAGE_SIZE = size_t{1} << PAGE_SHIFT;
+    for (size_t page = 0; page < pageStamps.size(); page++) {
+        if (pageStamps[page] == parent.pageStamps[page]) continue;
+        size_t start = page << PAGE_SHIFT;
+        std::copy_n(parent.memory.begin() + start, PAGE_SIZE, memory.begin() + start);
+        std::copy_n(parent.decoded.begin() + start, PAGE_SIZE, decoded.begin() + start);
+        pageStamps[page] = parent.pageStamps[page];
+    }
+    if (bootMemory != parent.bootMemory) bootMemory = parent.bootMemory;
+    bootStamp = parent.bootStamp;
+
+    registers = parent.registers;
+    index = parent.index;
+    pc = parent.pc;
+    stack = parent.stack;
+    sp = parent.sp;
+    hires = parent.hires;
+    planeMask = parent.planeMask;
+    flags = parent.flags;
+    audioPattern = parent.audioPattern;
+    pitch = parent.pitch;
+    display = parent.display;
+    keypad = parent.keypad;
+    delayTimer = parent.delayTimer;
+    soundTimer = parent.soundTimer;
+    waitingForKeyPress = parent.waitingForKeyPress;
+    keyPressed = parent.keyPressed;
+    waitingForTick = parent.waitingForTick;
+    idleCycles = parent.idleCycles;
+    randState = parent.randState;
+    markDirty(~0ull);
+}
@@ -1,44 +1,328 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
-#include <random>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "Quirks.h"
+
+struct NoProfiling;
+class Profiler;
+class TraceWriter;
+class Debugger;
+class FrameSink;
 
 class Chip8 {
 public:
     static constexpr unsigned int SCREEN_WIDTH = 64;
     static constexpr unsigned int SCREEN_HEIGHT = 32;
+    // SUPER-CHIP and XO-CHIP hi-res mode
+    static constexpr unsigned int HIRES_WIDTH = 128;
+    static constexpr unsigned int HIRES_HEIGHT = 64;
+    // XO-CHIP bit planes, each pixel has one bit per plane
+    static constexpr unsigned int PLANES = 2;
     // Font address is 0x050 to 0x09f in memory
     static constexpr unsigned int FONT_ADDRESS = 0x50;
+    // SUPER-CHIP 8x10 font for FX30, 0x0a0 to 0x13f
+    static constexpr unsigned int BIG_FONT_ADDRESS = 0xA0;
 
-    // Display (64x32 monochrome pixels)
-    std::array<std::array<uint8_t, SCREEN_WIDTH>, SCREEN_HEIGHT> display{};
+    // One display row of a plane, 128 pixels in two words. Pixel x is bit
+    // (63 - x % 64) of word x / 64, so the leftmost pixel is the most
+    // significant bit. In lo-res mode only word 0 and rows 0-31 are used.
+    using Row = std::array<uint64_t, 2>;
+    using Plane = std::array<Row, HIRES_HEIGHT>;
+    // ARGB colors for the pixel values 0-3 (plane 0 is bit 0, plane 1 bit 1)
+    using Palette = std::array<uint32_t, 4>;
+
+    // Display, one bit per pixel and plane. Everything but XO-CHIP only draws to plane 0.
+    std::array<Plane, PLANES> display{};
     std::array<bool, 16> keypad{};                   // Keypad 0-F, true if pressed, false if not pressed
     uint8_t delayTimer{};                            // Timer to achieve 60Hz
     uint8_t soundTimer{};                            // Gives off beeping sound when != 0
 
+    // Seeds the random number generator from std::random_device
     Chip8();
+    // Seeds the random number generator with a fixed value, for reproducible runs
+    explicit Chip8(unsigned int seed);
+
+    // Select the quirks, and whether memory, stack and keypad accesses are
+    // bounds checked (throwing std::out_of_range) or wrap around. Each
+    // combination has its own compiled run loop; this picks one, so the choice
+    // costs nothing per instruction. The default is modern and checked.
+    // Memory is resized to the profile's (64 KB for XO-CHIP), so call this
+    // before loadROM().
+    void setQuirks(QuirkProfile profile, bool checked = true);
+    QuirkProfile getQuirks() const { return quirks; }
+    bool isChecked() const { return checked; }
 
     bool loadROM(const std::string &filename);
+    // Copy a ROM image that is already in memory, e.g. shared between many instances
+    bool loadROM(const uint8_t *data, size_t size);
+
+    // Restart the program: registers, display, timers and keys go back to
+    // their power-on values and memory to what loadROM() left, keeping the
+    // quirks. Only the memory pages written since are restored, so a pool of
+    // instances can be reused without allocating.
+    void reset(unsigned int seed);
+    // Turn this instance into a copy of parent, e.g. to branch a search from
+    // it. Memory pages that parent's and this instance's history have in
+    // common (the ROM and font, typically) are not copied, only those either
+    // of them wrote since, along with their decoded instructions. Allocates
+    // only when the memory size changes.
+    // A Chip8Jit attached to this instance has to be flushed after either.
+    void forkFrom(const Chip8 &parent);
+    // Execute a single instruction
     void cycle();
+    // Execute the given number of instructions back to back. The timers and
+    // keys don't change in between, so once the program is idling until one
+    // of them does, the remaining instructions are skipped instead of run.
+    void run(uint64_t cycles);
+    // Same, but report every instruction and event to the profiler. The plain
+    // run() is a separate copy of the loop without any of the calls.
+    void run(uint64_t cycles, Profiler &profiler);
+    // Same, recording every instruction and its effects (see Trace.h). Idle
+    // loops are run through, so the trace has every instruction.
+    void run(uint64_t cycles, TraceWriter &trace);
+    // Same, stopping early at the debugger's breakpoints, watchpoints and
+    // steps (see Debugger.h). Like the profiled run, it runs through idle loops.
+    void run(uint64_t cycles, Debugger &debugger);
+    // Turn the idle skipping of run() off or back on (the default), e.g. to
+    // time loops whose body leaves the registers as they were. Results are
+    // the same either way, only getIdleCycles() and the host time differ.
+    void setIdleSkipping(bool enabled) { skipIdle = enabled; }
+    // Decrement the delay and sound timers, should be called at 60Hz of emulated time.
+    // This ends a frame, which goes to the frame sink if the display changed.
+    void tickTimers();
+    // Hand the display to sink at the end of every frame in which it changed,
+    // and of the first one, or stop with nullptr. Frames are numbered from 0
+    // at this call. A copy of the machine keeps the sink, forkFrom() and
+    // reset() don't change it.
+    void setFrameSink(FrameSink *sink);
+
+    // Size of a save state, which depends on the size of memory. Version 2
+    // layout, all values little-endian: magic "C8SS", u16 version, u32 memory
+    // size, memory, V0-VF, display mode (bit 0: hi-res), selected planes,
+    // display rows (u64, plane 0 then plane 1, two words per row), stack (u16),
+    // I, PC, SP, delay timer, sound timer, keypad bits (u16), wait flags (bit
+    // 0: FX0A waits for a press, bit 1: DXYN waits for the next tick), FX0A
+    // key, RNG state (u32), flag registers (16), audio pattern (16), pitch.
+    size_t stateSize() const { return STATE_FIXED_SIZE + memory.size(); }
+    // Write the complete machine state to out, which must hold stateSize() bytes
+    void saveState(uint8_t *out) const;
+    std::vector<uint8_t> saveState() const;
+    // Restore a state written by saveState(). Decoded instructions are only
+    // dropped where memory changed, so rolling back a frame is cheap. A Chip8Jit
+    // attached to this instance has to be flushed afterwards.
+    bool loadState(const uint8_t *data, size_t size);
+
+    // XO-CHIP audio: the F002 pattern of 128 one-bit samples and the FX3A
+    // pitch, which plays it at 4000 * 2^((pitch - 64) / 48) samples per second
+    const std::array<uint8_t, 16> &getAudioPattern() const { return audioPattern; }
+    uint8_t getPitch() const { return pitch; }
+
+    uint16_t getPC() const { return pc; }
+    uint16_t getIndex() const { return index; }
+    const std::array<uint8_t, 16> &getRegisters() const { return registers; }
+    // Return addresses of the subroutine calls, the innermost at getStackPointer() - 1
+    const std::array<uint16_t, 16> &getStack() const { return stack; }
+    uint8_t getStackPointer() const { return sp; }
+    size_t getMemorySize() const { return memory.size(); }
+    // Byte of memory, wrapping around at the end like the unchecked run loops
+    uint8_t readMemory(uint16_t address) const { return memory[address & (memory.size() - 1)]; }
+    // Current resolution, 64x32 or 128x64 in hi-res mode
+    bool isHires() const { return hires; }
+    unsigned int getWidth() const { return hires ? HIRES_WIDTH : SCREEN_WIDTH; }
+    unsigned int getHeight() const { return hires ? HIRES_HEIGHT : SCREEN_HEIGHT; }
+    // Pixel value 0-3 with one bit per plane
+    unsigned int getColor(unsigned int x, unsigned int y) const { return pixelColor(display, y, x); }
+    // Whether the pixel is set in any plane
+    bool getPixel(unsigned int x, unsigned int y) const { return getColor(x, y) != 0; }
+    // Keypad as a bit mask, bit N is key N
+    uint16_t getKeys() const;
+    void setKeys(uint16_t keys);
+
+    // Convert the display to 32-bit pixels for presentation, getWidth() by
+    // getHeight() of them. pitch is the distance between rows in pixels.
+    void toARGB(uint32_t *pixels, size_t pitch, const Palette &palette) const;
+    // Same with pixels set in any plane in onColor
+    void toARGB(uint32_t *pixels, size_t pitch, uint32_t onColor, uint32_t offColor) const;
+    // Convert the first width pixels of row y, e.g. of a copy of display
+    static void rowToARGB(const std::array<Plane, PLANES> &planes, unsigned int y, unsigned int width,
+                          uint32_t *line, const Palette &palette);
+
+    // Rows changed by drawing, clearing, scrolling or loadState() since the
+    // last clearDirtyRows(), bit y is row y. Scrolling marks every row that
+    // had or got pixels, and a change of resolution marks all rows. Writes to
+    // display from outside are not tracked.
+    uint64_t getDirtyRows() const { return dirtyRows; }
+    void clearDirtyRows() { dirtyRows = 0; }
+    // Counts the instructions and state loads that changed the display, so a
+    // frontend can skip frames that look the same as the last one it showed
+    uint64_t getDisplayGeneration() const { return displayGeneration; }
+    // Instructions run() did not execute because the program was idling:
+    // sitting in FX0A, or in a loop that only waits for the timers or keys.
+    // They still count as executed, only the host time is saved.
+    uint64_t getIdleCycles() const { return idleCycles; }
+    // True between a draw and the next tickTimers() under the display wait
+    // quirk, while run() executes nothing and the PC stays put
+    bool isWaitingForTick() const { return waitingForTick; }
+    // FNV-1a hash of the display, cheap enough to compare runs frame by frame
+    uint64_t displayHash() const;
+    // displayHash() extended with V0-VF, I, PC and the timers, to tell whether
+    // two runs are still in step
+    uint64_t stateHash() const;
+    // Hash of the whole display, the resolution, V0-VF, I and PC, computed in
+    // one vectorised pass, so it can be taken every frame. Its values differ
+    // from displayHash() and stateHash(), which recorded movies depend on.
+    uint64_t checkpointHash() const;
 
 private:
-    static constexpr unsigned int MEMORY_SIZE = 4096;
+    // The recompiler reads memory and generates code that accesses the registers directly
+    friend class Chip8Jit;
+
+    // Every instruction kind gets its own handler in the dispatch table of run()
+    enum class Op : uint8_t {
+        Decode, // Cache entry is stale and has to be decoded before executing
+        Unknown,
+        ClearScreen, Return, Jump, Call, SkipEqualImm, SkipNotEqualImm, SkipEqualReg, SetImm, AddImm,
+        Move, Or, And, Xor, Add, Sub, ShiftRight, SubReverse, ShiftLeft, SkipNotEqualReg,
+        SetIndex, JumpOffset, Random, Draw, SkipKey, SkipNotKey,
+        GetDelay, WaitKey, SetDelay, SetSound, AddIndex, FontChar, StoreBCD, StoreRegisters, LoadRegisters,
+        // SUPER-CHIP
+        ScrollDown, ScrollRight, ScrollLeft, Exit, LowRes, HighRes, BigFontChar, StoreFlags, LoadFlags,
+        // XO-CHIP
+        ScrollUp, StoreRange, LoadRange, SetIndexLong, SelectPlanes, LoadAudio, SetPitch,
+        Count
+    };
+
+    // An opcode with its operands already extracted, so executing it needs no
+    // masking or shifting. N is the low nibble of NN.
+    struct Instruction {
+        Op op{Op::Decode};
+        uint8_t x{};
+        uint8_t y{};
+        uint8_t nn{};
+        uint16_t nnn{};
+        uint16_t opcode{};
+    };
+
+    // Opcodes of extensions the profile doesn't have decode as Op::Unknown
+    template <typename Quirks>
+    static Instruction decode(uint16_t opcode);
+    // The run loop. Quirks is one of the policies in Quirks.h, CHECKED turns
+    // on bounds checks and Hooks is NoProfiling, Profiler (see Profiler.h),
+    // TraceWriter (see Trace.h) or Debugger (see Debugger.h).
+    template <typename Quirks, bool CHECKED, typename Hooks>
+    void execute(uint64_t cycles, Hooks &hooks);
+    template <typename Quirks, bool CHECKED>
+    void selectRunLoops();
+    template <typename Quirks, bool CHECKED>
+    void writeMemory(size_t address, uint8_t value);
+    // Give the pages that count bytes written from address on affect the
+    // stamp of this run() call. Called before the writes, so the stamps are
+    // right even if one of them throws.
+    template <typename Quirks>
+    void stampWrites(size_t address, size_t count);
+    // Shift the selected planes right by dx and down by dy pixels, negative
+    // values go left and up. Pixels shifted off the screen are lost.
+    void scroll(int dx, int dy);
+    // Clear the selected planes
+    void clearPlanes();
+    void setHires(bool enabled);
+    void markDirty(uint64_t rows);
+    void seedRandom(unsigned int seed);
+    // Give every page a stamp no other instance has
+    void restampPages();
+    static unsigned int pixelColor(const std::array<Plane, PLANES> &planes, unsigned int y, unsigned int x) {
+        unsigned int shift = 63 - x % 64;
+        return ((planes[0][y][x / 64] >> shift) & 1) | (((planes[1][y][x / 64] >> shift) & 1) << 1);
+    }
+
+    // Save state size without memory
+    static constexpr size_t STATE_FIXED_SIZE = 4 + 2 + 4 + 16 + 1 + 1 + PLANES * HIRES_HEIGHT * 2 * 8 + 16 * 2 +
+                                               2 + 2 + 1 + 1 + 1 + 2 + 1 + 1 + 4 + 16 + 16 + 1;
     static constexpr unsigned int REGISTER_COUNT = 16;
     static constexpr unsigned int ROM_OFFSET = 512; // ROM starts at 0x200 (512) in memory
     static constexpr unsigned int STACK_SIZE = 16;
+    static constexpr unsigned int PAGE_SHIFT = 8;   // Pages of 256 bytes for forkFrom() and reset()
 
     // Hardware
     std::array<uint8_t, REGISTER_COUNT> registers{}; // 16 Registers called V0...VF
-    std::array<uint8_t, MEMORY_SIZE> memory{};       // RAM
+    std::vector<uint8_t> memory;                     // RAM, sized by setQuirks()
     uint16_t index{};                                // Index Register (I)
     uint16_t pc{ROM_OFFSET};                         // Program Counter (points at current instruction)
     std::array<uint16_t, STACK_SIZE> stack{};        // Stack for subroutine calls
     uint8_t sp{0};                                   // Stack pointer
-    uint16_t opcode{};                               // Current instruction to be decoded from chip8
 
-    // Helpers to generate random numbers for opcode 0xCXNN
-    std::default_random_engine randGen;
-    std::uniform_int_distribution<uint8_t> randByte;
+    // SUPER-CHIP and XO-CHIP state
+    bool hires{false};
+    uint8_t planeMask{1};                            // Planes that drawing, clearing and scrolling affect
+    std::array<uint8_t, REGISTER_COUNT> flags{};     // FX75/FX85 flag registers
+    std::array<uint8_t, 16> audioPattern{};          // F002 sample pattern, 1 bit per sample
+    uint8_t pitch{64};                               // FX3A playback rate of the pattern
+
+    // Display change tracking, everything starts out dirty so the first frame is shown
+    uint64_t dirtyRows{~0ull};
+    uint64_t displayGeneration{1};
+
+    uint64_t idleCycles{};
+    bool skipIdle{true};
+
+    // Receives the changed frames, see setFrameSink()
+    FrameSink *frameSink{};
+    uint64_t sinkFrame{};
+    uint64_t sinkGeneration{};
+
+    // Decoded instruction cache with one entry per address (instructions may
+    // start at odd addresses). Entries are decoded lazily on first execution and
+    // reset to Op::Decode when the program writes to either of their bytes.
+    std::vector<Instruction> decoded;
+
+    // Every page of memory has a stamp, which is replaced by a new, unique
+    // one whenever the page's bytes or decoded instructions change in a way
+    // a lazy decode wouldn't. Equal stamps for the same page in two instances
+    // mean equal contents, so forkFrom() and reset() can skip those pages.
+    // A write to the first byte of a page also restamps the page before,
+    // whose last instruction includes that byte.
+    std::vector<uint64_t> pageStamps;
+    // Stamp of the pages written during the current run() call, taken at
+    // the first write. No other instance can have it before run() returns,
+    // so all of the call's writes share it.
+    uint64_t writeStamp{};
+    // Memory right after loadROM(), shared by forks. Page N of it has the
+    // stamp bootStamp + N.
+    std::shared_ptr<const std::vector<uint8_t>> bootMemory;
+    uint64_t bootStamp{};
+
+    // State of FX0A, which waits for a key to be pressed and then released
+    bool waitingForKeyPress{true};
+    int8_t keyPressed{-1};
+    // Set by DXYN with the display wait quirk, cleared by tickTimers()
+    bool waitingForTick{false};
+
+    // Run loops for the selected quirks
+    QuirkProfile quirks{QuirkProfile::Modern};
+    bool checked{true};
+    void (Chip8::*runLoop)(uint64_t, NoProfiling &);
+    void (Chip8::*profiledRunLoop)(uint64_t, Profiler &);
+    void (Chip8::*tracedRunLoop)(uint64_t, TraceWriter &);
+    void (Chip8::*debuggedRunLoop)(uint64_t, Debugger &);
+
+    // xorshift32 generator for opcode 0xCXNN. Its whole state is one word and
+    // the sequence is the same on every platform, so it fits in a save state.
+    uint8_t randomByte();
+    uint32_t randState{1};
+};
+
+// Receives the frames of a Chip8, see Chip8::setFrameSink(). FrameRecorder
+// (see FrameRecorder.h) writes them to a file.
+class FrameSink {
+public:
+    virtual ~FrameSink() = default;
+    // Called by tickTimers() on the emulating thread, with the number of the
+    // frame that just ended. The display is only valid during the call.
+    virtual void frame(uint64_t number, const Chip8 &chip8) = 0;
 };
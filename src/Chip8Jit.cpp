@@ -0,0 +1,402 @@
+#include "Chip8Jit.h"
+
+#include "Chip8.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define CHIP8_JIT_AVAILABLE 1
+#include <sys/mman.h>
+#endif
+
+#include <algorithm>
+#include <initializer_list>
+
+namespace {
+
+// Appends raw x86-64 machine code to the code buffer. The generated code only
+// uses rax/rcx/rdx as scratch and rdi as the Chip8 pointer, all of which are
+// caller-saved in the System V ABI, so blocks need no prologue.
+class Emitter {
+public:
+    Emitter(uint8_t *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+
+    bool overflowed() const { return size > capacity; }
+    size_t used() const { return size; }
+
+    void byte(uint8_t value) {
+        if (size < capacity) buffer[size] = value;
+        size++;
+    }
+    void bytes(std::initializer_list<uint8_t> values) {
+        for (uint8_t value: values) byte(value);
+    }
+    void imm16(uint16_t value) {
+        byte(value & 0xFF);
+        byte(value >> 8);
+    }
+    void imm32(uint32_t value) {
+        for (int i = 0; i < 4; i++) byte((value >> (i * 8)) & 0xFF);
+    }
+
+    // ModRM byte for [rdi + disp32] with the given register field
+    void memRdi(uint8_t reg, int32_t disp) {
+        byte(0x87 | (reg << 3));
+        imm32(static_cast<uint32_t>(disp));
+    }
+
+    // movzx r32, byte [rdi + disp]
+    void loadByte(uint8_t reg, int32_t disp) { bytes({0x0F, 0xB6}); memRdi(reg, disp); }
+    // mov byte [rdi + disp], r8
+    void storeByte(int32_t disp, uint8_t reg) { byte(0x88); memRdi(reg, disp); }
+    // mov byte [rdi + disp], imm8
+    void storeByteImm(int32_t disp, uint8_t value) { byte(0xC6); memRdi(0, disp); byte(value); }
+    // add byte [rdi + disp], imm8
+    void addByteImm(int32_t disp, uint8_t value) { byte(0x80); memRdi(0, disp); byte(value); }
+    // cmp byte [rdi + disp], imm8
+    void cmpByteImm(int32_t disp, uint8_t value) { byte(0x80); memRdi(7, disp); byte(value); }
+    // cmp al, byte [rdi + disp]
+    void cmpAlByte(int32_t disp) { byte(0x3A); memRdi(0, disp); }
+    // mov word [rdi + disp], imm16
+    void storeWordImm(int32_t disp, uint16_t value) { bytes({0x66, 0xC7}); memRdi(0, disp); imm16(value); }
+    // mov word [rdi + disp], ax
+    void storeWordAx(int32_t disp) { bytes({0x66, 0x89}); memRdi(0, disp); }
+    // add word [rdi + disp], ax
+    void addWordAx(int32_t disp) { bytes({0x66, 0x01}); memRdi(0, disp); }
+    // mov r32, imm32
+    void movImm(uint8_t reg, uint32_t value) { byte(0xB8 | reg); imm32(value); }
+    // Return the next pc and the number of instructions executed in eax
+    void returnPC(uint32_t pc, uint32_t count) { movImm(RAX, pc | (count << 16)); byte(0xC3); }
+    // Return taken if the cmovcc condition holds for the flags of the previous
+    // compare, notTaken otherwise. Always RETURN_SELECT_SIZE bytes long.
+    void returnSelect(uint8_t cmov, uint32_t taken, uint32_t notTaken, uint32_t count) {
+        movImm(RAX, notTaken | (count << 16));
+        movImm(RCX, taken | (count << 16));
+        bytes({0x0F, cmov, 0xC1});
+        byte(0xC3);
+    }
+    static constexpr uint8_t RETURN_SELECT_SIZE = 14;
+
+    static constexpr uint8_t RAX = 0;
+    static constexpr uint8_t RCX = 1;
+    static constexpr uint8_t RDX = 2;
+
+    static constexpr uint8_t CMOVE = 0x44;
+    static constexpr uint8_t CMOVNE = 0x45;
+
+private:
+    uint8_t *buffer;
+    size_t capacity;
+    size_t size{};
+};
+
+} // namespace
+
+Chip8Jit::Chip8Jit(Chip8 &chip8) : chip8(chip8) {
+    auto *base = reinterpret_cast<uint8_t *>(&chip8);
+    registersOffset = static_cast<int32_t>(reinterpret_cast<uint8_t *>(chip8.registers.data()) - base);
+    indexOffset = static_cast<int32_t>(reinterpret_cast<uint8_t *>(&chip8.index) - base);
+    delayTimerOffset = static_cast<int32_t>(&chip8.delayTimer - base);
+    soundTimerOffset = static_cast<int32_t>(&chip8.soundTimer - base);
+    keypadOffset = static_cast<int32_t>(reinterpret_cast<uint8_t *>(chip8.keypad.data()) - base);
+
+#ifdef CHIP8_JIT_AVAILABLE
+    void *buffer = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer != MAP_FAILED) {
+        code = static_cast<uint8_t *>(buffer);
+    }
+#endif
+}
+
+Chip8Jit::~Chip8Jit() {
+#ifdef CHIP8_JIT_AVAILABLE
+    if (code) munmap(code, CODE_BUFFER_SIZE);
+#endif
+}
+
+bool Chip8Jit::isSupported() {
+#ifdef CHIP8_JIT_AVAILABLE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Chip8Jit::flush() {
+    blocks.fill(Block{});
+    covered.fill(false);
+    codeUsed = 0;
+}
+
+void Chip8Jit::invalidate(uint16_t address, unsigned int length) {
+    // A block covering the written bytes must start at most one block length
+    // before them
+    for (unsigned int i = 0; i < length; i++) {
+        unsigned int written = address + i;
+        if (written >= MEMORY_SIZE || !covered[written]) continue;
+
+        unsigned int first = written >= MAX_BLOCK_INSTRUCTIONS * 2 ? written - MAX_BLOCK_INSTRUCTIONS * 2 : 0;
+        for (unsigned int start = first; start <= written; start++) {
+            Block &block = blocks[start];
+            if (block.compiled && written < block.end) {
+                block = Block{};
+            }
+        }
+    }
+}
+
+Chip8Jit::Block &Chip8Jit::compile(uint16_t address) {
+    Block &block = blocks[address];
+    block.compiled = true;
+
+#ifdef CHIP8_JIT_AVAILABLE
+    if (!code) return block;
+
+    const int32_t regs = registersOffset;
+    const int32_t vf = registersOffset + 15;
+    auto reg = [regs](unsigned int x) { return regs + static_cast<int32_t>(x); };
+
+    mprotect(code, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE);
+    Emitter emit(code + codeUsed, CODE_BUFFER_SIZE - codeUsed);
+
+    uint32_t pc = address;
+    uint16_t count = 0;
+    bool terminated = false;
+
+    while (!terminated && count < MAX_BLOCK_INSTRUCTIONS && pc + 1 < MEMORY_SIZE) {
+        uint16_t opcode = (static_cast<uint16_t>(chip8.memory[pc]) << 8) | chip8.memory[pc + 1];
+        unsigned int x = (opcode & 0x0F00) >> 8;
+        unsigned int y = (opcode & 0x00F0) >> 4;
+        uint8_t nn = opcode & 0x00FF;
+        uint16_t nnn = opcode & 0x0FFF;
+        bool translated = true;
+
+        switch (opcode & 0xF000) {
+            case 0x1000: // 1NNN: jump
+                emit.returnPC(nnn, count + 1);
+                terminated = true;
+                break;
+            case 0x3000: // 3XNN: skip if VX == NN
+                emit.cmpByteImm(reg(x), nn);
+                emit.returnSelect(Emitter::CMOVE, pc + 4, pc + 2, count + 1);
+                terminated = true;
+                break;
+            case 0x4000: // 4XNN: skip if VX != NN
+                emit.cmpByteImm(reg(x), nn);
+                emit.returnSelect(Emitter::CMOVNE, pc + 4, pc + 2, count + 1);
+                terminated = true;
+                break;
+            case 0x5000: // 5XY0: skip if VX == VY
+            case 0x9000: // 9XY0: skip if VX != VY
+                if ((opcode & 0x000F) != 0) {
+                    translated = false;
+                    break;
+                }
+                emit.loadByte(Emitter::RAX, reg(x));
+                emit.cmpAlByte(reg(y));
+                emit.returnSelect((opcode & 0xF000) == 0x5000 ? Emitter::CMOVE : Emitter::CMOVNE, pc + 4, pc + 2,
+                                  count + 1);
+                terminated = true;
+                break;
+            case 0x6000: // 6XNN: VX = NN
+                emit.storeByteImm(reg(x), nn);
+                break;
+            case 0x7000: // 7XNN: VX += NN
+                emit.addByteImm(reg(x), nn);
+                break;
+            case 0x8000:
+                switch (opcode & 0x000F) {
+                    case 0x0: // 8XY0: VX = VY
+                        emit.loadByte(Emitter::RAX, reg(y));
+                        emit.storeByte(reg(x), Emitter::RAX);
+                        break;
+                    case 0x1: // 8XY1: VX |= VY
+                    case 0x2: // 8XY2: VX &= VY
+                    case 0x3: { // 8XY3: VX ^= VY
+                        static constexpr uint8_t aluOps[] = {0x08, 0x20, 0x30}; // or/and/xor al, cl
+                        emit.loadByte(Emitter::RAX, reg(x));
+                        emit.loadByte(Emitter::RCX, reg(y));
+                        emit.bytes({aluOps[(opcode & 0x000F) - 1], 0xC8});
+                        emit.storeByte(reg(x), Emitter::RAX);
+                        break;
+                    }
+                    case 0x4: // 8XY4: VX += VY, VF = carry
+                        emit.loadByte(Emitter::RAX, reg(x));
+                        emit.loadByte(Emitter::RCX, reg(y));
+                        emit.bytes({0x00, 0xC8});       // add al, cl
+                        emit.bytes({0x0F, 0x92, 0xC2}); // setc dl
+                        emit.storeByte(reg(x), Emitter::RAX);
+                        emit.storeByte(vf, Emitter::RDX);
+                        break;
+                    case 0x5: // 8XY5: VX -= VY, VF = VX >= VY
+                    case 0x7: // 8XY7: VX = VY - VX, VF = VY >= VX
+                        emit.loadByte(Emitter::RAX, reg((opcode & 0x000F) == 0x5 ? x : y));
+                        emit.loadByte(Emitter::RCX, reg((opcode & 0x000F) == 0x5 ? y : x));
+                        emit.bytes({0x28, 0xC8});       // sub al, cl
+                        emit.bytes({0x0F, 0x93, 0xC2}); // setnc dl
+                        emit.storeByte(reg(x), Emitter::RAX);
+                        emit.storeByte(vf, Emitter::RDX);
+                        break;
+                    case 0x6: // 8XY6: VX >>= 1, VF = shifted out bit
+                        emit.loadByte(Emitter::RAX, reg(x));
+                        emit.bytes({0x88, 0xC2});       // mov dl, al
+                        emit.bytes({0x80, 0xE2, 0x01}); // and dl, 1
+                        emit.bytes({0xD0, 0xE8});       // shr al, 1
+                        emit.storeByte(reg(x), Emitter::RAX);
+                        emit.storeByte(vf, Emitter::RDX);
+                        break;
+                    case 0xE: // 8XYE: VX <<= 1, VF = shifted out bit
+                        emit.loadByte(Emitter::RAX, reg(x));
+                        emit.bytes({0x88, 0xC2});       // mov dl, al
+                        emit.bytes({0xC0, 0xEA, 0x07}); // shr dl, 7
+                        emit.bytes({0xD0, 0xE0});       // shl al, 1
+                        emit.storeByte(reg(x), Emitter::RAX);
+                        emit.storeByte(vf, Emitter::RDX);
+                        break;
+                    default:
+                        translated = false;
+                        break;
+                }
+                break;
+            case 0xA000: // ANNN: I = NNN
+                emit.storeWordImm(indexOffset, nnn);
+                break;
+            case 0xE000: // EX9E/EXA1: skip if key VX is (not) pressed
+                if (nn != 0x9E && nn != 0xA1) {
+                    translated = false;
+                    break;
+                }
+                emit.loadByte(Emitter::RAX, reg(x));
+                // Keys above 0xF are an error in the interpreter, so stop here
+                // and let it handle the instruction
+                emit.bytes({0x3C, 0x0F});                              // cmp al, 15
+                emit.bytes({0x77, 8 + Emitter::RETURN_SELECT_SIZE});   // ja bail
+                emit.bytes({0x80, 0xBC, 0x07});                        // cmp byte [rdi + rax + keypad], 0
+                emit.imm32(static_cast<uint32_t>(keypadOffset));
+                emit.byte(0x00);
+                emit.returnSelect(nn == 0x9E ? Emitter::CMOVNE : Emitter::CMOVE, pc + 4, pc + 2, count + 1);
+                emit.returnPC(pc, count);                              // bail:
+                terminated = true;
+                break;
+            case 0xF000:
+                switch (nn) {
+                    case 0x07: // FX07: VX = delay timer
+                        emit.loadByte(Emitter::RAX, delayTimerOffset);
+                        emit.storeByte(reg(x), Emitter::RAX);
+                        break;
+                    case 0x15: // FX15: delay timer = VX
+                        emit.loadByte(Emitter::RAX, reg(x));
+                        emit.storeByte(delayTimerOffset, Emitter::RAX);
+                        break;
+                    case 0x18: // FX18: sound timer = VX
+                        emit.loadByte(Emitter::RAX, reg(x));
+                        emit.storeByte(soundTimerOffset, Emitter::RAX);
+                        break;
+                    case 0x1E: // FX1E: I += VX
+                        emit.loadByte(Emitter::RAX, reg(x));
+                        emit.addWordAx(indexOffset);
+                        break;
+                    case 0x29: // FX29: I = font address of VX
+                        emit.loadByte(Emitter::RAX, reg(x));
+                        emit.bytes({0x8D, 0x44, 0x80, static_cast<uint8_t>(Chip8::FONT_ADDRESS)}); // lea eax, [rax + rax * 4 + FONT_ADDRESS]
+                        emit.storeWordAx(indexOffset);
+                        break;
+                    default:
+                        translated = false;
+                        break;
+                }
+                break;
+            default:
+                translated = false;
+                break;
+        }
+
+        if (!translated) break;
+        count++;
+        pc += 2;
+    }
+
+    if (count > 0 && !terminated) {
+        // Hand the untranslated instruction (or the next block) back to run()
+        emit.returnPC(pc, count);
+    }
+
+    if (emit.overflowed()) {
+        // Out of code space: start over with an empty buffer and try again
+        mprotect(code, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC);
+        flush();
+        return compile(address);
+    }
+
+    if (count > 0) {
+        block.fn = reinterpret_cast<BlockFn>(code + codeUsed);
+        block.end = static_cast<uint16_t>(pc);
+        block.count = count;
+        codeUsed += emit.used();
+        std::fill(covered.begin() + address, covered.begin() + pc, true);
+    }
+    mprotect(code, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC);
+#endif
+
+    return block;
+}
+
+void Chip8Jit::step() {
+    // Only FX33 and FX55 write memory, so note what they are about to
+    // overwrite and drop any block compiled from those bytes
+    uint16_t pc = chip8.pc & (MEMORY_SIZE - 1);
+    uint16_t opcode = (static_cast<uint16_t>(chip8.memory[pc]) << 8) | chip8.memory[(pc + 1) & (MEMORY_SIZE - 1)];
+    uint16_t address = chip8.index;
+    unsigned int length = 0;
+    if ((opcode & 0xF0FF) == 0xF033) length = 3;
+    else if ((opcode & 0xF0FF) == 0xF055) length = ((opcode & 0x0F00) >> 8) + 1;
+
+    chip8.cycle();
+
+    if (length > 0) {
+        invalidate(address, length);
+    }
+}
+
+void Chip8Jit::run(uint64_t cycles) {
+    // The generated code implements the modern quirks only
+    if (!code || chip8.getQuirks() != QuirkProfile::Modern) {
+        chip8.run(cycles);
+        return;
+    }
+
+    while (cycles > 0) {
+        uint16_t pc = chip8.pc;
+        if (pc >= MEMORY_SIZE) {
+            step();
+            cycles--;
+            continue;
+        }
+
+        Block &block = blocks[pc].compiled ? blocks[pc] : compile(pc);
+        if (!block.fn) {
+            // Untranslated instruction
+            step();
+            cycles--;
+            continue;
+        }
+        if (block.count > cycles) {
+            // The block would run past the requested number of cycles. Interpret
+            // the rest, compiling a block at every address on the way would
+            // fill the code buffer with overlapping copies of the same code.
+            for (; cycles > 0; cycles--) {
+                step();
+            }
+            break;
+        }
+
+        uint32_t result = block.fn(&chip8);
+        chip8.pc = static_cast<uint16_t>(result & 0xFFFF);
+        uint64_t executed = result >> 16;
+        if (executed == 0) {
+            // The block bailed out at its first instruction, the interpreter
+            // handles that one
+            step();
+            executed = 1;
+        }
+        cycles -= executed;
+    }
+}
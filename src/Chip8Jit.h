@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+class Chip8;
+
+// Dynamic recompiler that translates straight-line runs of CHIP-8
+// instructions into native x86-64 code. A block ends at a jump or skip
+// (1NNN, 3XNN, 4XNN, 5XY0, 9XY0, EX9E, EXA1) or right before any instruction
+// it does not translate (calls, returns, drawing, memory access, ...), which
+// are executed by the interpreter instead. Results match Chip8::run() exactly,
+// which chip8_golden --jit checks.
+//
+// Only available on x86-64 POSIX hosts, and only for the modern quirks;
+// otherwise run() just calls the interpreter.
+class Chip8Jit {
+public:
+    explicit Chip8Jit(Chip8 &chip8);
+    ~Chip8Jit();
+
+    Chip8Jit(const Chip8Jit &) = delete;
+    Chip8Jit &operator=(const Chip8Jit &) = delete;
+
+    static bool isSupported();
+
+    // Execute the given number of instructions, same as Chip8::run()
+    void run(uint64_t cycles);
+    // Drop every compiled block, must be called after loading a new ROM
+    void flush();
+
+private:
+    static constexpr unsigned int MEMORY_SIZE = 4096;
+    static constexpr unsigned int MAX_BLOCK_INSTRUCTIONS = 64;
+    static constexpr size_t CODE_BUFFER_SIZE = 1 << 20;
+
+    // Compiled blocks take a pointer to the Chip8 and return the next pc in the
+    // low 16 bits and the number of instructions executed in the high 16 bits
+    using BlockFn = uint32_t (*)(Chip8 *chip8);
+
+    struct Block {
+        BlockFn fn{};        // nullptr if the block starts with an instruction we don't translate
+        uint16_t end{};      // One past the last byte the block was compiled from
+        uint16_t count{};    // Most instructions one call of fn can execute
+        bool compiled{};
+    };
+
+    Block &compile(uint16_t address);
+    void invalidate(uint16_t address, unsigned int length);
+    void step();
+
+    Chip8 &chip8;
+    std::array<Block, MEMORY_SIZE> blocks{};
+    std::array<bool, MEMORY_SIZE> covered{}; // Bytes read by at least one compiled block
+
+    uint8_t *code{};     // Executable buffer, blocks are appended until it is full
+    size_t codeUsed{};
+
+    // Offsets of the Chip8 fields the generated code touches
+    int32_t registersOffset{};
+    int32_t indexOffset{};
+    int32_t delayTimerOffset{};
+    int32_t soundTimerOffset{};
+    int32_t keypadOffset{};
+};
@@ -0,0 +1,208 @@
+#include "Debugger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iterator>
+#include <sstream>
+
+namespace {
+
+constexpr const char *COMPARE_NAMES[] = {"", "==", "!=", "<", "<=", ">", ">="};
+
+} // namespace
+
+bool BreakCondition::holds(const Chip8 &chip8) const {
+    uint16_t actual = target == INDEX ? chip8.getIndex() : chip8.getRegisters()[target & 15];
+    switch (compare) {
+        case Compare::Equal: return actual == value;
+        case Compare::NotEqual: return actual != value;
+        case Compare::Less: return actual < value;
+        case Compare::LessEqual: return actual <= value;
+        case Compare::Greater: return actual > value;
+        case Compare::GreaterEqual: return actual >= value;
+        default: return true;
+    }
+}
+
+bool parseBreakCondition(const std::string &text, BreakCondition &condition) {
+    size_t position = 0;
+    BreakCondition parsed;
+    if (text.size() >= 2 && std::toupper(static_cast<unsigned char>(text[0])) == 'V' &&
+        std::isxdigit(static_cast<unsigned char>(text[1]))) {
+        parsed.target = static_cast<uint8_t>(std::stoul(text.substr(1, 1), nullptr, 16));
+        position = 2;
+    } else if (!text.empty() && std::toupper(static_cast<unsigned char>(text[0])) == 'I') {
+        parsed.target = BreakCondition::INDEX;
+        position = 1;
+    } else {
+        return false;
+    }
+
+    // Two-character operators first, so "<=" isn't read as "<"
+    size_t length = 0;
+    for (size_t i = 1; i < std::size(COMPARE_NAMES); i++) {
+        size_t nameLength = std::char_traits<char>::length(COMPARE_NAMES[i]);
+        if (nameLength > length && text.compare(position, nameLength, COMPARE_NAMES[i]) == 0) {
+            parsed.compare = static_cast<BreakCondition::Compare>(i);
+            length = nameLength;
+        }
+    }
+    if (length == 0) return false;
+    position += length;
+
+    const char *start = text.c_str() + position;
+    char *end = nullptr;
+    unsigned long value = std::strtoul(start, &end, 0);
+    uint16_t limit = parsed.target == BreakCondition::INDEX ? 0xFFFF : 0xFF;
+    if (end == start || *end != '\0' || value > limit) return false;
+    parsed.value = static_cast<uint16_t>(value);
+    condition = parsed;
+    return true;
+}
+
+std::string formatBreakCondition(const BreakCondition &condition) {
+    if (condition.compare == BreakCondition::Compare::Always) return "";
+    std::ostringstream text;
+    if (condition.target == BreakCondition::INDEX) {
+        text << 'I';
+    } else {
+        text << 'V' << std::uppercase << std::hex << static_cast<int>(condition.target) << std::nouppercase;
+    }
+    text << COMPARE_NAMES[static_cast<size_t>(condition.compare)] << "0x" << std::hex << condition.value;
+    return text.str();
+}
+
+Debugger::Debugger(const Chip8 &chip8) : chip8(chip8) {
+}
+
+void Debugger::addBreakpoint(uint16_t address, const BreakCondition &condition) {
+    removeBreakpoint(address);
+    breakpoints.push_back({address, condition});
+    setBreakBit(address, true);
+}
+
+bool Debugger::removeBreakpoint(uint16_t address) {
+    auto found = std::find_if(breakpoints.begin(), breakpoints.end(),
+                              [address](const Breakpoint &breakpoint) { return breakpoint.address == address; });
+    if (found == breakpoints.end()) return false;
+    breakpoints.erase(found);
+    // A pending stepOver() or stepOut() still needs its bit
+    if (mode != Mode::StepTo || address != stepAddress) setBreakBit(address, false);
+    return true;
+}
+
+void Debugger::addWatchpoint(uint16_t address) {
+    if (std::find(watchpoints.begin(), watchpoints.end(), address) == watchpoints.end()) {
+        watchpoints.push_back(address);
+    }
+    setBit(watchBits, address, true);
+}
+
+bool Debugger::removeWatchpoint(uint16_t address) {
+    auto found = std::find(watchpoints.begin(), watchpoints.end(), address);
+    if (found == watchpoints.end()) return false;
+    watchpoints.erase(found);
+    setBit(watchBits, address, false);
+    return true;
+}
+
+bool Debugger::isBreakpoint(uint16_t address) const {
+    return std::any_of(breakpoints.begin(), breakpoints.end(),
+                       [address](const Breakpoint &breakpoint) { return breakpoint.address == address; });
+}
+
+void Debugger::resume() {
+    halt(Stop::None);
+    skipFirst = true;
+}
+
+void Debugger::step() {
+    resume();
+    mode = Mode::Step;
+    checkEverything(true);
+}
+
+void Debugger::stepOver() {
+    uint16_t pc = static_cast<uint16_t>(chip8.getPC() & (chip8.getMemorySize() - 1));
+    uint16_t opcode = static_cast<uint16_t>((chip8.readMemory(pc) << 8) | chip8.readMemory(pc + 1));
+    if ((opcode & 0xF000) != 0x2000) {
+        step();
+        return;
+    }
+    // Back at the instruction after the call, at the same depth, so a
+    // recursive call passing through it doesn't count
+    resume();
+    stepTo(static_cast<uint16_t>(pc + 2), chip8.getStackPointer());
+}
+
+bool Debugger::stepOut() {
+    unsigned int depth = chip8.getStackPointer();
+    if (depth == 0 || depth > chip8.getStack().size()) return false;
+    resume();
+    stepTo(chip8.getStack()[depth - 1], depth - 1);
+    return true;
+}
+
+void Debugger::stepTo(uint16_t address, unsigned int depth) {
+    address &= static_cast<uint16_t>(chip8.getMemorySize() - 1);
+    mode = Mode::StepTo;
+    stepAddress = address;
+    stepDepth = depth;
+    setBreakBit(address, true);
+}
+
+void Debugger::checkEverything(bool enabled) {
+    checkingEverything = enabled;
+    if (enabled) {
+        checkBits.fill(~0ull);
+    } else {
+        checkBits = breakBits;
+    }
+}
+
+void Debugger::halt(Stop reason) {
+    if (mode == Mode::StepTo && !isBreakpoint(stepAddress)) setBreakBit(stepAddress, false);
+    mode = Mode::Run;
+    if (checkingEverything) checkEverything(false);
+    watchPending = false;
+    skipFirst = false;
+    stop = reason;
+}
+
+bool Debugger::checkBreak(uint16_t address) {
+    // The instruction the run resumes from, reached once more after decoding it
+    if (skipFirst && runCycles == 0) return false;
+
+    if (watchPending) {
+        halt(Stop::Watchpoint);
+        return true;
+    }
+    if (mode == Mode::Step ||
+        (mode == Mode::StepTo && address == stepAddress && chip8.getStackPointer() == stepDepth)) {
+        halt(Stop::Step);
+        return true;
+    }
+    for (const Breakpoint &breakpoint: breakpoints) {
+        if (breakpoint.address == address && breakpoint.condition.holds(chip8)) {
+            halt(Stop::Breakpoint);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Debugger::watchHit(uint16_t address, uint8_t value) {
+    // Stop before the next instruction, so the writing one completes
+    watchPending = true;
+    writerPC = static_cast<uint16_t>((chip8.getPC() - 2) & addressMask);
+    watchAddress = address;
+    watchValue = value;
+    checkEverything(true);
+}
+
+void Debugger::endRun() {
+    if (runCycles > 0) skipFirst = false;
+    // The write was the run's last instruction
+    if (watchPending) halt(Stop::Watchpoint);
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Chip8.h"
+
+// A condition on V0-VF or I, e.g. "V3==0x10" or "I>=0x300"
+struct BreakCondition {
+    enum class Compare : uint8_t { Always, Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual };
+    static constexpr uint8_t INDEX = 16; // target for I instead of a register
+
+    Compare compare{Compare::Always};
+    uint8_t target{};
+    uint16_t value{};
+
+    bool holds(const Chip8 &chip8) const;
+};
+
+// Parse a condition like "V3==0x10", "VF!=0" or "I>=0x300", false if invalid
+bool parseBreakCondition(const std::string &text, BreakCondition &condition);
+// The text parseBreakCondition() reads, empty for Compare::Always
+std::string formatBreakCondition(const BreakCondition &condition);
+
+// Breakpoints, watchpoints and stepping for Chip8::run(cycles, debugger). It is
+// a hook policy like Profiler (see Profiler.h) that can also stop the run loop
+// before an instruction. Breakpoint addresses are bits in a bitmap, so the
+// check costs one load and a bit test per instruction, and conditions are only
+// evaluated where a bit is set. Runs without a debugger use copies of the loop
+// that have no check at all.
+//
+// A run stops before the instruction at a breakpoint, or after an instruction
+// that wrote to a watched address (FX33, FX55 and 5XY2 write memory).
+// getStop() tells why the last run stopped, if it did. A stopped debugger stays
+// stopped until resume() or one of the steps says how to go on.
+class Debugger {
+public:
+    static constexpr bool ENABLED = true;
+    static constexpr bool BREAKS = true;
+
+    enum class Stop : uint8_t { None, Breakpoint, Watchpoint, Step };
+
+    struct Breakpoint {
+        uint16_t address{};
+        BreakCondition condition;
+    };
+
+    explicit Debugger(const Chip8 &chip8);
+    Debugger(const Debugger &) = delete;
+    Debugger &operator=(const Debugger &) = delete;
+
+    // Stop before the instruction at address when the condition holds. A
+    // second breakpoint at the same address replaces the first.
+    void addBreakpoint(uint16_t address, const BreakCondition &condition = {});
+    // False if there was no breakpoint at address
+    bool removeBreakpoint(uint16_t address);
+    const std::vector<Breakpoint> &getBreakpoints() const { return breakpoints; }
+    // Stop after any instruction that writes to address
+    void addWatchpoint(uint16_t address);
+    bool removeWatchpoint(uint16_t address);
+    const std::vector<uint16_t> &getWatchpoints() const { return watchpoints; }
+
+    // How the next run goes on: until a breakpoint or watchpoint, for one
+    // instruction, over a subroutine call (like step() for anything else but
+    // 2NNN), or until the current subroutine returns. None of them stops at a
+    // breakpoint on the instruction the run starts from. stepOut() is false,
+    // and changes nothing, outside a subroutine.
+    void resume();
+    void step();
+    void stepOver();
+    bool stepOut();
+
+    Stop getStop() const { return stop; }
+    // Instructions the last run executed before it returned or stopped
+    uint64_t getRunCycles() const { return runCycles; }
+    // For Stop::Watchpoint: the instruction that wrote, and what it wrote where
+    uint16_t getWriterPC() const { return writerPC; }
+    uint16_t getWatchAddress() const { return watchAddress; }
+    uint8_t getWatchValue() const { return watchValue; }
+
+    // Hooks called by Chip8::run()
+    void beginRun() {
+        addressMask = static_cast<uint16_t>(chip8.getMemorySize() - 1);
+        runCycles = 0;
+        stop = Stop::None;
+    }
+    bool shouldBreak(uint16_t address) {
+        return ((checkBits[address >> 6] >> (address & 63)) & 1) && checkBreak(address);
+    }
+    void instruction(uint16_t, uint16_t) { runCycles++; }
+    void write(uint16_t address, uint8_t value) {
+        address &= addressMask;
+        if ((watchBits[address >> 6] >> (address & 63)) & 1) watchHit(address, value);
+    }
+    void readDelay(uint16_t, uint8_t) {}
+    void waitKey() {}
+    void call(unsigned int) {}
+    void draw(bool) {}
+    void clear() {}
+    void endRun();
+
+private:
+    using Bitmap = std::array<uint64_t, 65536 / 64>;
+
+    enum class Mode : uint8_t { Run, Step, StepTo };
+
+    // An address whose bit is set: decide whether to stop there
+    bool checkBreak(uint16_t address);
+    void watchHit(uint16_t address, uint8_t value);
+    // Stop with the given reason and drop what the last step set up
+    void halt(Stop reason);
+    // Arm a temporary breakpoint that stops at address once the stack has depth entries
+    void stepTo(uint16_t address, unsigned int depth);
+    // Have shouldBreak() check every instruction, or only breakBits
+    void checkEverything(bool enabled);
+    void setBreakBit(uint16_t address, bool value) {
+        setBit(breakBits, address, value);
+        if (!checkingEverything) setBit(checkBits, address, value);
+    }
+    static void setBit(Bitmap &bitmap, uint16_t address, bool value) {
+        uint64_t bit = 1ull << (address & 63);
+        bitmap[address >> 6] = value ? bitmap[address >> 6] | bit : bitmap[address >> 6] & ~bit;
+    }
+    bool isBreakpoint(uint16_t address) const;
+
+    const Chip8 &chip8;
+    uint16_t addressMask{0xFFFF};
+
+    std::vector<Breakpoint> breakpoints;
+    std::vector<uint16_t> watchpoints;
+    Bitmap breakBits{}; // Breakpoints and the target of stepOver() or stepOut()
+    Bitmap watchBits{};
+    // The bitmap shouldBreak() tests: a copy of breakBits, or every bit set
+    // while stepping or once a watchpoint was hit, so the run stops at the
+    // next instruction. Filling it is rare, testing it happens every time.
+    Bitmap checkBits{};
+    bool checkingEverything{false};
+
+    Mode mode{Mode::Run};
+    // Target of stepOver() and stepOut()
+    uint16_t stepAddress{};
+    unsigned int stepDepth{};
+    // Pass the instruction the run starts from
+    bool skipFirst{false};
+
+    Stop stop{Stop::None};
+    uint64_t runCycles{};
+    bool watchPending{false};
+    uint16_t writerPC{};
+    uint16_t watchAddress{};
+    uint8_t watchValue{};
+};
@@ -0,0 +1,121 @@
+#include "Disassembler.h"
+
+#include <cstdio>
+
+namespace {
+
+std::string format(const char *pattern, unsigned int a = 0, unsigned int b = 0, unsigned int c = 0) {
+    char text[32];
+    std::snprintf(text, sizeof(text), pattern, a, b, c);
+    return text;
+}
+
+} // namespace
+
+std::string disassemble(uint16_t opcode) {
+    unsigned int x = (opcode & 0x0F00) >> 8;
+    unsigned int y = (opcode & 0x00F0) >> 4;
+    unsigned int n = opcode & 0x000F;
+    unsigned int nn = opcode & 0x00FF;
+    unsigned int nnn = opcode & 0x0FFF;
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode == 0x00E0) return "CLS";
+            if (opcode == 0x00EE) return "RET";
+            // SUPER-CHIP and XO-CHIP
+            if ((opcode & 0xFFF0) == 0x00C0) return format("SCD %u", n);
+            if ((opcode & 0xFFF0) == 0x00D0) return format("SCU %u", n);
+            if (opcode == 0x00FB) return "SCR";
+            if (opcode == 0x00FC) return "SCL";
+            if (opcode == 0x00FD) return "EXIT";
+            if (opcode == 0x00FE) return "LOW";
+            if (opcode == 0x00FF) return "HIGH";
+            break;
+        case 0x1000: return format("JP 0x%03X", nnn);
+        case 0x2000: return format("CALL 0x%03X", nnn);
+        case 0x3000: return format("SE V%X, 0x%02X", x, nn);
+        case 0x4000: return format("SNE V%X, 0x%02X", x, nn);
+        case 0x5000:
+            if (n == 0) return format("SE V%X, V%X", x, y);
+            if (n == 2) return format("LD [I], V%X-V%X", x, y);
+            if (n == 3) return format("LD V%X-V%X, [I]", x, y);
+            break;
+        case 0x6000: return format("LD V%X, 0x%02X", x, nn);
+        case 0x7000: return format("ADD V%X, 0x%02X", x, nn);
+        case 0x8000:
+            switch (n) {
+                case 0x0: return format("LD V%X, V%X", x, y);
+                case 0x1: return format("OR V%X, V%X", x, y);
+                case 0x2: return format("AND V%X, V%X", x, y);
+                case 0x3: return format("XOR V%X, V%X", x, y);
+                case 0x4: return format("ADD V%X, V%X", x, y);
+                case 0x5: return format("SUB V%X, V%X", x, y);
+                case 0x6: return format("SHR V%X, V%X", x, y);
+                case 0x7: return format("SUBN V%X, V%X", x, y);
+                case 0xE: return format("SHL V%X, V%X", x, y);
+            }
+            break;
+        case 0x9000:
+            if (n == 0) return format("SNE V%X, V%X", x, y);
+            break;
+        case 0xA000: return format("LD I, 0x%03X", nnn);
+        case 0xB000: return format("JP V0, 0x%03X", nnn);
+        case 0xC000: return format("RND V%X, 0x%02X", x, nn);
+        case 0xD000: return format("DRW V%X, V%X, %u", x, y, n);
+        case 0xE000:
+            if (nn == 0x9E) return format("SKP V%X", x);
+            if (nn == 0xA1) return format("SKNP V%X", x);
+            break;
+        case 0xF000:
+            switch (nn) {
+                case 0x07: return format("LD V%X, DT", x);
+                case 0x0A: return format("LD V%X, K", x);
+                case 0x15: return format("LD DT, V%X", x);
+                case 0x18: return format("LD ST, V%X", x);
+                case 0x1E: return format("ADD I, V%X", x);
+                case 0x29: return format("LD F, V%X", x);
+                case 0x33: return format("LD B, V%X", x);
+                case 0x55: return format("LD [I], V%X", x);
+                case 0x65: return format("LD V%X, [I]", x);
+                case 0x30: return format("LD HF, V%X", x);
+                case 0x75: return format("LD R, V%X", x);
+                case 0x85: return format("LD V%X, R", x);
+                case 0x01: return format("PLANE %u", x);
+                case 0x3A: return format("PITCH V%X", x);
+            }
+            // The address of F000 is in the next two bytes
+            if (opcode == 0xF000) return "LD I, LONG";
+            if (opcode == 0xF002) return "AUDIO";
+            break;
+    }
+    return format("DW 0x%04X", opcode);
+}
+
+std::string opcodePattern(uint16_t opcode) {
+    unsigned int n = opcode & 0x000F;
+    unsigned int nn = opcode & 0x00FF;
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode == 0x00E0 || opcode == 0x00EE || opcode >= 0x00FB) return format("%04X", opcode);
+            if ((opcode & 0xFFF0) == 0x00C0) return "00CN";
+            if ((opcode & 0xFFF0) == 0x00D0) return "00DN";
+            return "0NNN";
+        case 0x1000: return "1NNN";
+        case 0x2000: return "2NNN";
+        case 0x3000: return "3XNN";
+        case 0x4000: return "4XNN";
+        case 0x5000: return format("5XY%X", n);
+        case 0x6000: return "6XNN";
+        case 0x7000: return "7XNN";
+        case 0x8000: return format("8XY%X", n);
+        case 0x9000: return "9XY0";
+        case 0xA000: return "ANNN";
+        case 0xB000: return "BNNN";
+        case 0xC000: return "CXNN";
+        case 0xD000: return "DXYN";
+        case 0xE000: return format("EX%02X", nn);
+        default: return format("FX%02X", nn);
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Assembly for one opcode in the usual CHIP-8 mnemonics, e.g. "DRW V1, V2, 5".
+// Opcodes the interpreter does not know come out as "DW 0x0123".
+std::string disassemble(uint16_t opcode);
+
+// The opcode's form with its operands as letters, e.g. "8XY4" or "DXYN"
+std::string opcodePattern(uint16_t opcode);
@@ -0,0 +1,313 @@
+#include "FrameRecorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+// Write out the encoded records once this many have collected
+constexpr size_t FLUSH_SIZE = 64 * 1024;
+
+size_t frameBytes(bool hires) {
+    unsigned int width = hires ? Chip8::HIRES_WIDTH : Chip8::SCREEN_WIDTH;
+    unsigned int height = hires ? Chip8::HIRES_HEIGHT : Chip8::SCREEN_HEIGHT;
+    return Chip8::PLANES * width / 8 * height;
+}
+
+bool zeroWord(const uint8_t *bytes) {
+    uint64_t word;
+    std::memcpy(&word, bytes, sizeof(word));
+    return word == 0;
+}
+
+} // namespace
+
+FrameRecorder::FrameRecorder() = default;
+
+FrameRecorder::~FrameRecorder() {
+    close(0);
+}
+
+bool FrameRecorder::open(const std::string &path, unsigned int keyframeInterval) {
+    close(0);
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open recording file " << path << std::endl;
+        return false;
+    }
+
+    this->keyframeInterval = keyframeInterval > 0 ? std::min(keyframeInterval, 0xFFFFu) : KEYFRAME_INTERVAL;
+    started = false;
+    lastFrame = 0;
+    lastKeyframe = 0;
+    failed = false;
+    framesWritten = 0;
+    bytesWritten = 0;
+    buffer.assign(MAGIC, MAGIC + sizeof(MAGIC));
+    buffer.push_back(static_cast<uint8_t>(VERSION));
+    buffer.push_back(static_cast<uint8_t>(VERSION >> 8));
+    buffer.push_back(static_cast<uint8_t>(this->keyframeInterval));
+    buffer.push_back(static_cast<uint8_t>(this->keyframeInterval >> 8));
+    flush();
+
+    queue = std::make_unique<SpscQueue<Snapshot, QUEUE_SIZE>>();
+    closing = false;
+    writer = std::thread(&FrameRecorder::writerLoop, this);
+    return true;
+}
+
+bool FrameRecorder::close(uint64_t endFrame) {
+    if (!writer.joinable()) return true;
+
+    closing.store(true, std::memory_order_release);
+    changed.notify_all();
+    writer.join();
+
+    // The writer thread has stopped, so its state is ours now
+    buffer.push_back(END_FLAG);
+    uint64_t end = started ? std::max(endFrame, lastFrame + 1) : endFrame;
+    putVarint(buffer, started ? end - lastFrame : end);
+    flush();
+    file.close();
+    queue.reset();
+
+    if (failed) {
+        std::cerr << "Error: Could not write the recording file" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void FrameRecorder::frame(uint64_t number, const Chip8 &chip8) {
+    if (!queue) return;
+    Snapshot snapshot;
+    snapshot.number = number;
+    snapshot.hires = chip8.isHires();
+    snapshot.display = chip8.display;
+    while (!queue->push(snapshot)) {
+        changed.notify_one();
+        std::this_thread::yield();
+    }
+}
+
+void FrameRecorder::writerLoop() {
+    Snapshot snapshot;
+    while (true) {
+        // Frames pushed before closing was set are in the queue by the time it is seen
+        bool closed = closing.load(std::memory_order_acquire);
+        bool any = false;
+        while (queue->pop(snapshot)) {
+            encode(snapshot);
+            any = true;
+        }
+        if (buffer.size() >= FLUSH_SIZE) flush();
+        if (closed) break;
+        if (!any) {
+            // The emulating thread doesn't wake the writer for every frame, the
+            // writer looks again after a short wait
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait_for(lock, std::chrono::milliseconds(1));
+        }
+    }
+}
+
+void FrameRecorder::encode(const Snapshot &snapshot) {
+    bool keyframe = !started || snapshot.hires != previousHires || snapshot.number - lastKeyframe >= keyframeInterval;
+    if (keyframe) {
+        previous = {};
+        lastKeyframe = snapshot.number;
+    }
+    // XOR whole rows, before they are turned into columns
+    for (size_t plane = 0; plane < Chip8::PLANES; plane++) {
+        for (size_t y = 0; y < Chip8::HIRES_HEIGHT; y++) {
+            for (size_t word = 0; word < 2; word++) {
+                delta[plane][y][word] = snapshot.display[plane][y][word] ^ previous[plane][y][word];
+            }
+        }
+    }
+    previous = snapshot.display;
+    size_t size = toColumns(delta, snapshot.hires, columns.data());
+    runs.clear();
+    encodeRuns(columns.data(), size, runs);
+
+    buffer.push_back(static_cast<uint8_t>((keyframe ? KEYFRAME_FLAG : 0) | (snapshot.hires ? HIRES_FLAG : 0)));
+    putVarint(buffer, started ? snapshot.number - lastFrame : snapshot.number);
+    putVarint(buffer, runs.size());
+    buffer.insert(buffer.end(), runs.begin(), runs.end());
+
+    started = true;
+    previousHires = snapshot.hires;
+    lastFrame = snapshot.number;
+    framesWritten.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameRecorder::flush() {
+    file.write(reinterpret_cast<const char *>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+    if (!file) failed = true;
+    bytesWritten.fetch_add(buffer.size(), std::memory_order_relaxed);
+    buffer.clear();
+}
+
+size_t FrameRecorder::toColumns(const std::array<Chip8::Plane, Chip8::PLANES> &display, bool hires, uint8_t *out) {
+    unsigned int words = hires ? 2 : 1;
+    unsigned int height = hires ? Chip8::HIRES_HEIGHT : Chip8::SCREEN_HEIGHT;
+    size_t size = frameBytes(hires);
+    std::memset(out, 0, size);
+    // Byte k of word w in row y goes to column w * 8 + k
+    for (unsigned int plane = 0; plane < Chip8::PLANES; plane++) {
+        uint8_t *planeOut = out + plane * words * 8 * height;
+        for (unsigned int y = 0; y < height; y++) {
+            for (unsigned int word = 0; word < words; word++) {
+                uint64_t bits = display[plane][y][word];
+                if (bits == 0) continue;
+                for (unsigned int k = 0; k < 8; k++) {
+                    planeOut[(word * 8 + k) * height + y] = static_cast<uint8_t>(bits >> (56 - k * 8));
+                }
+            }
+        }
+    }
+    return size;
+}
+
+void FrameRecorder::fromColumns(const uint8_t *bytes, bool hires, RecordedFrame &frame) {
+    unsigned int columns = (hires ? Chip8::HIRES_WIDTH : Chip8::SCREEN_WIDTH) / 8;
+    unsigned int height = hires ? Chip8::HIRES_HEIGHT : Chip8::SCREEN_HEIGHT;
+    frame.display = {};
+    for (Chip8::Plane &plane: frame.display) {
+        for (unsigned int column = 0; column < columns; column++) {
+            unsigned int shift = 56 - column % 8 * 8;
+            for (unsigned int y = 0; y < height; y++) {
+                plane[y][column / 8] |= static_cast<uint64_t>(*bytes++) << shift;
+            }
+        }
+    }
+}
+
+void FrameRecorder::encodeRuns(const uint8_t *bytes, size_t size, std::vector<uint8_t> &out) {
+    size_t i = 0;
+    while (i < size) {
+        // Zeros eight at a time, they are most of a delta
+        size_t run = 0;
+        while (size - i - run >= 8 && zeroWord(bytes + i + run)) run += 8;
+        while (i + run < size && bytes[i + run] == 0) run++;
+        if (run > 0) {
+            i += run;
+            for (; run > 128; run -= 128) out.push_back(0xFF);
+            out.push_back(static_cast<uint8_t>(0x7F + run));
+            continue;
+        }
+        // Literals up to the next two zeros, a single zero costs less inside them
+        size_t start = i;
+        while (i < size && i - start < 128 && (bytes[i] != 0 || (i + 1 < size && bytes[i + 1] != 0))) i++;
+        out.push_back(static_cast<uint8_t>(i - start - 1));
+        out.insert(out.end(), bytes + start, bytes + i);
+    }
+}
+
+bool FrameRecorder::decodeRuns(const uint8_t *data, size_t length, uint8_t *out, size_t size) {
+    size_t position = 0;
+    size_t written = 0;
+    while (position < length) {
+        uint8_t control = data[position++];
+        if (control < 0x80) {
+            size_t count = control + 1u;
+            if (count > length - position || count > size - written) return false;
+            std::memcpy(out + written, data + position, count);
+            position += count;
+            written += count;
+        } else {
+            size_t count = control - 0x7Fu;
+            if (count > size - written) return false;
+            std::memset(out + written, 0, count);
+            written += count;
+        }
+    }
+    return written == size;
+}
+
+void FrameRecorder::putVarint(std::vector<uint8_t> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+bool FrameReader::open(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open recording file " << path << std::endl;
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (data.size() < 8 || std::memcmp(data.data(), FrameRecorder::MAGIC, 4) != 0) {
+        std::cerr << "Error: " << path << " is not a frame recording" << std::endl;
+        return false;
+    }
+    uint16_t version = static_cast<uint16_t>(data[4] | (data[5] << 8));
+    if (version != FrameRecorder::VERSION) {
+        std::cerr << "Error: Unsupported recording version " << version << std::endl;
+        return false;
+    }
+    keyframeInterval = static_cast<unsigned int>(data[6] | (data[7] << 8));
+    position = 8;
+    started = false;
+    frameNumber = 0;
+    endFrame = 0;
+    return true;
+}
+
+bool FrameReader::next(RecordedFrame &frame) {
+    if (position >= data.size()) return false;
+    uint8_t flags = data[position++];
+    uint64_t gap = 0;
+    if (!getVarint(gap)) return false;
+    uint64_t number = started ? frameNumber + gap : gap;
+    if (flags & FrameRecorder::END_FLAG) {
+        endFrame = number;
+        position = data.size();
+        return false;
+    }
+
+    uint64_t length = 0;
+    if (!getVarint(length) || length > data.size() - position) return false;
+    bool frameHires = (flags & FrameRecorder::HIRES_FLAG) != 0;
+    bool keyframe = (flags & FrameRecorder::KEYFRAME_FLAG) != 0;
+    size_t size = frameBytes(frameHires);
+    if (keyframe) {
+        if (!FrameRecorder::decodeRuns(data.data() + position, length, bytes.data(), size)) return false;
+    } else {
+        // A delta needs the frame before it at the same resolution
+        std::array<uint8_t, FrameRecorder::MAX_FRAME_BYTES> delta;
+        if (!started || frameHires != hires ||
+            !FrameRecorder::decodeRuns(data.data() + position, length, delta.data(), size)) {
+            return false;
+        }
+        for (size_t i = 0; i < size; i++) {
+            bytes[i] ^= delta[i];
+        }
+    }
+    position += length;
+
+    started = true;
+    hires = frameHires;
+    frameNumber = number;
+    frame.number = number;
+    frame.hires = frameHires;
+    frame.keyframe = keyframe;
+    FrameRecorder::fromColumns(bytes.data(), frameHires, frame);
+    return true;
+}
+
+bool FrameReader::getVarint(uint64_t &value) {
+    value = 0;
+    for (unsigned int shift = 0; shift < 64 && position < data.size(); shift += 7) {
+        uint8_t byte = data[position++];
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
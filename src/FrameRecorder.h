@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Chip8.h"
+#include "SpscQueue.h"
+
+// Frame recordings: the display of every frame in which it changed, for
+// watching a headless run afterwards (see chip8_recorder_export). A file
+// starts with magic "C8FR", u16 version and u16 keyframe interval, then has
+// one record per frame, all values little-endian:
+//
+//     u8      flags: bit 0 keyframe, bit 1 hi-res, bit 2 end of the recording
+//     varint  frames since the previous record (the frame number for the first)
+//     varint  payload size, then the payload, unless it's the end record
+//
+// Varints are LEB128. The payload is the display with each plane stored by
+// columns of 8 pixels, top to bottom and then left to right, so a sprite is
+// one run of bytes per column it touches. Other frames are XORed with the one
+// before them and keyframes stored as they are. Then the bytes are run-length
+// coded: a control byte below 0x80 is followed by control + 1 literal bytes,
+// and one from 0x80 stands for control - 0x7F zero bytes. A frame that moved
+// a sprite takes some 10 to 30 bytes, and frames without changes none. A
+// keyframe every few seconds, and on every change of resolution, lets a
+// reader start there.
+//
+// The end record gives the frame after the last one, so the last frame's
+// length is known.
+
+// A recorded frame, as the reader returns it
+struct RecordedFrame {
+    uint64_t number{};
+    bool hires{};
+    bool keyframe{};
+    std::array<Chip8::Plane, Chip8::PLANES> display{};
+};
+
+// Records a Chip8's frames as its frame sink. The emulating thread only
+// copies the display into a queue; the recorder's own thread compresses the
+// frames and writes them to the file. If the writer falls behind by a whole
+// queue, the emulating thread waits for it, so no frame is lost.
+class FrameRecorder : public FrameSink {
+public:
+    // Frames between keyframes by default, 10 seconds
+    static constexpr unsigned int KEYFRAME_INTERVAL = 600;
+
+    FrameRecorder();
+    ~FrameRecorder() override;
+    FrameRecorder(const FrameRecorder &) = delete;
+    FrameRecorder &operator=(const FrameRecorder &) = delete;
+
+    // Start a recording, with a keyframe at least every keyframeInterval
+    // frames (up to 65535)
+    bool open(const std::string &path, unsigned int keyframeInterval = KEYFRAME_INTERVAL);
+    // Write the rest of the frames and the end record, with endFrame the
+    // number of frames the run had (at least one past the last frame
+    // recorded), and stop the writer thread. False if anything could not be
+    // written.
+    bool close(uint64_t endFrame);
+
+    void frame(uint64_t number, const Chip8 &chip8) override;
+
+    // Frames and bytes written so far
+    uint64_t getFrames() const { return framesWritten.load(std::memory_order_relaxed); }
+    uint64_t getBytes() const { return bytesWritten.load(std::memory_order_relaxed); }
+
+private:
+    friend class FrameReader;
+
+    enum Flags : uint8_t {
+        KEYFRAME_FLAG = 1,
+        HIRES_FLAG = 2,
+        END_FLAG = 4,
+    };
+
+    static constexpr char MAGIC[4] = {'C', '8', 'F', 'R'};
+    static constexpr uint16_t VERSION = 1;
+    // Bytes of a display in columns, for both planes at the hi-res size
+    static constexpr size_t MAX_FRAME_BYTES = Chip8::PLANES * Chip8::HIRES_WIDTH / 8 * Chip8::HIRES_HEIGHT;
+    // Frames the emulating thread can be ahead of the writer
+    static constexpr size_t QUEUE_SIZE = 64;
+
+    struct Snapshot {
+        uint64_t number{};
+        bool hires{};
+        std::array<Chip8::Plane, Chip8::PLANES> display{};
+    };
+
+    // Both planes of the rows in use, in columns of 8 pixels. Words that are
+    // zero, most of them in a delta, are skipped.
+    static size_t toColumns(const std::array<Chip8::Plane, Chip8::PLANES> &display, bool hires, uint8_t *out);
+    static void fromColumns(const uint8_t *bytes, bool hires, RecordedFrame &frame);
+    static void encodeRuns(const uint8_t *bytes, size_t size, std::vector<uint8_t> &out);
+    // False if the runs don't make exactly size bytes
+    static bool decodeRuns(const uint8_t *data, size_t length, uint8_t *out, size_t size);
+    static void putVarint(std::vector<uint8_t> &out, uint64_t value);
+
+    void writerLoop();
+    void encode(const Snapshot &snapshot);
+    void flush();
+
+    std::unique_ptr<SpscQueue<Snapshot, QUEUE_SIZE>> queue;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::atomic<bool> closing{false};
+
+    // Writer thread state
+    std::ofstream file;
+    unsigned int keyframeInterval{KEYFRAME_INTERVAL};
+    std::array<Chip8::Plane, Chip8::PLANES> previous{};
+    std::array<Chip8::Plane, Chip8::PLANES> delta{};
+    std::array<uint8_t, MAX_FRAME_BYTES> columns{};
+    bool previousHires{};
+    bool started{false};       // A frame was written, so previous holds it
+    uint64_t lastFrame{};
+    uint64_t lastKeyframe{};
+    std::vector<uint8_t> runs;   // Payload of the frame being encoded
+    std::vector<uint8_t> buffer; // Encoded records waiting to be written
+    bool failed{false};
+
+    std::atomic<uint64_t> framesWritten{0};
+    std::atomic<uint64_t> bytesWritten{0};
+};
+
+// Reads a recording back frame by frame
+class FrameReader {
+public:
+    bool open(const std::string &path);
+    // Next recorded frame, false after the last one or at a damaged record
+    bool next(RecordedFrame &frame);
+    // The number of frames of the recording, known once next() returned false
+    // at the end record. 0 if the recording has none.
+    uint64_t getEndFrame() const { return endFrame; }
+    unsigned int getKeyframeInterval() const { return keyframeInterval; }
+
+private:
+    bool getVarint(uint64_t &value);
+
+    std::vector<uint8_t> data;
+    size_t position{};
+    unsigned int keyframeInterval{};
+    std::array<uint8_t, FrameRecorder::MAX_FRAME_BYTES> bytes{};
+    bool started{false};
+    bool hires{false};
+    uint64_t frameNumber{};
+    uint64_t endFrame{};
+};
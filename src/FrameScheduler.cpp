@@ -0,0 +1,46 @@
+#include "FrameScheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+FrameScheduler::FrameScheduler(unsigned int framesPerSecond, unsigned int maxCatchUp)
+    : framesPerSecond(std::max(1u, framesPerSecond)),
+      maxCatchUp(std::max(1u, maxCatchUp)),
+      start(Clock::now()) {
+}
+
+FrameScheduler::Clock::time_point FrameScheduler::deadline(uint64_t frame) const {
+    return start + std::chrono::nanoseconds(frame * 1000000000ull / framesPerSecond);
+}
+
+unsigned int FrameScheduler::pollFrames() {
+    // Frames 0 to elapsed * fps are due
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    uint64_t dueUntil = elapsed * framesPerSecond / 1000000000ull + 1;
+    if (dueUntil <= nextFrame) return 0;
+
+    uint64_t due = dueUntil - nextFrame;
+    if (due > maxCatchUp) {
+        // Too far behind to catch up without a visible fast-forward
+        droppedFrames += due - maxCatchUp;
+        due = maxCatchUp;
+    }
+    nextFrame = dueUntil;
+    return static_cast<unsigned int>(due);
+}
+
+unsigned int FrameScheduler::waitForFrames() {
+    Clock::time_point target = deadline(nextFrame);
+    Clock::time_point now = Clock::now();
+    std::chrono::nanoseconds spin = std::clamp(oversleep * 2, MIN_SPIN, MAX_SPIN);
+    if (target - now > spin) {
+        Clock::time_point wake = target - spin;
+        std::this_thread::sleep_until(wake);
+        // Moving average over roughly the last 8 sleeps
+        oversleep += (std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - wake) - oversleep) / 8;
+    }
+    while (Clock::now() < target) {
+        std::this_thread::yield();
+    }
+    return pollFrames();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Paces emulated frames against the host clock. Frame N is due at
+// start + N / framesPerSecond, computed from N rather than by adding up frame
+// lengths, so the rate stays exact over any run length. Waiting sleeps until
+// shortly before the deadline and spins for the rest, which keeps the CPU idle
+// between frames without the oversleep of a plain sleep. How early to wake up
+// follows how much the host's sleeps have overshot lately.
+class FrameScheduler {
+public:
+    // maxCatchUp limits how many late frames are run back to back after a
+    // stall; frames beyond that are dropped
+    explicit FrameScheduler(unsigned int framesPerSecond = 60, unsigned int maxCatchUp = 4);
+
+    // Block until the next frame is due, then return how many frames to run
+    unsigned int waitForFrames();
+
+    uint64_t getDroppedFrames() const { return droppedFrames; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Bounds of the time left before a deadline that is spun away instead of slept
+    static constexpr std::chrono::nanoseconds MIN_SPIN{100000};
+    static constexpr std::chrono::nanoseconds MAX_SPIN{4000000};
+
+    Clock::time_point deadline(uint64_t frame) const;
+    // How many frames are due now, possibly 0, with catch-up limited
+    unsigned int pollFrames();
+
+    unsigned int framesPerSecond;
+    unsigned int maxCatchUp;
+    Clock::time_point start;
+    uint64_t nextFrame{};
+    uint64_t droppedFrames{};
+    std::chrono::nanoseconds oversleep{1000000}; // Recent average of how late sleeps return
+};
@@ -0,0 +1,149 @@
+#include "InputMovie.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+constexpr char MOVIE_MAGIC[4] = {'C', '8', 'M', 'V'};
+constexpr uint16_t MOVIE_VERSION = 2;
+
+template <typename T>
+void put(std::vector<uint8_t> &out, T value) {
+    for (size_t i = 0; i < sizeof(T); i++) {
+        out.push_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (i * 8)));
+    }
+}
+
+// Reads a little-endian value, or fails once the data runs out
+template <typename T>
+bool get(const std::vector<uint8_t> &in, size_t &position, T &value) {
+    if (in.size() - position < sizeof(T)) return false;
+    uint64_t result = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        result |= static_cast<uint64_t>(in[position++]) << (i * 8);
+    }
+    value = static_cast<T>(result);
+    return true;
+}
+
+} // namespace
+
+void InputMovie::record(uint16_t keys, uint64_t hash) {
+    if (input.empty() || input.back().keys != keys) {
+        input.push_back({frameCount(), keys});
+    }
+    frameHashes.push_back(hash);
+}
+
+void InputMovie::truncate(uint64_t frames) {
+    if (frames >= frameCount()) return;
+    frameHashes.resize(frames);
+    while (!input.empty() && input.back().frame >= frames) {
+        input.pop_back();
+    }
+}
+
+uint16_t InputMovie::keysAt(uint64_t frame) const {
+    // The last change at or before the frame
+    auto next = std::upper_bound(input.begin(), input.end(), frame,
+                                 [](uint64_t value, const KeyEvent &event) { return value < event.frame; });
+    return next == input.begin() ? 0 : std::prev(next)->keys;
+}
+
+bool InputMovie::save(const std::string &filename) const {
+    std::vector<uint8_t> data(std::begin(MOVIE_MAGIC), std::end(MOVIE_MAGIC));
+    put<uint16_t>(data, MOVIE_VERSION);
+    put<uint32_t>(data, seed);
+    put<uint32_t>(data, static_cast<uint32_t>(ips));
+    put<uint8_t>(data, static_cast<uint8_t>(quirks));
+    put<uint64_t>(data, romHash);
+    put<uint32_t>(data, static_cast<uint32_t>(input.size()));
+    for (const KeyEvent &event: input) {
+        put<uint64_t>(data, event.frame);
+        put<uint16_t>(data, event.keys);
+    }
+    put<uint64_t>(data, frameCount());
+    for (uint64_t hash: frameHashes) {
+        put<uint64_t>(data, hash);
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.write(reinterpret_cast<const char *>(data.data()), data.size())) {
+        std::cerr << "Error: Could not write movie file " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool InputMovie::load(const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open movie file " << filename << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t position = sizeof(MOVIE_MAGIC);
+    uint16_t version = 0;
+    if (data.size() < position || std::memcmp(data.data(), MOVIE_MAGIC, position) != 0 ||
+        !get(data, position, version)) {
+        std::cerr << "Error: " << filename << " is not a movie file" << std::endl;
+        return false;
+    }
+    if (version == 0 || version > MOVIE_VERSION) {
+        std::cerr << "Error: Unsupported movie version " << version << std::endl;
+        return false;
+    }
+
+    uint32_t ipsValue = 0;
+    uint8_t profile = 0;
+    uint32_t eventCount = 0;
+    uint64_t frames = 0;
+    bool ok = get(data, position, seed) && get(data, position, ipsValue) &&
+              (version < 2 || get(data, position, profile)) && get(data, position, romHash) &&
+              get(data, position, eventCount);
+    if (ok && profile >= static_cast<uint8_t>(QuirkProfile::Count)) {
+        std::cerr << "Error: Movie file " << filename << " uses an unknown quirk profile" << std::endl;
+        return false;
+    }
+    input.clear();
+    for (uint32_t i = 0; ok && i < eventCount; i++) {
+        KeyEvent event{};
+        ok = get(data, position, event.frame) && get(data, position, event.keys);
+        input.push_back(event);
+    }
+    ok = ok && get(data, position, frames) && (data.size() - position) / sizeof(uint64_t) >= frames;
+    frameHashes.clear();
+    for (uint64_t i = 0; ok && i < frames; i++) {
+        uint64_t hash = 0;
+        get(data, position, hash);
+        frameHashes.push_back(hash);
+    }
+    if (!ok) {
+        std::cerr << "Error: Movie file " << filename << " is truncated" << std::endl;
+        return false;
+    }
+    // keysAt() and truncate() rely on the events being in frame order
+    for (size_t i = 1; i < input.size(); i++) {
+        if (input[i].frame <= input[i - 1].frame) {
+            std::cerr << "Error: Movie file " << filename << " is damaged" << std::endl;
+            return false;
+        }
+    }
+    ips = ipsValue;
+    quirks = static_cast<QuirkProfile>(profile);
+    return true;
+}
+
+uint64_t InputMovie::hashROM(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
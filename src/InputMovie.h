@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BatchRunner.h"
+#include "Quirks.h"
+
+// Recording of a seeded run: the keypad state of every frame, stored as the
+// frames where it changes, and the Chip8::stateHash() after every frame.
+// Replaying the input into a Chip8 built with the same seed and running
+// cyclesInFrame() instructions per frame must reproduce every hash.
+//
+// File format, all values little-endian: magic "C8MV", u16 version, u32 seed,
+// u32 ips, u8 quirk profile (version 2 and later), u64 ROM hash, u32 event
+// count, events as (u64 frame, u16 keys), u64 frame count, one u64 hash per
+// frame. Version 1 files were all recorded with the modern quirks.
+struct InputMovie {
+    unsigned int seed{};
+    uint64_t ips{660};                 // Emulated instructions per second
+    QuirkProfile quirks{QuirkProfile::Modern};
+    uint64_t romHash{};                // hashROM() of the ROM the movie was recorded with
+    std::vector<KeyEvent> input;       // Keypad changes, sorted by frame
+    std::vector<uint64_t> frameHashes; // State hash at the end of each frame
+
+    uint64_t frameCount() const { return frameHashes.size(); }
+    // Append a frame: the keys held while it ran and the state hash after it
+    void record(uint16_t keys, uint64_t hash);
+    // Drop everything after the first frames, e.g. when the player rewinds
+    void truncate(uint64_t frames);
+
+    uint16_t keysAt(uint64_t frame) const;
+    // Instructions in the given frame, spread evenly when ips is not a multiple of 60
+    uint64_t cyclesInFrame(uint64_t frame) const { return ips * (frame + 1) / 60 - ips * frame / 60; }
+
+    bool save(const std::string &filename) const;
+    bool load(const std::string &filename);
+
+    // FNV-1a hash of a ROM image, to catch replays against the wrong ROM
+    static uint64_t hashROM(const uint8_t *data, size_t size);
+};
@@ -0,0 +1,137 @@
+#include "Profiler.h"
+
+#include "Disassembler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <vector>
+
+void Profiler::readDelay(uint16_t address, uint8_t value) {
+    // A timer that is still running, read again by the same FX07 right after
+    // the last time, means the ROM is busy waiting for it
+    if (value != 0 && address == lastDelayRead && sinceDelayRead <= SPIN_WINDOW) {
+        frameDelayCycles += sinceDelayRead;
+    }
+    lastDelayRead = address;
+    sinceDelayRead = 0;
+}
+
+void Profiler::endFrame() {
+    frames++;
+    delayCycles += frameDelayCycles;
+    waitCycles += frameWaitCycles;
+    maxFrameDelayCycles = std::max(maxFrameDelayCycles, frameDelayCycles);
+    maxFrameWaitCycles = std::max(maxFrameWaitCycles, frameWaitCycles);
+    frameDelayCycles = 0;
+    frameWaitCycles = 0;
+}
+
+void Profiler::reset() {
+    // In place, as a fresh Profiler is too big for the stack
+    addressCounts.fill(0);
+    opcodes.fill(0);
+    formCounts.fill(0);
+    cycles = 0;
+    maxStackDepth = 0;
+    draws = 0;
+    collisions = 0;
+    clears = 0;
+    lastDelayRead = 0xFFFF;
+    sinceDelayRead = 0;
+    frameDelayCycles = 0;
+    frameWaitCycles = 0;
+    frames = 0;
+    delayCycles = 0;
+    waitCycles = 0;
+    maxFrameDelayCycles = 0;
+    maxFrameWaitCycles = 0;
+}
+
+namespace {
+
+double percent(uint64_t part, uint64_t total) {
+    return total > 0 ? 100.0 * part / total : 0;
+}
+
+} // namespace
+
+void Profiler::printFlat(std::ostream &out) const {
+    // Any opcode of a form will do to name it, rebuild one from the index
+    std::vector<std::pair<uint64_t, unsigned int>> forms;
+    for (unsigned int i = 0; i < formCounts.size(); i++) {
+        if (formCounts[i] > 0) forms.emplace_back(formCounts[i], i);
+    }
+    std::sort(forms.rbegin(), forms.rend());
+
+    out << std::fixed << std::setprecision(2)
+        << "instructions: " << cycles << "\n"
+        << "form       count         %\n";
+    for (const auto &[count, index]: forms) {
+        uint16_t opcode = static_cast<uint16_t>(((index >> 8) << 12) | (index & 0xFF));
+        out << std::left << std::setw(8) << opcodePattern(opcode) << std::right << std::setw(11) << count
+            << std::setw(9) << percent(count, cycles) << "\n";
+    }
+
+    uint64_t frameCount = std::max<uint64_t>(frames, 1);
+    out << "max stack depth: " << maxStackDepth << "\n"
+        << "draws: " << draws << " (" << collisions << " with collisions)\n"
+        << "clears: " << clears << "\n"
+        << "delay timer spin: " << percent(delayCycles, cycles) << "% of instructions, "
+        << static_cast<double>(delayCycles) / frameCount << " per frame (max " << maxFrameDelayCycles << ")\n"
+        << "key wait (FX0A): " << percent(waitCycles, cycles) << "% of instructions, "
+        << static_cast<double>(waitCycles) / frameCount << " per frame (max " << maxFrameWaitCycles << ")\n";
+    out << std::defaultfloat;
+}
+
+void Profiler::printHotLoops(std::ostream &out, unsigned int count) const {
+    // Split the executed addresses into runs of consecutive instructions
+    struct Region {
+        uint16_t first;
+        uint16_t last;
+        uint64_t total;
+        bool loop;
+    };
+    std::vector<Region> regions;
+    for (unsigned int start = 0; start < MEMORY_SIZE; start++) {
+        if (addressCounts[start] == 0) continue;
+        // Code may run at odd addresses, so only merge with earlier regions of the same parity
+        bool merged = false;
+        for (Region &region: regions) {
+            if (region.last + 2u == start) {
+                region.last = static_cast<uint16_t>(start);
+                region.total += addressCounts[start];
+                merged = true;
+                break;
+            }
+        }
+        if (!merged) regions.push_back({static_cast<uint16_t>(start), static_cast<uint16_t>(start),
+                                        addressCounts[start], false});
+    }
+
+    // A region is a loop if one of its jumps goes back into it
+    for (Region &region: regions) {
+        for (unsigned int address = region.first; address <= region.last; address += 2) {
+            uint16_t opcode = opcodes[address];
+            uint16_t target = opcode & 0x0FFF;
+            if ((opcode & 0xF000) == 0x1000 && target >= region.first && target <= address) {
+                region.loop = true;
+            }
+        }
+    }
+    std::sort(regions.begin(), regions.end(), [](const Region &a, const Region &b) { return a.total > b.total; });
+
+    out << std::fixed << std::setprecision(2) << std::hex << std::uppercase;
+    for (size_t i = 0; i < regions.size() && i < count; i++) {
+        const Region &region = regions[i];
+        out << (region.loop ? "loop " : "code ") << "0x" << region.first << "-0x" << region.last << std::dec
+            << "  " << percent(region.total, cycles) << "% of instructions\n";
+        for (unsigned int address = region.first; address <= region.last; address += 2) {
+            out << "  0x" << std::hex << std::setw(3) << std::setfill('0') << address << std::setfill(' ')
+                << "  " << std::setw(4) << std::setfill('0') << opcodes[address] << std::setfill(' ') << std::dec
+                << std::setw(12) << addressCounts[address] << std::setw(8)
+                << percent(addressCounts[address], cycles) << "%  " << disassemble(opcodes[address]) << "\n";
+        }
+        out << std::hex;
+    }
+    out << std::dec << std::nouppercase << std::defaultfloat;
+}
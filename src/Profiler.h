@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+// Hook policies for Chip8::run(). The run loop is a template over the policy,
+// so the hooks of NoProfiling are empty inline functions that compile away,
+// while run(cycles, profiler) gets a separate copy of the loop that calls
+// Profiler at every instruction. Policies with BREAKS set (see Debugger.h)
+// can also stop the loop before an instruction.
+struct NoProfiling {
+    static constexpr bool ENABLED = false;
+    static constexpr bool BREAKS = false;
+
+    void instruction(uint16_t, uint16_t) {}
+    void write(uint16_t, uint8_t) {}
+    void readDelay(uint16_t, uint8_t) {}
+    void waitKey() {}
+    void call(unsigned int) {}
+    void draw(bool) {}
+    void clear() {}
+};
+
+// Counts executions per address and per opcode form, plus a few events that
+// tell where a ROM spends its time. Call endFrame() once per frame to get the
+// per-frame figures.
+class Profiler {
+public:
+    static constexpr bool ENABLED = true;
+    static constexpr bool BREAKS = false;
+    static constexpr unsigned int MEMORY_SIZE = 65536; // Big enough for XO-CHIP
+
+    // Hooks called by Chip8::run()
+    void instruction(uint16_t address, uint16_t opcode) {
+        address &= MEMORY_SIZE - 1;
+        addressCounts[address]++;
+        opcodes[address] = opcode;
+        formCounts[formIndex(opcode)]++;
+        cycles++;
+        sinceDelayRead++;
+    }
+    void write(uint16_t, uint8_t) {}
+    void readDelay(uint16_t address, uint8_t value);
+    void waitKey() { frameWaitCycles++; }
+    void call(unsigned int depth) { maxStackDepth = depth > maxStackDepth ? depth : maxStackDepth; }
+    void draw(bool collision) {
+        draws++;
+        collisions += collision;
+    }
+    void clear() { clears++; }
+
+    void endFrame();
+    void reset();
+
+    uint64_t getCycles() const { return cycles; }
+    uint64_t getCount(uint16_t address) const { return addressCounts[address & (MEMORY_SIZE - 1)]; }
+
+    // Opcode forms by execution count, plus the event counters
+    void printFlat(std::ostream &out) const;
+    // The busiest runs of consecutive instructions, disassembled
+    void printHotLoops(std::ostream &out, unsigned int count) const;
+
+private:
+    // Opcodes that only differ in operands share a form: top nibble plus the
+    // low nibble for 8XY_ and the low byte for 00E_, 00F_, EX__ and FX__
+    static unsigned int formIndex(uint16_t opcode) {
+        unsigned int nibble = opcode >> 12;
+        unsigned int sub = 0;
+        if (nibble == 0x8) sub = opcode & 0x000F;
+        else if (nibble == 0xE || nibble == 0xF) sub = opcode & 0x00FF;
+        else if (nibble == 0x0 && (opcode == 0x00E0 || opcode == 0x00EE || (opcode >= 0x00FB && opcode <= 0x00FF))) sub = opcode & 0x00FF;
+        else if (nibble == 0x0 && (opcode & 0xFFE0) == 0x00C0) sub = opcode & 0x00F0; // 00CN and 00DN
+        return (nibble << 8) | sub;
+    }
+
+    // Loops that read the delay timer and come back to the same FX07 within
+    // this many instructions count as waiting for the timer
+    static constexpr unsigned int SPIN_WINDOW = 8;
+
+    std::array<uint64_t, MEMORY_SIZE> addressCounts{};
+    std::array<uint16_t, MEMORY_SIZE> opcodes{}; // Last opcode seen at each address
+    std::array<uint64_t, 16 * 256> formCounts{};
+    uint64_t cycles{};
+
+    unsigned int maxStackDepth{};
+    uint64_t draws{};
+    uint64_t collisions{};
+    uint64_t clears{};
+
+    // Delay timer and FX0A waits, for the current frame and in total
+    uint16_t lastDelayRead{0xFFFF};
+    uint64_t sinceDelayRead{};
+    uint64_t frameDelayCycles{};
+    uint64_t frameWaitCycles{};
+    uint64_t frames{};
+    uint64_t delayCycles{};
+    uint64_t waitCycles{};
+    uint64_t maxFrameDelayCycles{};
+    uint64_t maxFrameWaitCycles{};
+};
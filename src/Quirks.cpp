@@ -0,0 +1,28 @@
+#include "Quirks.h"
+
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+constexpr const char *PROFILE_NAMES[] = {"modern", "vip", "chip48", "schip", "xochip"};
+static_assert(std::size(PROFILE_NAMES) == static_cast<size_t>(QuirkProfile::Count));
+
+} // namespace
+
+const char *quirkProfileName(QuirkProfile profile) {
+    size_t index = static_cast<size_t>(profile);
+    return index < std::size(PROFILE_NAMES) ? PROFILE_NAMES[index] : "unknown";
+}
+
+bool parseQuirkProfile(const std::string &name, QuirkProfile &profile) {
+    for (size_t i = 0; i < std::size(PROFILE_NAMES); i++) {
+        if (name == PROFILE_NAMES[i]) {
+            profile = static_cast<QuirkProfile>(i);
+            return true;
+        }
+    }
+    std::cerr << "Error: Unknown quirk profile " << name << ", use modern, vip, chip48, schip or xochip"
+              << std::endl;
+    return false;
+}
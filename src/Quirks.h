@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Behaviours that differ between CHIP-8 implementations, as tested by
+// roms/test-roms/5-quirks.ch8. Each profile is a policy of constants that
+// Chip8 compiles its run loop against, so every profile gets its own copy of
+// the loop with the choices already made (see Chip8::setQuirks()). The
+// profiles also decide which instruction set extensions are there.
+enum class QuirkProfile : uint8_t {
+    Modern,    // What this emulator always did, and the default
+    CosmacVip, // The original interpreter on the COSMAC VIP
+    Chip48,    // CHIP-48 on the HP-48 calculators
+    Schip,     // SUPER-CHIP 1.1
+    XoChip,    // Octo's XO-CHIP
+    Count
+};
+
+// What FX55 and FX65 leave in I
+enum class IndexIncrement : uint8_t {
+    Unchanged,
+    ByX,        // I += X
+    ByXPlusOne, // I += X + 1, I ends up past the last register
+};
+
+struct ModernQuirks {
+    static constexpr bool VF_RESET = false;      // 8XY1, 8XY2 and 8XY3 clear VF
+    static constexpr bool SHIFT_VY = false;      // 8XY6 and 8XYE shift VY into VX instead of VX in place
+    static constexpr IndexIncrement INDEX_INCREMENT = IndexIncrement::Unchanged;
+    static constexpr bool JUMP_VX = false;       // BXNN jumps to XNN + VX instead of NNN + V0
+    static constexpr bool WRAP_SPRITES = false;  // Sprites wrap around the screen edges instead of clipping
+    static constexpr bool DISPLAY_WAIT = false;  // DXYN waits for the next 60Hz tick
+    static constexpr bool SCHIP_OPCODES = false; // 128x64 hi-res mode, scrolling, DXY0, FX30, FX75 and FX85
+    static constexpr bool XO_CHIP_OPCODES = false; // Bit planes, 00DN, 5XY2, 5XY3, F000 NNNN, FN01, F002, FX3A
+    static constexpr unsigned int MEMORY_SIZE = 4096; // Bytes of RAM, XO-CHIP has 64 KB
+};
+
+struct CosmacVipQuirks {
+    static constexpr bool VF_RESET = true;
+    static constexpr bool SHIFT_VY = true;
+    static constexpr IndexIncrement INDEX_INCREMENT = IndexIncrement::ByXPlusOne;
+    static constexpr bool JUMP_VX = false;
+    static constexpr bool WRAP_SPRITES = false;
+    static constexpr bool DISPLAY_WAIT = true;
+    static constexpr bool SCHIP_OPCODES = false;
+    static constexpr bool XO_CHIP_OPCODES = false;
+    static constexpr unsigned int MEMORY_SIZE = 4096;
+};
+
+struct Chip48Quirks {
+    static constexpr bool VF_RESET = false;
+    static constexpr bool SHIFT_VY = false;
+    static constexpr IndexIncrement INDEX_INCREMENT = IndexIncrement::ByX;
+    static constexpr bool JUMP_VX = true;
+    static constexpr bool WRAP_SPRITES = false;
+    static constexpr bool DISPLAY_WAIT = false;
+    static constexpr bool SCHIP_OPCODES = false;
+    static constexpr bool XO_CHIP_OPCODES = false;
+    static constexpr unsigned int MEMORY_SIZE = 4096;
+};
+
+struct SchipQuirks {
+    static constexpr bool VF_RESET = false;
+    static constexpr bool SHIFT_VY = false;
+    static constexpr IndexIncrement INDEX_INCREMENT = IndexIncrement::Unchanged;
+    static constexpr bool JUMP_VX = true;
+    static constexpr bool WRAP_SPRITES = false;
+    static constexpr bool DISPLAY_WAIT = false;
+    static constexpr bool SCHIP_OPCODES = true;
+    static constexpr bool XO_CHIP_OPCODES = false;
+    static constexpr unsigned int MEMORY_SIZE = 4096;
+};
+
+struct XoChipQuirks {
+    static constexpr bool VF_RESET = false;
+    static constexpr bool SHIFT_VY = true;
+    static constexpr IndexIncrement INDEX_INCREMENT = IndexIncrement::ByXPlusOne;
+    static constexpr bool JUMP_VX = false;
+    static constexpr bool WRAP_SPRITES = true;
+    static constexpr bool DISPLAY_WAIT = false;
+    static constexpr bool SCHIP_OPCODES = true;
+    static constexpr bool XO_CHIP_OPCODES = true;
+    static constexpr unsigned int MEMORY_SIZE = 65536;
+};
+
+// Names as used on the command line: modern, vip, chip48, schip, xochip
+const char *quirkProfileName(QuirkProfile profile);
+bool parseQuirkProfile(const std::string &name, QuirkProfile &profile);
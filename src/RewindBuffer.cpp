@@ -0,0 +1,156 @@
+#include "RewindBuffer.h"
+
+#include "Chip8.h"
+
+#include <algorithm>
+
+// Delta format: a sequence of [u16 skip][u16 length][length bytes], all
+// little-endian. skip is the number of unchanged bytes before the run, and the
+// run bytes are XORed into the keyframe. Skips and runs longer than 16 bits
+// (possible with the 64 KB memory of XO-CHIP) are split into several entries.
+
+namespace {
+
+// Zero bytes inside a run that are cheaper to store than to start a new run for
+constexpr size_t MAX_ZERO_GAP = 4;
+
+void putWord(std::vector<uint8_t> &out, size_t value) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+size_t getWord(const uint8_t *in) {
+    return in[0] | (in[1] << 8);
+}
+
+} // namespace
+
+RewindBuffer::RewindBuffer(size_t capacity, unsigned int keyframeInterval)
+    : capacity(std::max<size_t>(1, capacity)),
+      keyframeInterval(std::max(1u, keyframeInterval)) {
+}
+
+void RewindBuffer::encodeDelta(const uint8_t *state, const uint8_t *keyframe, size_t size, std::vector<uint8_t> &out) {
+    size_t position = 0;
+    size_t last = 0; // End of the previous run
+    while (position < size) {
+        if (state[position] == keyframe[position]) {
+            position++;
+            continue;
+        }
+
+        // Extend the run until a long enough stretch of unchanged bytes
+        size_t start = position;
+        size_t end = position + 1;
+        for (size_t zeros = 0; position < size && zeros <= MAX_ZERO_GAP; position++) {
+            if (state[position] == keyframe[position]) {
+                zeros++;
+            } else {
+                zeros = 0;
+                end = position + 1;
+            }
+        }
+
+        for (; start - last > UINT16_MAX; last += UINT16_MAX) {
+            putWord(out, UINT16_MAX);
+            putWord(out, 0);
+        }
+        while (start < end) {
+            size_t length = std::min<size_t>(end - start, UINT16_MAX);
+            putWord(out, start - last);
+            putWord(out, length);
+            for (size_t i = start; i < start + length; i++) {
+                out.push_back(state[i] ^ keyframe[i]);
+            }
+            start += length;
+            last = start;
+        }
+        position = end;
+    }
+}
+
+void RewindBuffer::applyDelta(const uint8_t *delta, const uint8_t *end, uint8_t *state) {
+    while (delta < end) {
+        state += getWord(delta);
+        size_t length = getWord(delta + 2);
+        delta += 4;
+        for (size_t i = 0; i < length; i++) {
+            state[i] ^= delta[i];
+        }
+        state += length;
+        delta += length;
+    }
+}
+
+void RewindBuffer::recycle(Segment &segment) {
+    segment.deltas.clear();
+    segment.offsets.clear();
+    spare.push_back(std::move(segment));
+}
+
+void RewindBuffer::push(const Chip8 &chip8) {
+    // Deltas need a keyframe of the same size, so a change of memory size
+    // starts a new segment
+    size_t size = chip8.stateSize();
+    if (segments.empty() || segments.back().offsets.size() + 1 >= keyframeInterval ||
+        segments.back().keyframe.size() != size) {
+        Segment segment;
+        if (!spare.empty()) {
+            segment = std::move(spare.back());
+            spare.pop_back();
+        }
+        segment.keyframe.resize(size);
+        chip8.saveState(segment.keyframe.data());
+        segments.push_back(std::move(segment));
+    } else {
+        Segment &segment = segments.back();
+        scratch.resize(size);
+        chip8.saveState(scratch.data());
+        segment.offsets.push_back(static_cast<uint32_t>(segment.deltas.size()));
+        encodeDelta(scratch.data(), segment.keyframe.data(), size, segment.deltas);
+    }
+    frameCount++;
+
+    // Deltas can't outlive their keyframe, so drop the oldest segment as a whole
+    while (frameCount > capacity && segments.size() > 1) {
+        frameCount -= 1 + segments.front().offsets.size();
+        recycle(segments.front());
+        segments.pop_front();
+    }
+}
+
+bool RewindBuffer::pop(Chip8 &chip8) {
+    if (segments.empty()) return false;
+
+    Segment &segment = segments.back();
+    if (segment.offsets.empty()) {
+        if (!chip8.loadState(segment.keyframe.data(), segment.keyframe.size())) return false;
+        recycle(segment);
+        segments.pop_back();
+    } else {
+        uint32_t start = segment.offsets.back();
+        scratch.assign(segment.keyframe.begin(), segment.keyframe.end());
+        applyDelta(segment.deltas.data() + start, segment.deltas.data() + segment.deltas.size(), scratch.data());
+        if (!chip8.loadState(scratch.data(), scratch.size())) return false;
+        segment.deltas.resize(start);
+        segment.offsets.pop_back();
+    }
+    frameCount--;
+    return true;
+}
+
+void RewindBuffer::clear() {
+    while (!segments.empty()) {
+        recycle(segments.back());
+        segments.pop_back();
+    }
+    frameCount = 0;
+}
+
+size_t RewindBuffer::memoryUsage() const {
+    size_t bytes = 0;
+    for (const Segment &segment: segments) {
+        bytes += segment.keyframe.size() + segment.deltas.size() + segment.offsets.size() * sizeof(uint32_t);
+    }
+    return bytes;
+}
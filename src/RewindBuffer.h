@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+class Chip8;
+
+// History of per-frame save states for rewinding. Every keyframeInterval
+// frames a full state is stored, and the frames in between are stored as the
+// XOR of their state with that keyframe, with the runs of zero bytes left out.
+// Within a second of play usually only the display, a few registers and the
+// timers change, so a frame takes tens to hundreds of bytes instead of a full
+// Chip8::stateSize().
+class RewindBuffer {
+public:
+    // capacity is the number of frames kept. The oldest frames are dropped a
+    // whole keyframe interval at a time.
+    explicit RewindBuffer(size_t capacity = 60 * 60 * 5, unsigned int keyframeInterval = 60);
+
+    // Record the current state
+    void push(const Chip8 &chip8);
+    // Restore the most recently recorded state and drop it from the history.
+    // Returns false if there is nothing left to rewind to, or if the state
+    // could not be loaded, in which case it stays in the history.
+    bool pop(Chip8 &chip8);
+    void clear();
+
+    size_t size() const { return frameCount; }
+    // Bytes used by the recorded states
+    size_t memoryUsage() const;
+
+private:
+    // A keyframe and the deltas of the frames recorded after it
+    struct Segment {
+        std::vector<uint8_t> keyframe;
+        std::vector<uint8_t> deltas;   // Encoded deltas back to back
+        std::vector<uint32_t> offsets; // Start of each delta in deltas
+    };
+
+    static void encodeDelta(const uint8_t *state, const uint8_t *keyframe, size_t size, std::vector<uint8_t> &out);
+    static void applyDelta(const uint8_t *delta, const uint8_t *end, uint8_t *state);
+    void recycle(Segment &segment);
+
+    size_t capacity;
+    unsigned int keyframeInterval;
+    std::deque<Segment> segments;
+    std::vector<Segment> spare; // Dropped segments, kept to reuse their buffers
+    size_t frameCount{};
+    std::vector<uint8_t> scratch; // A state being encoded or decoded
+};
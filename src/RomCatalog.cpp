@@ -0,0 +1,399 @@
+#include "RomCatalog.h"
+
+#include "Chip8.h"
+#include "InputMovie.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHIP8_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// A read-only view of a whole file. Where mmap is not available the file is
+// read into memory instead.
+struct RomCatalog::Mapping {
+    const uint8_t *data{};
+    size_t size{};
+    std::vector<uint8_t> copy;
+    bool mapped{false};
+
+    Mapping() = default;
+    Mapping(const Mapping &) = delete;
+    Mapping &operator=(const Mapping &) = delete;
+    ~Mapping() {
+#ifdef CHIP8_HAVE_MMAP
+        if (mapped) munmap(const_cast<uint8_t *>(data), size);
+#endif
+    }
+
+    static std::unique_ptr<Mapping> map(const fs::path &path) {
+        auto mapping = std::make_unique<Mapping>();
+#ifdef CHIP8_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        off_t length = lseek(fd, 0, SEEK_END);
+        if (length > 0) {
+            void *address = mmap(nullptr, static_cast<size_t>(length), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                mapping->data = static_cast<const uint8_t *>(address);
+                mapping->size = static_cast<size_t>(length);
+                mapping->mapped = true;
+            }
+        }
+        ::close(fd);
+        if (length < 0 || (length > 0 && !mapping->mapped)) return nullptr;
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) return nullptr;
+        mapping->copy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        mapping->data = mapping->copy.data();
+        mapping->size = mapping->copy.size();
+#endif
+        return mapping;
+    }
+};
+
+namespace {
+
+constexpr char INDEX_MAGIC[4] = {'C', '8', 'I', 'X'};
+constexpr uint16_t INDEX_VERSION = 1;
+constexpr char ARCHIVE_MAGIC[4] = {'C', '8', 'P', 'K'};
+constexpr uint16_t ARCHIVE_VERSION = 1;
+
+// Largest image that fits behind 0x200 in the 64 KB of XO-CHIP
+constexpr size_t MAX_ROM_SIZE = 65536 - 512;
+
+template <typename T>
+void put(std::vector<uint8_t> &out, T value) {
+    for (size_t i = 0; i < sizeof(T); i++) {
+        out.push_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (i * 8)));
+    }
+}
+
+void putString(std::vector<uint8_t> &out, const std::string &text) {
+    out.insert(out.end(), text.begin(), text.end());
+}
+
+// Reads a little-endian value, or fails once the data runs out
+template <typename T>
+bool get(std::span<const uint8_t> in, size_t &position, T &value) {
+    if (in.size() - position < sizeof(T)) return false;
+    uint64_t result = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        result |= static_cast<uint64_t>(in[position++]) << (i * 8);
+    }
+    value = static_cast<T>(result);
+    return true;
+}
+
+bool getString(std::span<const uint8_t> in, size_t &position, size_t length, std::string &text) {
+    if (in.size() - position < length) return false;
+    text.assign(reinterpret_cast<const char *>(in.data() + position), length);
+    position += length;
+    return true;
+}
+
+bool isRomFile(const fs::path &path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension == ".ch8" || extension == ".c8" || extension == ".sc8" || extension == ".xo8";
+}
+
+bool parseHash(const std::string &text, uint64_t &hash) {
+    auto isHex = [](unsigned char c) { return std::isxdigit(c) != 0; };
+    if (text.size() != 16 || !std::all_of(text.begin(), text.end(), isHex)) return false;
+    hash = std::stoull(text, nullptr, 16);
+    return true;
+}
+
+// What a cached hash was computed from
+struct IndexEntry {
+    uint64_t size;
+    int64_t modified;
+    uint64_t hash;
+};
+
+std::unordered_map<std::string, IndexEntry> readIndex(const fs::path &path) {
+    std::unordered_map<std::string, IndexEntry> index;
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return index;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // A damaged or outdated cache is ignored and rebuilt
+    size_t position = sizeof(INDEX_MAGIC);
+    uint16_t version = 0;
+    uint32_t count = 0;
+    if (data.size() < position || std::memcmp(data.data(), INDEX_MAGIC, position) != 0 ||
+        !get<uint16_t>(data, position, version) || version != INDEX_VERSION || !get(data, position, count)) {
+        return index;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t length = 0;
+        std::string name;
+        IndexEntry entry{};
+        if (!get(data, position, length) || !getString(data, position, length, name) ||
+            !get(data, position, entry.size) || !get(data, position, entry.modified) ||
+            !get(data, position, entry.hash)) {
+            return {};
+        }
+        index[name] = entry;
+    }
+    return index;
+}
+
+} // namespace
+
+RomCatalog::RomCatalog() = default;
+RomCatalog::~RomCatalog() = default;
+
+bool RomCatalog::open(const std::string &path) {
+    roms.clear();
+    mappings.clear();
+    std::error_code error;
+    bool ok = fs::is_directory(path, error) ? openDirectory(path) : openArchive(path);
+    buildIndex();
+    return ok;
+}
+
+bool RomCatalog::openDirectory(const std::string &path) {
+    // Sorted, so the order of the catalog doesn't depend on the file system
+    std::vector<fs::path> files;
+    std::error_code error;
+    for (fs::recursive_directory_iterator it(path, fs::directory_options::skip_permission_denied, error), end;
+         !error && it != end; it.increment(error)) {
+        if (it->is_regular_file(error) && isRomFile(it->path())) files.push_back(it->path());
+    }
+    if (error) {
+        std::cerr << "Error: Could not read ROM directory " << path << std::endl;
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+
+    fs::path cachePath = indexPath.empty() ? fs::path(path) / INDEX_FILE : fs::path(indexPath);
+    std::unordered_map<std::string, IndexEntry> cached;
+    if (indexCaching) cached = readIndex(cachePath);
+    std::vector<uint8_t> index(std::begin(INDEX_MAGIC), std::end(INDEX_MAGIC));
+    put<uint16_t>(index, INDEX_VERSION);
+    put<uint32_t>(index, 0); // Count, filled in below
+    uint32_t count = 0;
+    bool changed = false;
+
+    for (const fs::path &file: files) {
+        uint64_t size = fs::file_size(file, error);
+        if (error || size > MAX_ROM_SIZE) continue;
+        auto mapping = Mapping::map(file);
+        if (!mapping) {
+            std::cerr << "Error: Could not open ROM file " << file.string() << std::endl;
+            continue;
+        }
+
+        RomInfo rom;
+        rom.name = fs::relative(file, path).generic_string();
+        rom.data = std::span<const uint8_t>(mapping->data, mapping->size);
+        int64_t modified = fs::last_write_time(file, error).time_since_epoch().count();
+        auto entry = cached.find(rom.name);
+        if (entry != cached.end() && entry->second.size == size && entry->second.modified == modified) {
+            rom.hash = entry->second.hash;
+        } else {
+            rom.hash = InputMovie::hashROM(rom.data.data(), rom.data.size());
+            changed = true;
+        }
+
+        put<uint16_t>(index, static_cast<uint16_t>(rom.name.size()));
+        putString(index, rom.name);
+        put<uint64_t>(index, size);
+        put<int64_t>(index, modified);
+        put<uint64_t>(index, rom.hash);
+        count++;
+
+        roms.push_back(std::move(rom));
+        mappings.push_back(std::move(mapping));
+    }
+
+    // Rewrite the cache when a hash was computed or a file went away. A
+    // directory that can't be written to just gets hashed every time.
+    if (indexCaching && (changed || count != cached.size())) {
+        for (size_t i = 0; i < sizeof(uint32_t); i++) {
+            index[sizeof(INDEX_MAGIC) + sizeof(uint16_t) + i] = static_cast<uint8_t>(count >> (i * 8));
+        }
+        std::ofstream file(cachePath, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(index.data()), index.size());
+    }
+
+    fs::path metadataPath = fs::path(path) / METADATA_FILE;
+    return !fs::exists(metadataPath, error) || readMetadata(metadataPath.string());
+}
+
+bool RomCatalog::readMetadata(const std::string &path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (unsigned int number = 1; std::getline(file, line); number++) {
+        std::istringstream words(line);
+        std::string key;
+        if (!(words >> key) || key[0] == '#') continue;
+
+        // A name, or a hash that applies to the image under any name
+        std::vector<RomInfo *> targets;
+        uint64_t hash = 0;
+        for (RomInfo &rom: roms) {
+            if (rom.name == key) targets.push_back(&rom);
+        }
+        if (targets.empty() && parseHash(key, hash)) {
+            for (RomInfo &rom: roms) {
+                if (rom.hash == hash) targets.push_back(&rom);
+            }
+        }
+
+        std::string setting;
+        while (words >> setting) {
+            size_t equals = setting.find('=');
+            std::string name = setting.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : setting.substr(equals + 1);
+            QuirkProfile quirks{};
+            unsigned long ips = 0;
+            if (name == "quirks" && parseQuirkProfile(value, quirks)) {
+                for (RomInfo *rom: targets) rom->quirks = quirks;
+            } else if (name == "ips" && (ips = std::strtoul(value.c_str(), nullptr, 0)) > 0) {
+                for (RomInfo *rom: targets) rom->ips = static_cast<unsigned int>(ips);
+            } else if (name == "keys" && value.size() == 16) {
+                for (RomInfo *rom: targets) rom->keyMap = value;
+            } else {
+                std::cerr << "Error: " << path << ":" << number << ": invalid setting " << setting << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool RomCatalog::openArchive(const std::string &path) {
+    auto mapping = Mapping::map(path);
+    if (!mapping) {
+        std::cerr << "Error: Could not open ROM archive " << path << std::endl;
+        return false;
+    }
+    std::span<const uint8_t> data(mapping->data, mapping->size);
+
+    size_t position = sizeof(ARCHIVE_MAGIC);
+    uint16_t version = 0;
+    uint32_t count = 0;
+    if (data.size() < position || std::memcmp(data.data(), ARCHIVE_MAGIC, position) != 0 ||
+        !get(data, position, version) || !get(data, position, count)) {
+        std::cerr << "Error: " << path << " is not a ROM archive" << std::endl;
+        return false;
+    }
+    if (version != ARCHIVE_VERSION) {
+        std::cerr << "Error: Unsupported ROM archive version " << version << std::endl;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        RomInfo rom;
+        uint16_t nameLength = 0;
+        uint32_t offset = 0;
+        uint32_t size = 0;
+        uint8_t profile = 0;
+        uint32_t ips = 0;
+        uint8_t keyMapLength = 0;
+        bool ok = get(data, position, nameLength) && getString(data, position, nameLength, rom.name) &&
+                  get(data, position, offset) && get(data, position, size) && get(data, position, rom.hash) &&
+                  get(data, position, profile) && get(data, position, ips) && get(data, position, keyMapLength) &&
+                  getString(data, position, keyMapLength, rom.keyMap) &&
+                  offset <= data.size() && size <= data.size() - offset &&
+                  profile < static_cast<uint8_t>(QuirkProfile::Count);
+        if (!ok) {
+            roms.clear();
+            std::cerr << "Error: ROM archive " << path << " is damaged" << std::endl;
+            return false;
+        }
+        rom.data = data.subspan(offset, size);
+        rom.quirks = static_cast<QuirkProfile>(profile);
+        rom.ips = ips;
+        roms.push_back(std::move(rom));
+    }
+    mappings.push_back(std::move(mapping));
+    return true;
+}
+
+bool RomCatalog::pack(const std::string &path) const {
+    std::vector<uint8_t> out(std::begin(ARCHIVE_MAGIC), std::end(ARCHIVE_MAGIC));
+    put<uint16_t>(out, ARCHIVE_VERSION);
+    put<uint32_t>(out, static_cast<uint32_t>(roms.size()));
+
+    // The header size is known up front, so the images can go right after it
+    size_t offset = out.size();
+    for (const RomInfo &rom: roms) {
+        offset += 2 + rom.name.size() + 4 + 4 + 8 + 1 + 4 + 1 + rom.keyMap.size();
+    }
+    for (const RomInfo &rom: roms) {
+        put<uint16_t>(out, static_cast<uint16_t>(rom.name.size()));
+        putString(out, rom.name);
+        put<uint32_t>(out, static_cast<uint32_t>(offset));
+        put<uint32_t>(out, static_cast<uint32_t>(rom.data.size()));
+        put<uint64_t>(out, rom.hash);
+        put<uint8_t>(out, static_cast<uint8_t>(rom.quirks));
+        put<uint32_t>(out, rom.ips);
+        put<uint8_t>(out, static_cast<uint8_t>(rom.keyMap.size()));
+        putString(out, rom.keyMap);
+        offset += rom.data.size();
+    }
+    for (const RomInfo &rom: roms) {
+        out.insert(out.end(), rom.data.begin(), rom.data.end());
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file.write(reinterpret_cast<const char *>(out.data()), out.size())) {
+        std::cerr << "Error: Could not write ROM archive " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void RomCatalog::buildIndex() {
+    byHash.clear();
+    byName.clear();
+    for (size_t i = 0; i < roms.size(); i++) {
+        // The first of several copies of an image answers lookups by hash
+        byHash.emplace(roms[i].hash, i);
+        byName.emplace(roms[i].name, i);
+    }
+}
+
+const RomInfo *RomCatalog::find(uint64_t hash) const {
+    auto it = byHash.find(hash);
+    return it != byHash.end() ? &roms[it->second] : nullptr;
+}
+
+const RomInfo *RomCatalog::findName(const std::string &name) const {
+    auto it = byName.find(name);
+    return it != byName.end() ? &roms[it->second] : nullptr;
+}
+
+const RomInfo *RomCatalog::lookup(const std::string &key) const {
+    if (const RomInfo *rom = findName(key)) return rom;
+    uint64_t hash = 0;
+    return parseHash(key, hash) ? find(hash) : nullptr;
+}
+
+bool RomCatalog::load(const RomInfo &rom, Chip8 &chip8) {
+    chip8.setQuirks(rom.quirks, chip8.isChecked());
+    return chip8.loadROM(rom.data.data(), rom.data.size());
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Quirks.h"
+
+class Chip8;
+
+// A ROM image in a catalog and how to run it
+struct RomInfo {
+    std::string name;              // Path relative to the catalog directory, or name in the archive
+    uint64_t hash{};               // InputMovie::hashROM() of the image
+    std::span<const uint8_t> data; // Mapped image, valid as long as the catalog
+    // Metadata, from the catalog's metadata file
+    QuirkProfile quirks{QuirkProfile::Modern};
+    unsigned int ips{660};
+    std::string keyMap;            // Host keys for CHIP-8 keys 0-F, empty for the default layout
+};
+
+// A collection of ROMs, memory-mapped so that starting an instance is a hash
+// table lookup and a copy into its memory instead of file I/O per run.
+//
+// A catalog is either a directory, searched recursively for .ch8, .c8, .sc8
+// and .xo8 files, or an archive written by pack(). The hashes of a directory
+// are cached in INDEX_FILE inside it, or in the file given to setIndexPath(),
+// and only recomputed for files whose size or modification time changed.
+// Metadata comes from METADATA_FILE in the
+// directory, one ROM per line:
+//
+//     # name or 16 hex digit hash, then any of the settings
+//     games/Brix.ch8 quirks=vip ips=540
+//     3bd1f6a9d35e2b1c quirks=schip keys=x123qweasdzc4rfv
+//
+// Archives hold the images, hashes and metadata in one file: magic "C8PK",
+// u16 version, u32 ROM count, per ROM (u16 name length, name, u32 offset,
+// u32 size, u64 hash, u8 quirk profile, u32 ips, u8 key map length, key
+// map), then the images. All values are little-endian.
+class RomCatalog {
+public:
+    static constexpr const char *INDEX_FILE = ".chip8index";
+    static constexpr const char *METADATA_FILE = "catalog.txt";
+
+    RomCatalog();
+    ~RomCatalog();
+    RomCatalog(const RomCatalog &) = delete;
+    RomCatalog &operator=(const RomCatalog &) = delete;
+
+    // Cache the hashes of the directories open() reads in this file instead
+    // of INDEX_FILE inside them, e.g. for a read-only or version-controlled
+    // directory. Use one file per directory, or they keep replacing each other.
+    void setIndexPath(const std::string &path) { indexPath = path; }
+    // Without the cache, open() hashes every file and writes nothing
+    void setIndexCaching(bool enabled) { indexCaching = enabled; }
+
+    // Open a directory or an archive, replacing what was open before
+    bool open(const std::string &path);
+    // Write every ROM with its metadata into an archive
+    bool pack(const std::string &path) const;
+
+    const std::vector<RomInfo> &getRoms() const { return roms; }
+    // nullptr if there is no such ROM
+    const RomInfo *find(uint64_t hash) const;
+    const RomInfo *findName(const std::string &name) const;
+    // By name, or by hash if key is 16 hex digits
+    const RomInfo *lookup(const std::string &key) const;
+
+    // Select the ROM's quirk profile and copy it into memory
+    static bool load(const RomInfo &rom, Chip8 &chip8);
+
+private:
+    struct Mapping;
+
+    bool openDirectory(const std::string &path);
+    bool openArchive(const std::string &path);
+    bool readMetadata(const std::string &path);
+    void buildIndex();
+
+    std::vector<std::unique_ptr<Mapping>> mappings;
+    std::vector<RomInfo> roms;
+    std::unordered_map<uint64_t, size_t> byHash;
+    std::unordered_map<std::string, size_t> byName;
+    std::string indexPath; // Empty for INDEX_FILE in the directory
+    bool indexCaching{true};
+};
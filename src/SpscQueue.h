@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Fixed-size ring buffer for one producer thread and one consumer thread,
+// without locks. CAPACITY must be a power of two. Each side keeps a copy of
+// the other side's index and only reloads it when the queue looks full or
+// empty, so the shared indices are rarely touched.
+template <typename T, size_t CAPACITY>
+class SpscQueue {
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+public:
+    // Producer side, false if the queue is full
+    bool push(const T &value) {
+        size_t write = writeIndex.load(std::memory_order_relaxed);
+        if (write - cachedRead == CAPACITY) {
+            cachedRead = readIndex.load(std::memory_order_acquire);
+            if (write - cachedRead == CAPACITY) return false;
+        }
+        slots[write & (CAPACITY - 1)] = value;
+        writeIndex.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, false if the queue is empty
+    bool pop(T &value) {
+        size_t read = readIndex.load(std::memory_order_relaxed);
+        if (read == cachedWrite) {
+            cachedWrite = writeIndex.load(std::memory_order_acquire);
+            if (read == cachedWrite) return false;
+        }
+        value = slots[read & (CAPACITY - 1)];
+        readIndex.store(read + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, CAPACITY> slots{};
+    // Each side's index and its copy of the other one share a cache line
+    alignas(64) std::atomic<size_t> writeIndex{0};
+    size_t cachedRead{0};
+    alignas(64) std::atomic<size_t> readIndex{0};
+    size_t cachedWrite{0};
+};
@@ -0,0 +1,210 @@
+#include "Trace.h"
+
+#include <iostream>
+
+TraceWriter::TraceWriter(const Chip8 &chip8) : chip8(chip8) {
+}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const std::string &path) {
+    close();
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open trace file " << path << std::endl;
+        return false;
+    }
+
+    opcodes.assign(65536, 0);
+    std::memcpy(registers, chip8.getRegisters().data(), sizeof(registers));
+    index = chip8.getIndex();
+    expectedPC = NO_PC;
+    records = 0;
+    pending = false;
+    writeCount = 0;
+
+    uint8_t header[sizeof(MAGIC) + 2 + 16 + 2];
+    std::memcpy(header, MAGIC, sizeof(MAGIC));
+    header[4] = static_cast<uint8_t>(VERSION);
+    header[5] = static_cast<uint8_t>(VERSION >> 8);
+    std::memcpy(header + 6, chip8.getRegisters().data(), 16);
+    header[22] = static_cast<uint8_t>(index);
+    header[23] = static_cast<uint8_t>(index >> 8);
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+    chunks.assign(CHUNK_COUNT, std::vector<uint8_t>(CHUNK_SIZE));
+    fullChunks.clear();
+    freeChunks.clear();
+    for (size_t i = 1; i < CHUNK_COUNT; i++) freeChunks.push_back(i);
+    current = 0;
+    out = chunks[0].data();
+    chunkEnd = out + CHUNK_SIZE;
+    closing = false;
+    failed = !file;
+    writer = std::thread(&TraceWriter::writerLoop, this);
+    return true;
+}
+
+bool TraceWriter::close() {
+    if (!writer.joinable()) return true;
+
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fullChunks.emplace_back(current, out - chunks[current].data());
+        closing = true;
+    }
+    changed.notify_all();
+    writer.join();
+    file.close();
+    out = chunkEnd = nullptr;
+
+    if (failed) {
+        std::cerr << "Error: Could not write the trace file" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void TraceWriter::nextChunk() {
+    if (!writer.joinable()) {
+        chunks.resize(1);
+        chunks[0].resize(CHUNK_SIZE);
+        current = 0;
+        out = chunks[0].data();
+        chunkEnd = out + CHUNK_SIZE;
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    fullChunks.emplace_back(current, out - chunks[current].data());
+    changed.notify_all();
+    // Waits only if the disk is slower than the emulation
+    changed.wait(lock, [this] { return !freeChunks.empty(); });
+    current = freeChunks.back();
+    freeChunks.pop_back();
+    out = chunks[current].data();
+    chunkEnd = out + CHUNK_SIZE;
+}
+
+void TraceWriter::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this] { return !fullChunks.empty() || closing; });
+        if (fullChunks.empty()) return;
+
+        auto [chunk, size] = fullChunks.front();
+        fullChunks.erase(fullChunks.begin());
+        lock.unlock();
+        file.write(reinterpret_cast<const char *>(chunks[chunk].data()), static_cast<std::streamsize>(size));
+        bool ok = static_cast<bool>(file);
+        lock.lock();
+
+        failed |= !ok;
+        freeChunks.push_back(chunk);
+        changed.notify_all();
+    }
+}
+
+bool TraceReader::open(const std::string &path) {
+    file.open(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open trace file " << path << std::endl;
+        return false;
+    }
+
+    buffer.clear();
+    position = 0;
+    if (!fill(24) || std::memcmp(buffer.data(), TraceWriter::MAGIC, sizeof(TraceWriter::MAGIC)) != 0) {
+        std::cerr << "Error: " << path << " is not a trace file" << std::endl;
+        return false;
+    }
+    position = sizeof(TraceWriter::MAGIC);
+    if (get16() != TraceWriter::VERSION) {
+        std::cerr << "Error: Unsupported trace version in " << path << std::endl;
+        return false;
+    }
+    std::memcpy(registers.data(), buffer.data() + position, registers.size());
+    position += registers.size();
+    index = get16();
+
+    opcodes.assign(65536, 0);
+    expectedPC = TraceWriter::NO_PC;
+    cycle = 0;
+    return true;
+}
+
+bool TraceReader::fill(size_t count) {
+    if (available() >= count) return true;
+
+    // Move what is left to the front and read the next block behind it
+    constexpr size_t BLOCK_SIZE = 1 << 16;
+    buffer.erase(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(position));
+    position = 0;
+    size_t kept = buffer.size();
+    buffer.resize(kept + BLOCK_SIZE);
+    file.read(reinterpret_cast<char *>(buffer.data() + kept), BLOCK_SIZE);
+    buffer.resize(kept + static_cast<size_t>(file.gcount()));
+    return available() >= count;
+}
+
+bool TraceReader::next(TraceRecord &record) {
+    fill(TraceWriter::MAX_RECORD_SIZE);
+    if (available() == 0) return false;
+
+    // The decoder state only changes once the whole record is there
+    size_t start = position;
+    uint8_t flags = buffer[position++];
+    size_t needed = ((flags & TraceWriter::PC_FLAG) ? 2 : 0) + ((flags & TraceWriter::OPCODE_FLAG) ? 2 : 0) +
+                    ((flags & TraceWriter::REGS_FLAG) ? 2 : 0);
+    if (available() < needed) {
+        position = start;
+        return false;
+    }
+
+    record = TraceRecord{};
+    record.cycle = cycle;
+    record.pc = (flags & TraceWriter::PC_FLAG) ? get16() : static_cast<uint16_t>(expectedPC);
+    record.opcode = (flags & TraceWriter::OPCODE_FLAG) ? get16() : opcodes[record.pc];
+    record.registers = registers;
+    record.index = index;
+
+    if (flags & TraceWriter::REGS_FLAG) {
+        record.changedRegisters = get16();
+        if (available() < static_cast<size_t>(std::popcount(record.changedRegisters))) {
+            position = start;
+            return false;
+        }
+        for (unsigned int i = 0; i < 16; i++) {
+            if ((record.changedRegisters >> i) & 1) record.registers[i] = buffer[position++];
+        }
+    }
+    if (flags & TraceWriter::INDEX_FLAG) {
+        if (available() < 2) {
+            position = start;
+            return false;
+        }
+        record.changedIndex = true;
+        record.index = get16();
+    }
+    if (flags & TraceWriter::MEMORY_FLAG) {
+        if (available() < 1 || buffer[position] > TRACE_MAX_WRITES || available() < 1 + buffer[position] * 3u) {
+            position = start;
+            return false;
+        }
+        record.writeCount = buffer[position++];
+        for (unsigned int i = 0; i < record.writeCount; i++) {
+            record.writes[i].address = get16();
+            record.writes[i].value = buffer[position++];
+        }
+    }
+
+    opcodes[record.pc] = record.opcode;
+    registers = record.registers;
+    index = record.index;
+    expectedPC = static_cast<uint16_t>(record.pc + 2);
+    cycle++;
+    return true;
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Chip8.h"
+
+// Execution traces: every instruction a run executes, with the registers, I
+// and memory it changed, for finding where two runs part ways. A trace file
+// starts with magic "C8TR", u16 version, V0-VF and I (u16) at the start of
+// the trace, then one record per instruction: a flags byte, then the fields
+// the flags select, in this order (all values little-endian):
+//
+//     PC      u16 address, if it isn't the previous record's + 2
+//     OPCODE  u16 opcode, if it isn't the one last recorded at that address
+//     REGS    u16 mask of the registers the instruction changed, then their values
+//     INDEX   u16 I, if the instruction changed it
+//     MEMORY  u8 number of bytes written, then u16 address and u8 value each
+//
+// So a typical instruction takes one to four bytes. Only what instructions
+// do is recorded; changes from outside a run, like loadState(), show up in
+// the records that follow them.
+
+// Most bytes one instruction writes (FX55 and 5XY2 with all 16 registers)
+constexpr unsigned int TRACE_MAX_WRITES = 16;
+
+struct TraceWrite {
+    uint16_t address{};
+    uint8_t value{};
+
+    bool operator==(const TraceWrite &) const = default;
+};
+
+// One instruction of a trace, with the registers and I after it
+struct TraceRecord {
+    uint64_t cycle{}; // Number of the instruction in the trace, from 0
+    uint16_t pc{};
+    uint16_t opcode{};
+    std::array<uint8_t, 16> registers{};
+    uint16_t index{};
+    uint16_t changedRegisters{}; // Bit N: the instruction changed VN
+    bool changedIndex{};
+    uint8_t writeCount{};
+    std::array<TraceWrite, TRACE_MAX_WRITES> writes{};
+
+    bool operator==(const TraceRecord &) const = default;
+};
+
+// Records the instructions of Chip8::run(cycles, trace). It is a hook policy
+// like Profiler (see Profiler.h), so the run loop calls it inline. Records are
+// encoded into fixed chunks on the emulating thread, and the writer's own
+// thread writes full chunks to the file while the next one fills. Each traced
+// instance needs a TraceWriter of its own.
+class TraceWriter {
+public:
+    static constexpr bool ENABLED = true;
+    static constexpr bool BREAKS = false;
+
+    explicit TraceWriter(const Chip8 &chip8);
+    ~TraceWriter();
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+
+    // Start a trace from chip8's current registers
+    bool open(const std::string &path);
+    // Write out the rest of the trace and stop the writer thread. False if
+    // anything could not be written.
+    bool close();
+
+    uint64_t getRecords() const { return records; }
+
+    // Hooks called by Chip8::run(). An instruction's effects are known once
+    // the next one starts, or the run ends.
+    void instruction(uint16_t address, uint16_t opcode) {
+        finish();
+        pending = true;
+        pendingPC = address;
+        pendingOpcode = opcode;
+    }
+    void write(uint16_t address, uint8_t value) {
+        if (writeCount < TRACE_MAX_WRITES) writes[writeCount++] = {address, value};
+    }
+    void readDelay(uint16_t, uint8_t) {}
+    void waitKey() {}
+    void call(unsigned int) {}
+    void draw(bool) {}
+    void clear() {}
+    void endRun() { finish(); }
+
+private:
+    friend class TraceReader;
+
+    enum Flags : uint8_t {
+        PC_FLAG = 1,
+        OPCODE_FLAG = 2,
+        REGS_FLAG = 4,
+        INDEX_FLAG = 8,
+        MEMORY_FLAG = 16,
+    };
+
+    static constexpr char MAGIC[4] = {'C', '8', 'T', 'R'};
+    static constexpr uint16_t VERSION = 1;
+    static constexpr size_t CHUNK_SIZE = 256 * 1024;
+    static constexpr size_t CHUNK_COUNT = 4;
+    // Longest record: flags, PC, opcode, register mask and 16 values, I, and
+    // the count and 16 writes
+    static constexpr size_t MAX_RECORD_SIZE = 1 + 2 + 2 + 2 + 16 + 2 + 1 + TRACE_MAX_WRITES * 3;
+    // The PC before the first record, which no address matches
+    static constexpr uint32_t NO_PC = 0x10000;
+
+    // Encode the pending instruction. Works on copies of the members, since
+    // every byte stored through a uint8_t pointer could alias them.
+    void finish() {
+        if (!pending) return;
+        pending = false;
+        if (static_cast<size_t>(chunkEnd - out) < MAX_RECORD_SIZE) nextChunk();
+
+        uint8_t *p = out + 1;
+        uint8_t flags = 0;
+        uint16_t pc = pendingPC;
+        uint16_t opcode = pendingOpcode;
+        if (pc != expectedPC) {
+            flags |= PC_FLAG;
+            p = put16(p, pc);
+        }
+        if (opcodes[pc] != opcode) {
+            flags |= OPCODE_FLAG;
+            p = put16(p, opcode);
+            opcodes[pc] = opcode;
+        }
+
+        // Compare the registers eight at a time, and gather one bit per changed
+        // register
+        const std::array<uint8_t, 16> &current = chip8.getRegisters();
+        uint16_t currentIndex = chip8.getIndex();
+        uint64_t now[2];
+        std::memcpy(now, current.data(), sizeof(now));
+        uint64_t diff[2] = {now[0] ^ registers[0], now[1] ^ registers[1]};
+        if ((diff[0] | diff[1]) != 0) {
+            flags |= REGS_FLAG;
+            uint16_t bits = static_cast<uint16_t>(changedBytes(diff[0]) | (changedBytes(diff[1]) << 8));
+            p = put16(p, bits);
+            for (unsigned int rest = bits; rest != 0; rest &= rest - 1) {
+                *p++ = current[std::countr_zero(rest)];
+            }
+            registers[0] = now[0];
+            registers[1] = now[1];
+        }
+        if (currentIndex != index) {
+            flags |= INDEX_FLAG;
+            p = put16(p, currentIndex);
+            index = currentIndex;
+        }
+        if (writeCount > 0) {
+            flags |= MEMORY_FLAG;
+            *p++ = static_cast<uint8_t>(writeCount);
+            for (unsigned int i = 0; i < writeCount; i++) {
+                p = put16(p, writes[i].address);
+                *p++ = writes[i].value;
+            }
+            writeCount = 0;
+        }
+
+        *out = flags;
+        out = p;
+        expectedPC = static_cast<uint16_t>(pc + 2);
+        records++;
+    }
+
+    // Bit N set if byte N of diff is not zero
+    static unsigned int changedBytes(uint64_t diff) {
+        diff |= diff >> 4;
+        diff |= diff >> 2;
+        diff |= diff >> 1;
+        return static_cast<unsigned int>(((diff & 0x0101010101010101ull) * 0x0102040810204080ull) >> 56);
+    }
+
+    static uint8_t *put16(uint8_t *p, uint16_t value) {
+        p[0] = static_cast<uint8_t>(value);
+        p[1] = static_cast<uint8_t>(value >> 8);
+        return p + 2;
+    }
+
+    // Hand the current chunk to the writer thread and wait for an empty one.
+    // Without an open file the records go nowhere.
+    void nextChunk();
+    void writerLoop();
+
+    const Chip8 &chip8;
+
+    // Encoder state, the same as the reader's after the records so far
+    std::vector<uint16_t> opcodes; // Last opcode recorded at each address
+    uint64_t registers[2]{}; // V0-VF in host byte order
+    uint16_t index{};
+    uint32_t expectedPC{NO_PC};
+    uint64_t records{};
+
+    // The instruction whose effects are not recorded yet
+    bool pending{false};
+    uint16_t pendingPC{};
+    uint16_t pendingOpcode{};
+    unsigned int writeCount{};
+    std::array<TraceWrite, TRACE_MAX_WRITES> writes{};
+
+    // Chunks are either being filled (current), queued for the writer, or free
+    std::vector<std::vector<uint8_t>> chunks;
+    size_t current{};
+    uint8_t *out{};
+    uint8_t *chunkEnd{};
+
+    std::ofstream file;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<std::pair<size_t, size_t>> fullChunks; // Chunk and bytes used, in order
+    std::vector<size_t> freeChunks;
+    bool closing{false};
+    bool failed{false};
+};
+
+// Reads a trace back record by record
+class TraceReader {
+public:
+    bool open(const std::string &path);
+    // Next record, false at the end of the trace. A trace cut off in the
+    // middle of a record ends before it.
+    bool next(TraceRecord &record);
+
+private:
+    // Make at least count bytes available past position if the file has them
+    bool fill(size_t count);
+    size_t available() const { return buffer.size() - position; }
+    uint16_t get16() {
+        uint16_t value = static_cast<uint16_t>(buffer[position] | (buffer[position + 1] << 8));
+        position += 2;
+        return value;
+    }
+
+    std::ifstream file;
+    std::vector<uint8_t> buffer;
+    size_t position{};
+
+    std::vector<uint16_t> opcodes;
+    std::array<uint8_t, 16> registers{};
+    uint16_t index{};
+    uint32_t expectedPC{TraceWriter::NO_PC};
+    uint64_t cycle{};
+};
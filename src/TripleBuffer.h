@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest value from one writer thread to one reader thread without
+// locks. Each side owns one of three slots and the third sits in the middle.
+// Publishing swaps the writer's slot with the middle one, and the reader takes
+// the middle slot only when something new was published, so neither side ever
+// waits for the other. Values the reader was too slow to pick up are dropped.
+template <typename T>
+class TripleBuffer {
+public:
+    // Writer side: fill back(), then publish() it
+    T &back() { return slots[backSlot].value; }
+    void publish() {
+        backSlot = middle.exchange(backSlot | FRESH, std::memory_order_acq_rel) & SLOT_MASK;
+    }
+
+    // Reader side: move the newest published value to front(), false if
+    // nothing was published since the last call
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        frontSlot = middle.exchange(frontSlot, std::memory_order_acq_rel) & SLOT_MASK;
+        return true;
+    }
+    const T &front() const { return slots[frontSlot].value; }
+
+private:
+    // The middle index carries a flag for values the reader has not taken yet
+    static constexpr uint8_t SLOT_MASK = 0x03;
+    static constexpr uint8_t FRESH = 0x04;
+
+    // Slots on separate cache lines, so the two threads don't share one
+    struct alignas(64) Slot {
+        T value{};
+    };
+    std::array<Slot, 3> slots{};
+    uint8_t backSlot{0};
+    alignas(64) std::atomic<uint8_t> middle{1};
+    alignas(64) uint8_t frontSlot{2};
+};
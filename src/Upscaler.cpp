@@ -0,0 +1,345 @@
+#include "Upscaler.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+// SSE2 is part of x86-64, so its kernels need no check. The AVX2 kernels are
+// compiled with a target attribute and picked at runtime.
+#if defined(__SSE2__) || defined(_M_X64)
+#define CHIP8_SSE2_KERNELS 1
+#include <emmintrin.h>
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CHIP8_AVX2_KERNELS 1
+#define CHIP8_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr const char *FILTER_NAMES[] = {"none", "scanlines", "scale2x"};
+static_assert(std::size(FILTER_NAMES) == static_cast<size_t>(ScaleFilter::Count));
+
+struct NamedPalette {
+    const char *name;
+    Chip8::Palette palette;
+};
+
+// Off, on, plane 1 only and both planes, like the frontend's colors
+constexpr NamedPalette PALETTES[] = {
+    {"mono", {0xFF000000, 0xFFFFFFFF, 0xFF808080, 0xFFC0C0C0}},
+    {"amber", {0xFF1A0F00, 0xFFFFB000, 0xFF805800, 0xFFFFD080}},
+    {"green", {0xFF001400, 0xFF33FF66, 0xFF10802A, 0xFF99FFB2}},
+    {"lcd", {0xFF9BBC0F, 0xFF0F380F, 0xFF8BAC0F, 0xFF306230}},
+};
+
+// Colors of count pixels (a multiple of 8) from one bit per plane, MSB first
+[[maybe_unused]] void colorsGeneric(const uint64_t *plane0, const uint64_t *plane1, unsigned int count,
+                                    const uint32_t *palette, uint32_t *out) {
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int shift = 63 - i % 64;
+        out[i] = palette[((plane0[i / 64] >> shift) & 1) | (((plane1[i / 64] >> shift) & 1) << 1)];
+    }
+}
+
+// Repeat each of count colors factor times
+void repeatGeneric(const uint32_t *colors, unsigned int count, unsigned int factor, uint32_t *out) {
+    for (unsigned int i = 0; i < count; i++) {
+        std::fill_n(out + i * factor, factor, colors[i]);
+    }
+}
+
+#ifdef CHIP8_SSE2_KERNELS
+inline __m128i select(__m128i mask, __m128i value, __m128i old) {
+    return _mm_or_si128(_mm_and_si128(mask, value), _mm_andnot_si128(mask, old));
+}
+
+void colorsSse2(const uint64_t *plane0, const uint64_t *plane1, unsigned int count, const uint32_t *palette,
+                uint32_t *out) {
+    // Lane N tests the bit of pixel N, the most significant of the nibble first
+    const __m128i bits = _mm_set_epi32(1, 2, 4, 8);
+    const __m128i color0 = _mm_set1_epi32(static_cast<int>(palette[0]));
+    const __m128i color1 = _mm_set1_epi32(static_cast<int>(palette[1]));
+    const __m128i color2 = _mm_set1_epi32(static_cast<int>(palette[2]));
+    const __m128i color3 = _mm_set1_epi32(static_cast<int>(palette[3]));
+    for (unsigned int i = 0; i < count; i += 4) {
+        unsigned int shift = 60 - i % 64;
+        __m128i low = _mm_set1_epi32(static_cast<int>((plane0[i / 64] >> shift) & 0xF));
+        __m128i high = _mm_set1_epi32(static_cast<int>((plane1[i / 64] >> shift) & 0xF));
+        __m128i mask0 = _mm_cmpeq_epi32(_mm_and_si128(low, bits), bits);
+        __m128i mask1 = _mm_cmpeq_epi32(_mm_and_si128(high, bits), bits);
+        __m128i colors = select(mask1, select(mask0, color3, color2), select(mask0, color1, color0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), colors);
+    }
+}
+
+void repeatSse2(const uint32_t *colors, unsigned int count, unsigned int factor, uint32_t *out) {
+    if (factor == 2) {
+        for (unsigned int i = 0; i < count; i += 4) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(colors + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2), _mm_unpacklo_epi32(pixels, pixels));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2 + 4), _mm_unpackhi_epi32(pixels, pixels));
+        }
+        return;
+    }
+    // Whole vectors per pixel, each overlapping the next pixel's, which
+    // overwrites the excess. The last pixels would store past the line.
+    unsigned int vectors = (factor + 3) / 4;
+    size_t total = static_cast<size_t>(count) * factor;
+    unsigned int i = 0;
+    for (; i < count && static_cast<size_t>(i) * factor + vectors * 4 <= total; i++) {
+        __m128i pixel = _mm_set1_epi32(static_cast<int>(colors[i]));
+        for (unsigned int v = 0; v < vectors; v++) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * factor + v * 4), pixel);
+        }
+    }
+    repeatGeneric(colors + i, count - i, factor, out + static_cast<size_t>(i) * factor);
+}
+#endif
+
+#ifdef CHIP8_AVX2_KERNELS
+CHIP8_TARGET_AVX2 void colorsAvx2(const uint64_t *plane0, const uint64_t *plane1, unsigned int count,
+                                  const uint32_t *palette, uint32_t *out) {
+    const __m256i bits = _mm256_set_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i color0 = _mm256_set1_epi32(static_cast<int>(palette[0]));
+    const __m256i color1 = _mm256_set1_epi32(static_cast<int>(palette[1]));
+    const __m256i color2 = _mm256_set1_epi32(static_cast<int>(palette[2]));
+    const __m256i color3 = _mm256_set1_epi32(static_cast<int>(palette[3]));
+    for (unsigned int i = 0; i < count; i += 8) {
+        unsigned int shift = 56 - i % 64;
+        __m256i low = _mm256_set1_epi32(static_cast<int>((plane0[i / 64] >> shift) & 0xFF));
+        __m256i high = _mm256_set1_epi32(static_cast<int>((plane1[i / 64] >> shift) & 0xFF));
+        __m256i mask0 = _mm256_cmpeq_epi32(_mm256_and_si256(low, bits), bits);
+        __m256i mask1 = _mm256_cmpeq_epi32(_mm256_and_si256(high, bits), bits);
+        __m256i colors = _mm256_blendv_epi8(_mm256_blendv_epi8(color0, color1, mask0),
+                                            _mm256_blendv_epi8(color2, color3, mask0), mask1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), colors);
+    }
+}
+
+CHIP8_TARGET_AVX2 void repeatAvx2(const uint32_t *colors, unsigned int count, unsigned int factor, uint32_t *out) {
+    if (factor == 2) {
+        for (unsigned int i = 0; i < count; i += 8) {
+            __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(colors + i));
+            // The unpacks work within 128-bit halves, the permutes put the halves in order
+            __m256i low = _mm256_unpacklo_epi32(pixels, pixels);
+            __m256i high = _mm256_unpackhi_epi32(pixels, pixels);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i * 2), _mm256_permute2x128_si256(low, high, 0x20));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i * 2 + 8),
+                                _mm256_permute2x128_si256(low, high, 0x31));
+        }
+        return;
+    }
+    unsigned int vectors = (factor + 7) / 8;
+    size_t total = static_cast<size_t>(count) * factor;
+    unsigned int i = 0;
+    for (; i < count && static_cast<size_t>(i) * factor + vectors * 8 <= total; i++) {
+        __m256i pixel = _mm256_set1_epi32(static_cast<int>(colors[i]));
+        for (unsigned int v = 0; v < vectors; v++) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i * factor + v * 8), pixel);
+        }
+    }
+    repeatGeneric(colors + i, count - i, factor, out + static_cast<size_t>(i) * factor);
+}
+#endif
+
+struct Kernels {
+    void (*colors)(const uint64_t *, const uint64_t *, unsigned int, const uint32_t *, uint32_t *);
+    void (*repeat)(const uint32_t *, unsigned int, unsigned int, uint32_t *);
+};
+
+const Kernels &kernels() {
+    static const Kernels selected = [] {
+#ifdef CHIP8_AVX2_KERNELS
+        if (__builtin_cpu_supports("avx2")) return Kernels{colorsAvx2, repeatAvx2};
+#endif
+#ifdef CHIP8_SSE2_KERNELS
+        return Kernels{colorsSse2, repeatSse2};
+#else
+        return Kernels{colorsGeneric, repeatGeneric};
+#endif
+    }();
+    return selected;
+}
+
+// Every channel at 5/8 of its brightness, alpha unchanged
+uint32_t dim(uint32_t color) {
+    uint32_t result = color & 0xFF000000;
+    for (unsigned int shift = 0; shift < 24; shift += 8) {
+        result |= (((color >> shift) & 0xFF) * 5 / 8) << shift;
+    }
+    return result;
+}
+
+// Bit i of value moves to bit 2 * i
+uint64_t spread(uint64_t value) {
+    value &= 0xFFFFFFFF;
+    value = (value | (value << 16)) & 0x0000FFFF0000FFFFull;
+    value = (value | (value << 8)) & 0x00FF00FF00FF00FFull;
+    value = (value | (value << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    value = (value | (value << 2)) & 0x3333333333333333ull;
+    value = (value | (value << 1)) & 0x5555555555555555ull;
+    return value;
+}
+
+// Both pixels of two planes at once: set where the colors are equal
+inline uint64_t equal(uint64_t a0, uint64_t a1, uint64_t b0, uint64_t b1) {
+    return ~((a0 ^ b0) | (a1 ^ b1));
+}
+
+} // namespace
+
+const char *scaleFilterName(ScaleFilter filter) {
+    size_t index = static_cast<size_t>(filter);
+    return index < std::size(FILTER_NAMES) ? FILTER_NAMES[index] : "unknown";
+}
+
+bool parseScaleFilter(const std::string &name, ScaleFilter &filter) {
+    for (size_t i = 0; i < std::size(FILTER_NAMES); i++) {
+        if (name == FILTER_NAMES[i]) {
+            filter = static_cast<ScaleFilter>(i);
+            return true;
+        }
+    }
+    std::cerr << "Error: Unknown filter " << name << ", use none, scanlines or scale2x" << std::endl;
+    return false;
+}
+
+bool parsePalette(const std::string &text, Chip8::Palette &palette) {
+    for (const NamedPalette &named: PALETTES) {
+        if (text == named.name) {
+            palette = named.palette;
+            return true;
+        }
+    }
+
+    std::istringstream list(text);
+    std::string color;
+    Chip8::Palette parsed{};
+    size_t count = 0;
+    while (std::getline(list, color, ',')) {
+        char *end = nullptr;
+        unsigned long value = std::strtoul(color.c_str(), &end, 16);
+        if (count == parsed.size() || color.size() != 6 || *end != '\0') {
+            count = 0;
+            break;
+        }
+        parsed[count++] = 0xFF000000 | static_cast<uint32_t>(value);
+    }
+    if (count != parsed.size()) {
+        std::cerr << "Error: Unknown palette " << text
+                  << ", use mono, amber, green, lcd or four RRGGBB colors separated by commas" << std::endl;
+        return false;
+    }
+    palette = parsed;
+    return true;
+}
+
+Upscaler::Upscaler(const Chip8::Palette &palette, ScaleFilter filter) : filter(filter) {
+    setPalette(palette);
+}
+
+void Upscaler::setPalette(const Chip8::Palette &palette) {
+    for (size_t i = 0; i < palette.size(); i++) {
+        this->palette[i] = palette[i];
+        dimmed[i] = dim(palette[i]);
+    }
+}
+
+std::vector<uint32_t> Upscaler::getColors() const {
+    std::vector<uint32_t> colors(palette.begin(), palette.end());
+    if (filter == ScaleFilter::Scanlines) colors.insert(colors.end(), dimmed.begin(), dimmed.end());
+    return colors;
+}
+
+void Upscaler::expandLine(const Line &plane0, const Line &plane1, unsigned int width, unsigned int factor,
+                          const uint32_t *palette, uint32_t *out) const {
+    if (factor == 1) {
+        kernels().colors(plane0.data(), plane1.data(), width, palette, out);
+        return;
+    }
+    alignas(32) uint32_t colors[4 * 64];
+    kernels().colors(plane0.data(), plane1.data(), width, palette, colors);
+    kernels().repeat(colors, width, factor, out);
+}
+
+void Upscaler::scaleRows(const Planes &planes, unsigned int width, unsigned int height, unsigned int scale,
+                         unsigned int first, unsigned int last, uint32_t *pixels, size_t pitch) const {
+    bool smooth = filter == ScaleFilter::Scale2x && scale % 2 == 0;
+    unsigned int words = width / 64;
+    size_t lineBytes = static_cast<size_t>(width) * scale * sizeof(uint32_t);
+
+    for (unsigned int y = first; y <= last && y < height; y++) {
+        uint32_t *block = pixels + static_cast<size_t>(y - first) * scale * pitch;
+        Line row[2]{};
+        for (unsigned int plane = 0; plane < Chip8::PLANES; plane++) {
+            for (unsigned int w = 0; w < words; w++) row[plane][w] = planes[plane][y][w];
+        }
+
+        if (!smooth) {
+            expandLine(row[0], row[1], width, scale, palette.data(), block);
+            for (unsigned int line = 1; line < scale; line++) std::memcpy(block + line * pitch, block, lineBytes);
+            if (filter == ScaleFilter::Scanlines && scale > 1) {
+                expandLine(row[0], row[1], width, scale, dimmed.data(), block + (scale - 1) * pitch);
+            }
+            continue;
+        }
+
+        // Scale2x on whole words: every pixel P becomes four, each taking the
+        // color of two equal neighbours on its side when the other two differ.
+        // Pixels past the edges count as equal to the ones at the edge.
+        const Chip8::Plane &plane0 = planes[0];
+        const Chip8::Plane &plane1 = planes[1];
+        unsigned int above = y > 0 ? y - 1 : y;
+        unsigned int below = y + 1 < height ? y + 1 : y;
+        Line top[2]{};
+        Line bottom[2]{};
+        for (unsigned int w = 0; w < words; w++) {
+            uint64_t p[2] = {plane0[y][w], plane1[y][w]};
+            uint64_t a[2] = {plane0[above][w], plane1[above][w]};
+            uint64_t d[2] = {plane0[below][w], plane1[below][w]};
+            uint64_t b[2];
+            uint64_t c[2];
+            for (unsigned int i = 0; i < 2; i++) {
+                const Chip8::Plane &plane = i == 0 ? plane0 : plane1;
+                c[i] = (p[i] >> 1) | (w > 0 ? plane[y][w - 1] << 63 : p[i] & (1ull << 63));
+                b[i] = (p[i] << 1) | (w + 1 < words ? plane[y][w + 1] >> 63 : p[i] & 1);
+            }
+            uint64_t ab = equal(a[0], a[1], b[0], b[1]);
+            uint64_t ac = equal(a[0], a[1], c[0], c[1]);
+            uint64_t bd = equal(b[0], b[1], d[0], d[1]);
+            uint64_t cd = equal(c[0], c[1], d[0], d[1]);
+            uint64_t useA = ac & ~cd & ~ab;
+            uint64_t useB = ab & ~ac & ~bd;
+            uint64_t useC = cd & ~bd & ~ac;
+            uint64_t useD = bd & ~ab & ~cd;
+            for (unsigned int i = 0; i < 2; i++) {
+                uint64_t e1 = (a[i] & useA) | (p[i] & ~useA);
+                uint64_t e2 = (b[i] & useB) | (p[i] & ~useB);
+                uint64_t e3 = (c[i] & useC) | (p[i] & ~useC);
+                uint64_t e4 = (d[i] & useD) | (p[i] & ~useD);
+                top[i][w * 2] = (spread(e1 >> 32) << 1) | spread(e2 >> 32);
+                top[i][w * 2 + 1] = (spread(e1) << 1) | spread(e2);
+                bottom[i][w * 2] = (spread(e3 >> 32) << 1) | spread(e4 >> 32);
+                bottom[i][w * 2 + 1] = (spread(e3) << 1) | spread(e4);
+            }
+        }
+
+        unsigned int factor = scale / 2;
+        uint32_t *lower = block + factor * pitch;
+        expandLine(top[0], top[1], width * 2, factor, palette.data(), block);
+        expandLine(bottom[0], bottom[1], width * 2, factor, palette.data(), lower);
+        for (unsigned int line = 1; line < factor; line++) {
+            std::memcpy(block + line * pitch, block, lineBytes);
+            std::memcpy(lower + line * pitch, lower, lineBytes);
+        }
+    }
+}
+
+void Upscaler::scale(const Chip8 &chip8, unsigned int scale, uint32_t *pixels, size_t pitch) const {
+    scaleRows(chip8.display, chip8.getWidth(), chip8.getHeight(), scale, 0, chip8.getHeight() - 1, pixels, pitch);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Chip8.h"
+
+// Filters applied while scaling
+enum class ScaleFilter : uint8_t {
+    None,      // Every pixel becomes a scale x scale block
+    Scanlines, // Same, with the last line of each block darkened
+    Scale2x,   // EPX/Scale2x edge smoothing, then blocks of scale / 2. Odd scales get no smoothing.
+    Count
+};
+
+// Names as used on the command line: none, scanlines, scale2x
+const char *scaleFilterName(ScaleFilter filter);
+bool parseScaleFilter(const std::string &name, ScaleFilter &filter);
+
+// A palette by name (mono, amber, green, lcd) or as four RRGGBB colors for
+// the pixel values 0-3, e.g. "000000,ffffff,808080,c0c0c0"
+bool parsePalette(const std::string &text, Chip8::Palette &palette);
+
+// Scales the display to a whole multiple of its size in ARGB pixels on the
+// CPU, for software renderers and for headless jobs that want full-size
+// frames. Pixel colors are expanded 8 at a time with AVX2 (4 with SSE2, or a
+// plain loop elsewhere, picked at runtime) and repeated with vector stores.
+// The output can go straight into a locked streaming texture or any buffer.
+class Upscaler {
+public:
+    using Planes = std::array<Chip8::Plane, Chip8::PLANES>;
+
+    static constexpr unsigned int MAX_SCALE = 32;
+
+    explicit Upscaler(const Chip8::Palette &palette, ScaleFilter filter = ScaleFilter::None);
+
+    void setPalette(const Chip8::Palette &palette);
+    void setFilter(ScaleFilter filter) { this->filter = filter; }
+    ScaleFilter getFilter() const { return filter; }
+    // Every color the output can have: the palette, and the darker scanline
+    // colors with that filter. For indexed images.
+    std::vector<uint32_t> getColors() const;
+
+    // Scale rows first to last of a width x height display (64x32 or 128x64),
+    // as in Chip8::display or a copy of it, to scale (1 to MAX_SCALE) times
+    // its size. pixels is where the output of row first starts, and pitch
+    // the distance between output lines in pixels.
+    void scaleRows(const Planes &planes, unsigned int width, unsigned int height, unsigned int scale,
+                   unsigned int first, unsigned int last, uint32_t *pixels, size_t pitch) const;
+    // The whole current display, getWidth() * scale by getHeight() * scale pixels
+    void scale(const Chip8 &chip8, unsigned int scale, uint32_t *pixels, size_t pitch) const;
+    // How many rows above and below a changed row change in the output as well
+    unsigned int reach() const { return filter == ScaleFilter::Scale2x ? 1 : 0; }
+
+private:
+    // One line of up to 256 pixels per plane, MSB first like Chip8::Row
+    using Line = std::array<uint64_t, 4>;
+
+    // Expand a line of width pixels, repeating every pixel factor times
+    void expandLine(const Line &plane0, const Line &plane1, unsigned int width, unsigned int factor,
+                    const uint32_t *palette, uint32_t *out) const;
+
+    std::array<uint32_t, 4> palette{};
+    std::array<uint32_t, 4> dimmed{}; // For the scanlines
+    ScaleFilter filter;
+};
@@ -0,0 +1,177 @@
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BatchRunner.h"
+#include "RomCatalog.h"
+
+// Batch runner: runs many instances of one ROM in parallel, each with its own
+// seed and a random input script derived from it, and reports per-instance
+// results plus the aggregate instructions per second. With --catalog the ROM is
+// looked up in a ROM catalog, which also supplies its quirk profile and speed.
+
+namespace {
+
+struct Options {
+    std::string romPath;     // File, or name or hash in the catalog
+    std::string catalogPath;
+    std::string indexPath;   // Hash cache of a catalog directory, instead of the one inside it
+    bool noCache = false;    // Hash every ROM of a catalog directory and don't write a cache
+    uint64_t instances = 1000;
+    uint64_t frames = 600;
+    uint64_t cyclesPerFrame = 0; // 0 = 11, or the catalog's ips / 60
+    unsigned int threads = 0; // 0 = all hardware threads
+    unsigned int seed = 1;    // Seed of the first instance, the others count up
+    bool printResults = false;
+    std::string videoDir;     // Record every run's frames to SEED.c8fr in this directory
+};
+
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " <ROM_FILE | ROM_NAME --catalog PATH> [options]\n"
+              << "  --instances N  Number of independent runs (default 1000)\n"
+              << "  --frames N     Frames per run (default 600)\n"
+              << "  --ipf N        Instructions per frame (default 11)\n"
+              << "  --threads N    Worker threads (default: all cores)\n"
+              << "  --seed N       Seed of the first run (default 1)\n"
+              << "  --results      Print one line per run\n"
+              << "  --catalog PATH Look the ROM up by name or hash in a ROM directory or archive\n"
+              << "  --cache FILE   Cache the catalog directory's hashes in FILE instead of inside it\n"
+              << "  --no-cache     Hash the catalog directory's ROMs without writing a cache\n"
+              << "  --video-dir DIR Record the changed frames of every run to DIR/SEED.c8fr\n";
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--instances" && hasValue) {
+            options.instances = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--frames" && hasValue) {
+            options.frames = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--ipf" && hasValue) {
+            options.cyclesPerFrame = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (arg == "--seed" && hasValue) {
+            options.seed = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (arg == "--results") {
+            options.printResults = true;
+        } else if (arg == "--video-dir" && hasValue) {
+            options.videoDir = argv[++i];
+        } else if (arg == "--catalog" && hasValue) {
+            options.catalogPath = argv[++i];
+        } else if (arg == "--cache" && hasValue) {
+            options.indexPath = argv[++i];
+        } else if (arg == "--no-cache") {
+            options.noCache = true;
+        } else if (arg[0] != '-' && options.romPath.empty()) {
+            options.romPath = arg;
+        } else {
+            std::cerr << "Error: Unknown or incomplete option " << arg << std::endl;
+            return false;
+        }
+    }
+    return !options.romPath.empty();
+}
+
+// Press a random key (or none) for a random number of frames, over and over
+std::vector<KeyEvent> randomInput(unsigned int seed, uint64_t frames) {
+    std::mt19937 rng(seed);
+    std::vector<KeyEvent> input;
+    for (uint64_t frame = 0; frame < frames; frame += 1 + rng() % 30) {
+        unsigned int key = rng() % 17;
+        input.push_back({frame, static_cast<uint16_t>(key < 16 ? 1u << key : 0u)});
+    }
+    return input;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> rom;
+    QuirkProfile quirks = QuirkProfile::Modern;
+    RomCatalog catalog;
+    if (!options.catalogPath.empty()) {
+        catalog.setIndexPath(options.indexPath);
+        catalog.setIndexCaching(!options.noCache);
+        if (!catalog.open(options.catalogPath)) return 1;
+        const RomInfo *info = catalog.lookup(options.romPath);
+        if (!info) {
+            std::cerr << "Error: No ROM " << options.romPath << " in " << options.catalogPath << std::endl;
+            return 1;
+        }
+        rom.assign(info->data.begin(), info->data.end());
+        quirks = info->quirks;
+        if (options.cyclesPerFrame == 0) options.cyclesPerFrame = (info->ips + 30) / 60;
+    } else {
+        std::ifstream file(options.romPath, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Error: Could not open ROM file " << options.romPath << std::endl;
+            return 1;
+        }
+        rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    if (options.cyclesPerFrame == 0) options.cyclesPerFrame = 11;
+    if (!options.videoDir.empty()) {
+        std::error_code error;
+        std::filesystem::create_directories(options.videoDir, error);
+        if (error) {
+            std::cerr << "Error: Could not create " << options.videoDir << ": " << error.message() << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<BatchJob> jobs(options.instances);
+    for (uint64_t i = 0; i < options.instances; i++) {
+        jobs[i].rom = rom;
+        jobs[i].quirks = quirks;
+        jobs[i].seed = options.seed + static_cast<unsigned int>(i);
+        jobs[i].frames = options.frames;
+        jobs[i].cyclesPerFrame = options.cyclesPerFrame;
+        jobs[i].input = randomInput(jobs[i].seed, options.frames);
+        if (!options.videoDir.empty()) {
+            std::filesystem::path path = std::filesystem::path(options.videoDir) / (std::to_string(jobs[i].seed) + ".c8fr");
+            jobs[i].videoPath = path.string();
+        }
+    }
+
+    BatchRunner runner(options.threads);
+    std::vector<BatchResult> results = runner.run(jobs);
+
+    uint64_t failed = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        const BatchResult &result = results[i];
+        if (!result.error.empty()) failed++;
+        if (!options.printResults) continue;
+
+        std::cout << i << " seed=" << jobs[i].seed << std::hex
+                  << " display=" << result.displayHash
+                  << " pc=0x" << result.pc
+                  << " i=0x" << result.index << " v=";
+        for (uint8_t value: result.registers) {
+            std::cout << (value < 0x10 ? "0" : "") << static_cast<int>(value);
+        }
+        std::cout << std::dec << " cycles=" << result.cycles;
+        if (!result.error.empty()) std::cout << " error=" << result.error;
+        std::cout << '\n';
+    }
+
+    std::cout << "instances: " << results.size() << "\n"
+              << "failed: " << failed << "\n"
+              << "threads: " << runner.getThreadCount() << "\n"
+              << "instructions/second: " << runner.getInstructionsPerSecond() << std::endl;
+    return failed == 0 ? 0 : 2;
+}
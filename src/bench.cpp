@@ -0,0 +1,437 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Chip8.h"
+#include "Chip8Jit.h"
+#include "Upscaler.h"
+
+// Benchmark suite: runs every ROM in the ROM directories headless with
+// scripted input, then times each opcode on its own in a synthetic program
+// and times the display conversion and CPU upscaling used by the frontend. The best of several
+// repeats is reported, as a table or as JSON to diff runs across commits.
+
+namespace {
+
+struct Options {
+    std::vector<std::string> romDirs;
+    uint64_t cycles = 20000000;    // Instructions per ROM run
+    uint64_t opCycles = 5000000;   // Instructions per opcode measurement
+    uint64_t cyclesPerFrame = 11;
+    unsigned int repeats = 3;
+    bool useJit = false;
+    bool json = false;
+    bool skipIdle = true;          // ROM runs skip idle loops like the frontend, opcode runs never do
+};
+
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --rom-dir DIR   Benchmark the .ch8 files in DIR (default: roms and roms/test-roms)\n"
+              << "  --cycles N      Instructions per ROM (default 20000000)\n"
+              << "  --op-cycles N   Instructions per opcode measurement (default 5000000)\n"
+              << "  --ipf N         Instructions per frame (default 11)\n"
+              << "  --repeat N      Runs per measurement, the fastest counts (default 3)\n"
+              << "  --jit           Use the x86-64 dynamic recompiler\n"
+              << "  --no-idle-skip  Run the ROMs' idle loops instead of skipping them\n"
+              << "  --json          Print the results as JSON\n";
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--rom-dir" && hasValue) {
+            options.romDirs.push_back(argv[++i]);
+        } else if (arg == "--cycles" && hasValue) {
+            options.cycles = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--op-cycles" && hasValue) {
+            options.opCycles = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--ipf" && hasValue) {
+            options.cyclesPerFrame = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--repeat" && hasValue) {
+            options.repeats = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (arg == "--jit") {
+            options.useJit = true;
+        } else if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--no-idle-skip") {
+            options.skipIdle = false;
+        } else {
+            std::cerr << "Error: Unknown or incomplete option " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.romDirs.empty()) {
+        options.romDirs = {"roms", "roms/test-roms"};
+    }
+    return options.cycles > 0 && options.opCycles > 0 && options.cyclesPerFrame > 0 && options.repeats > 0;
+}
+
+// Runs the given number of instructions in frames of cyclesPerFrame, the way
+// the frontend does, and returns the host seconds it took
+double timeRun(Chip8 &chip8, uint64_t cycles, const Options &options,
+               const std::function<void(uint64_t frame)> &beforeFrame) {
+    std::optional<Chip8Jit> jit;
+    if (options.useJit) jit.emplace(chip8);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t frame = 0, done = 0; done < cycles; frame++) {
+        beforeFrame(frame);
+        uint64_t frameCycles = std::min(options.cyclesPerFrame, cycles - done);
+        if (options.useJit) {
+            jit->run(frameCycles);
+        } else {
+            chip8.run(frameCycles);
+        }
+        chip8.tickTimers();
+        done += frameCycles;
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Repeat a measurement and keep the fastest
+template <typename Measure>
+double best(unsigned int repeats, Measure measure) {
+    double fastest = measure();
+    for (unsigned int i = 1; i < repeats; i++) {
+        fastest = std::min(fastest, measure());
+    }
+    return fastest;
+}
+
+struct RomResult {
+    std::string name;
+    double instructionsPerSecond{};
+    uint64_t idleCycles{}; // Skipped instead of run, see Chip8::getIdleCycles()
+    std::string error;
+};
+
+std::vector<RomResult> benchmarkRoms(const Options &options, Chip8 &lastMachine) {
+    std::vector<std::filesystem::path> paths;
+    for (const std::string &dir: options.romDirs) {
+        std::error_code error;
+        for (const auto &entry: std::filesystem::directory_iterator(dir, error)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".ch8") {
+                paths.push_back(entry.path());
+            }
+        }
+        if (error) {
+            std::cerr << "Warning: Could not read ROM directory " << dir << std::endl;
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<RomResult> results;
+    for (const auto &path: paths) {
+        RomResult result;
+        result.name = path.generic_string();
+        try {
+            double seconds = best(options.repeats, [&]() {
+                Chip8 chip8(1);
+                if (!chip8.loadROM(path.string())) {
+                    throw std::runtime_error("could not load ROM");
+                }
+                chip8.setIdleSkipping(options.skipIdle);
+                // Hold a different key every 10 frames, with a pause in between
+                double elapsed = timeRun(chip8, options.cycles, options, [&chip8](uint64_t frame) {
+                    uint64_t step = frame / 10;
+                    chip8.setKeys(step % 2 == 0 ? static_cast<uint16_t>(1u << (step / 2 % 16)) : 0);
+                });
+                lastMachine = chip8;
+                result.idleCycles = chip8.getIdleCycles();
+                return elapsed;
+            });
+            result.instructionsPerSecond = options.cycles / seconds;
+        } catch (const std::exception &e) {
+            result.error = e.what();
+        }
+        results.push_back(result);
+    }
+    return results;
+}
+
+// A synthetic program that runs one opcode over and over: the prologue, then
+// LOOP_LENGTH copies of the opcode and a jump back to the first copy
+struct OpcodeBench {
+    std::string name;                                 // e.g. "8XY4"
+    std::vector<uint16_t> prologue;
+    std::function<uint16_t(uint16_t address)> opcode; // Opcode to place at address
+    uint16_t keys{};
+    unsigned int pixels{};                            // Pixels drawn per instruction
+};
+
+constexpr unsigned int LOOP_LENGTH = 1000;
+
+std::vector<OpcodeBench> opcodeBenches() {
+    auto same = [](uint16_t opcode) { return [opcode](uint16_t) { return opcode; }; };
+    // V0 = 0, V1 = 1 for the register forms, so no skip is ever taken
+    std::vector<uint16_t> regs = {0x6000, 0x6101};
+    std::vector<uint16_t> data = {0xAE00, 0x6000, 0x6101}; // I points past the program
+    std::vector<uint16_t> font = {0xA050, 0x6000, 0x6101};
+
+    return {
+        {"00E0", {}, same(0x00E0)},
+        {"1NNN", {}, [](uint16_t address) { return static_cast<uint16_t>(0x1000 | (address + 2)); }},
+        {"2NNN+00EE", {}, same(0x2E00)}, // The subroutine at 0xE00 is a lone return
+        {"3XNN", regs, same(0x3001)},
+        {"4XNN", regs, same(0x4000)},
+        {"5XY0", regs, same(0x5010)},
+        {"6XNN", regs, same(0x6042)},
+        {"7XNN", regs, same(0x7003)},
+        {"8XY0", regs, same(0x8010)},
+        {"8XY1", regs, same(0x8011)},
+        {"8XY2", regs, same(0x8012)},
+        {"8XY3", regs, same(0x8013)},
+        {"8XY4", regs, same(0x8014)},
+        {"8XY5", regs, same(0x8015)},
+        {"8XY6", regs, same(0x8016)},
+        {"8XY7", regs, same(0x8017)},
+        {"8XYE", regs, same(0x801E)},
+        {"9XY0", regs, same(0x9000)},
+        {"ANNN", regs, same(0xA050)},
+        {"BNNN", regs, [](uint16_t address) { return static_cast<uint16_t>(0xB000 | (address + 2)); }},
+        {"CXNN", regs, same(0xC0FF)},
+        {"DXY1", font, same(0xD011), 0, 8},
+        {"DXY5", font, same(0xD015), 0, 40},
+        {"DXYF", font, same(0xD01F), 0, 120},
+        {"EX9E", regs, same(0xE09E)},
+        {"EXA1", regs, same(0xE0A1), 1},
+        {"FX07", regs, same(0xF007)},
+        {"FX0A", regs, same(0xF00A)}, // No key is pressed, so this measures the wait
+        {"FX15", regs, same(0xF015)},
+        {"FX18", regs, same(0xF018)},
+        {"FX1E", regs, same(0xF01E)},
+        {"FX29", regs, same(0xF029)},
+        {"FX33", data, same(0xF033)},
+        {"FX55", data, same(0xFF55)},
+        {"FX65", data, same(0xFF65)},
+    };
+}
+
+std::vector<uint8_t> buildProgram(const OpcodeBench &bench) {
+    std::vector<uint16_t> words = bench.prologue;
+    uint16_t loopStart = static_cast<uint16_t>(0x200 + 2 * words.size());
+    for (unsigned int i = 0; i < LOOP_LENGTH; i++) {
+        words.push_back(bench.opcode(static_cast<uint16_t>(0x200 + 2 * words.size())));
+    }
+    // Chained jumps also end up here, after the last copy
+    words.push_back(static_cast<uint16_t>(0x1000 | loopStart));
+
+    std::vector<uint8_t> rom(0xE02 - 0x200, 0);
+    for (size_t i = 0; i < words.size(); i++) {
+        rom[2 * i] = static_cast<uint8_t>(words[i] >> 8);
+        rom[2 * i + 1] = static_cast<uint8_t>(words[i]);
+    }
+    // Subroutine for the call benchmark
+    rom[0xE00 - 0x200] = 0x00;
+    rom[0xE01 - 0x200] = 0xEE;
+    return rom;
+}
+
+struct OpcodeResult {
+    std::string name;
+    double nanoseconds{};
+    unsigned int pixels{};
+    uint64_t idleCycles{}; // Nonzero means the time isn't the opcode's
+};
+
+std::vector<OpcodeResult> benchmarkOpcodes(const Options &options) {
+    std::vector<OpcodeResult> results;
+    for (const OpcodeBench &bench: opcodeBenches()) {
+        std::vector<uint8_t> rom = buildProgram(bench);
+        uint64_t idleCycles = 0;
+        double seconds = best(options.repeats, [&]() {
+            Chip8 chip8(1);
+            chip8.loadROM(rom.data(), rom.size());
+            chip8.setKeys(bench.keys);
+            // Most loops here leave the registers as they were and would be
+            // skipped as idle once a frame is longer than the loop
+            chip8.setIdleSkipping(false);
+            double elapsed = timeRun(chip8, options.opCycles, options, [](uint64_t) {});
+            idleCycles = std::max(idleCycles, chip8.getIdleCycles());
+            return elapsed;
+        });
+        if (idleCycles != 0) {
+            std::cerr << "Warning: " << idleCycles << " instructions of the " << bench.name
+                      << " benchmark were skipped as idle, its time is not the opcode's" << std::endl;
+        }
+        results.push_back({bench.name, seconds * 1e9 / options.opCycles, bench.pixels, idleCycles});
+    }
+    return results;
+}
+
+// Cost of turning the display into ARGB pixels for the frontend's texture
+double benchmarkConversion(const Options &options, const Chip8 &chip8) {
+    constexpr unsigned int CONVERSIONS = 100000;
+    std::vector<uint32_t> pixels(Chip8::HIRES_WIDTH * Chip8::HIRES_HEIGHT);
+    volatile uint32_t sink = 0;
+    double seconds = best(options.repeats, [&]() {
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < CONVERSIONS; i++) {
+            chip8.toARGB(pixels.data(), chip8.getWidth(), 0xFFFFFFFF, 0xFF000000);
+            // Read a pixel so the conversions can't be dropped as dead stores
+            sink = pixels[i % pixels.size()];
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    });
+    return seconds * 1e9 / CONVERSIONS;
+}
+
+struct UpscaleResult {
+    std::string filter;
+    double nanoseconds{}; // Per 640x320 frame
+};
+
+// The --scale 5 window of the frontend, whatever the resolution
+std::vector<UpscaleResult> benchmarkUpscaling(const Options &options, const Chip8 &chip8) {
+    constexpr unsigned int FRAMES = 5000;
+    constexpr unsigned int WIDTH = 640;
+    unsigned int scale = WIDTH / chip8.getWidth();
+    std::vector<uint32_t> pixels(WIDTH * 320);
+    volatile uint32_t sink = 0;
+    std::vector<UpscaleResult> results;
+    for (size_t filter = 0; filter < static_cast<size_t>(ScaleFilter::Count); filter++) {
+        Upscaler upscaler({0xFF000000, 0xFFFFFFFF, 0xFF808080, 0xFFC0C0C0}, static_cast<ScaleFilter>(filter));
+        double seconds = best(options.repeats, [&]() {
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned int i = 0; i < FRAMES; i++) {
+                upscaler.scale(chip8, scale, pixels.data(), WIDTH);
+                sink = pixels[i % pixels.size()];
+            }
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        });
+        results.push_back({scaleFilterName(static_cast<ScaleFilter>(filter)), seconds * 1e9 / FRAMES});
+    }
+    return results;
+}
+
+// Mean cost of the opcodes sharing a top nibble
+std::map<char, double> nibbleAverages(const std::vector<OpcodeResult> &opcodes) {
+    std::map<char, std::pair<double, int>> sums;
+    for (const OpcodeResult &result: opcodes) {
+        sums[result.name[0]].first += result.nanoseconds;
+        sums[result.name[0]].second++;
+    }
+    std::map<char, double> averages;
+    for (const auto &[nibble, sum]: sums) {
+        averages[nibble] = sum.first / sum.second;
+    }
+    return averages;
+}
+
+void printJson(const Options &options, const std::vector<RomResult> &roms, const std::vector<OpcodeResult> &opcodes,
+               double conversion, const std::vector<UpscaleResult> &upscaling) {
+    std::cout << "{\n"
+              << "  \"jit\": " << (options.useJit ? "true" : "false") << ",\n"
+              << "  \"cycles\": " << options.cycles << ",\n"
+              << "  \"op_cycles\": " << options.opCycles << ",\n"
+              << "  \"ipf\": " << options.cyclesPerFrame << ",\n"
+              << "  \"roms\": [\n";
+    for (size_t i = 0; i < roms.size(); i++) {
+        std::cout << "    {\"name\": \"" << roms[i].name << "\", \"mips\": " << roms[i].instructionsPerSecond / 1e6;
+        if (roms[i].idleCycles != 0) std::cout << ", \"idle_cycles\": " << roms[i].idleCycles;
+        if (!roms[i].error.empty()) std::cout << ", \"error\": \"" << roms[i].error << "\"";
+        std::cout << "}" << (i + 1 < roms.size() ? "," : "") << "\n";
+    }
+    std::cout << "  ],\n"
+              << "  \"opcodes\": [\n";
+    for (size_t i = 0; i < opcodes.size(); i++) {
+        std::cout << "    {\"opcode\": \"" << opcodes[i].name << "\", \"ns\": " << opcodes[i].nanoseconds;
+        if (opcodes[i].pixels > 0) {
+            std::cout << ", \"pixels_per_second\": " << opcodes[i].pixels / opcodes[i].nanoseconds * 1e9;
+        }
+        if (opcodes[i].idleCycles != 0) std::cout << ", \"idle_cycles\": " << opcodes[i].idleCycles;
+        std::cout << "}" << (i + 1 < opcodes.size() ? "," : "") << "\n";
+    }
+    std::cout << "  ],\n"
+              << "  \"nibbles\": {";
+    auto nibbles = nibbleAverages(opcodes);
+    for (auto it = nibbles.begin(); it != nibbles.end(); ++it) {
+        std::cout << (it == nibbles.begin() ? "" : ", ") << "\"" << it->first << "\": " << it->second;
+    }
+    std::cout << "},\n"
+              << "  \"frame_conversion_ns\": " << conversion << ",\n"
+              << "  \"upscale_640x320_ns\": {";
+    for (size_t i = 0; i < upscaling.size(); i++) {
+        std::cout << (i == 0 ? "" : ", ") << "\"" << upscaling[i].filter << "\": " << upscaling[i].nanoseconds;
+    }
+    std::cout << "}\n"
+              << "}" << std::endl;
+}
+
+void printTable(const std::vector<RomResult> &roms, const std::vector<OpcodeResult> &opcodes, double conversion,
+                const std::vector<UpscaleResult> &upscaling) {
+    std::cout << "ROM                                  MIPS\n";
+    for (const RomResult &rom: roms) {
+        std::cout << rom.name << std::string(rom.name.size() < 36 ? 36 - rom.name.size() : 1, ' ');
+        if (rom.error.empty()) {
+            std::cout << rom.instructionsPerSecond / 1e6;
+            if (rom.idleCycles != 0) std::cout << "  (" << rom.idleCycles << " idle instructions skipped)";
+            std::cout << "\n";
+        } else {
+            std::cout << "error: " << rom.error << "\n";
+        }
+    }
+
+    std::cout << "\nopcode      ns/instruction\n";
+    for (const OpcodeResult &opcode: opcodes) {
+        std::cout << opcode.name << std::string(opcode.name.size() < 12 ? 12 - opcode.name.size() : 1, ' ')
+                  << opcode.nanoseconds;
+        if (opcode.pixels > 0) {
+            std::cout << "  (" << opcode.pixels / opcode.nanoseconds * 1e3 << " Mpixels/s)";
+        }
+        if (opcode.idleCycles != 0) std::cout << "  (" << opcode.idleCycles << " idle instructions skipped)";
+        std::cout << "\n";
+    }
+
+    std::cout << "\nnibble      ns/instruction\n";
+    for (const auto &[nibble, nanoseconds]: nibbleAverages(opcodes)) {
+        std::cout << nibble << "XXX        " << nanoseconds << "\n";
+    }
+    std::cout << "\nframe conversion: " << conversion << " ns\n";
+
+    std::cout << "\nupscale to 640x320  ns/frame\n";
+    for (const UpscaleResult &result: upscaling) {
+        std::cout << result.filter << std::string(20 - result.filter.size(), ' ') << result.nanoseconds << "\n";
+    }
+    std::cout << std::flush;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (options.useJit && !Chip8Jit::isSupported()) {
+        std::cerr << "Error: The recompiler is not available on this platform" << std::endl;
+        return 1;
+    }
+
+    // The frame conversion and upscaling are timed on the last screen of the last ROM
+    // rather than on a blank one
+    Chip8 lastMachine(1);
+    std::vector<RomResult> roms = benchmarkRoms(options, lastMachine);
+    std::vector<OpcodeResult> opcodes = benchmarkOpcodes(options);
+    double conversion = benchmarkConversion(options, lastMachine);
+    std::vector<UpscaleResult> upscaling = benchmarkUpscaling(options, lastMachine);
+
+    if (options.json) {
+        printJson(options, roms, opcodes, conversion, upscaling);
+    } else {
+        printTable(roms, opcodes, conversion, upscaling);
+    }
+    return 0;
+}
@@ -0,0 +1,357 @@
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Chip8.h"
+#include "Debugger.h"
+#include "Disassembler.h"
+
+// Debugger: runs a ROM headless under commands read from stdin, one per line,
+// stopping at breakpoints, watchpoints and steps. Frames run exactly as in
+// chip8_headless, and stopping in the middle of one doesn't change the run:
+// the next command finishes the frame before the timers tick.
+
+namespace {
+
+struct Options {
+    std::string romPath;
+    uint64_t cyclesPerFrame = 11;
+    unsigned int seed = std::random_device{}();
+    QuirkProfile quirks = QuirkProfile::Modern;
+    bool checked = true;
+    std::vector<std::string> breakpoints; // From --break, as typed
+};
+
+// Frames continue runs without a count (one minute of emulated time)
+constexpr uint64_t DEFAULT_FRAMES = 3600;
+
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " <ROM_FILE> [options] < COMMANDS\n"
+              << "  --ipf N         Instructions per frame (default 11)\n"
+              << "  --seed N        Seed for the random number generator (default: random)\n"
+              << "  --quirks NAME   Quirk profile: modern (default), vip, chip48, schip or xochip\n"
+              << "  --unchecked     Wrap out of range memory, stack and keypad accesses instead of stopping\n"
+              << "  --break ADDR    Set a breakpoint before the first command (repeatable)\n"
+              << "Type help for the commands.\n";
+}
+
+void printCommands() {
+    std::cout << "  break ADDR [COND]   Stop before ADDR, if given when COND holds (e.g. V3==0x10, I>=0x300)\n"
+              << "  delete ADDR         Remove the breakpoint at ADDR\n"
+              << "  watch ADDR          Stop after an instruction writes to ADDR\n"
+              << "  unwatch ADDR        Remove the watchpoint at ADDR\n"
+              << "  info                List the breakpoints and watchpoints\n"
+              << "  continue [FRAMES]   Run until a stop, at most FRAMES frames (default 3600)\n"
+              << "  step [N]            Execute N instructions (default 1)\n"
+              << "  next                Step over a subroutine call\n"
+              << "  finish              Run until the current subroutine returns\n"
+              << "  regs                Show the registers, stack and timers\n"
+              << "  list [ADDR] [N]     Disassemble N instructions from ADDR (default: around the PC)\n"
+              << "  x ADDR [N]          Show N bytes of memory from ADDR (default 16)\n"
+              << "  keys MASK           Hold the keypad keys of the hex bit mask, bit N is key N\n"
+              << "  screen              Print the display\n"
+              << "  quit                Exit\n";
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--ipf" && hasValue) {
+            options.cyclesPerFrame = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--seed" && hasValue) {
+            options.seed = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (arg == "--quirks" && hasValue) {
+            if (!parseQuirkProfile(argv[++i], options.quirks)) return false;
+        } else if (arg == "--unchecked") {
+            options.checked = false;
+        } else if (arg == "--break" && hasValue) {
+            options.breakpoints.push_back(argv[++i]);
+        } else if (arg[0] != '-' && options.romPath.empty()) {
+            options.romPath = arg;
+        } else {
+            std::cerr << "Error: Unknown or incomplete option " << arg << std::endl;
+            return false;
+        }
+    }
+    return !options.romPath.empty() && options.cyclesPerFrame > 0;
+}
+
+bool parseNumber(const std::string &text, uint64_t limit, uint64_t &value) {
+    char *end = nullptr;
+    value = std::strtoull(text.c_str(), &end, 0);
+    if (text.empty() || *end != '\0' || value > limit) {
+        std::cerr << "Error: Invalid number " << text << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool parseAddress(const std::string &text, uint16_t &address) {
+    uint64_t value = 0;
+    if (!parseNumber(text, 0xFFFF, value)) return false;
+    address = static_cast<uint16_t>(value);
+    return true;
+}
+
+// Opcodes are printed in upper case, like the disassembly and chip8_tracediff
+std::string hex(unsigned int value, int digits, bool upper = false) {
+    std::ostringstream text;
+    text << std::hex << (upper ? std::uppercase : std::nouppercase) << std::setw(digits) << std::setfill('0') << value;
+    return text.str();
+}
+
+class Session {
+public:
+    explicit Session(const Options &options)
+        : chip8(options.seed), debugger(chip8), cyclesPerFrame(options.cyclesPerFrame) {
+        chip8.setQuirks(options.quirks, options.checked);
+    }
+
+    bool load(const std::vector<uint8_t> &rom) { return chip8.loadROM(rom.data(), rom.size()); }
+    bool addBreakpoint(const std::string &address, const std::string &condition);
+    // Execute one command, false once it says to quit
+    bool execute(const std::string &line);
+
+private:
+    // Run frames until the debugger stops or frames frames are done, and show
+    // where it stopped
+    void runFrames(uint64_t frames);
+    void printStop() const;
+    // count instructions from address, marking breakpoints and the PC
+    void printListing(uint16_t address, unsigned int count) const;
+    void printRegisters() const;
+    void printMemory(uint16_t address, unsigned int count) const;
+    void printScreen() const;
+    uint16_t opcodeAt(uint16_t address) const {
+        return static_cast<uint16_t>((chip8.readMemory(address) << 8) | chip8.readMemory(address + 1));
+    }
+
+    Chip8 chip8;
+    Debugger debugger;
+    uint64_t cyclesPerFrame;
+    uint64_t frame = 0;       // Frames completed
+    uint64_t frameCycles = 0; // Instructions run in the current frame
+};
+
+bool Session::addBreakpoint(const std::string &address, const std::string &condition) {
+    uint16_t value = 0;
+    BreakCondition parsed;
+    if (!parseAddress(address, value)) return false;
+    if (!condition.empty() && !parseBreakCondition(condition, parsed)) {
+        std::cerr << "Error: Invalid condition " << condition << ", use e.g. V3==0x10 or I>=0x300" << std::endl;
+        return false;
+    }
+    debugger.addBreakpoint(value, parsed);
+    return true;
+}
+
+bool Session::execute(const std::string &line) {
+    std::istringstream words(line);
+    std::string command;
+    if (!(words >> command) || command[0] == '#') return true;
+    std::vector<std::string> args{std::istream_iterator<std::string>(words), std::istream_iterator<std::string>()};
+    std::string first = args.empty() ? "" : args[0];
+    std::string second = args.size() > 1 ? args[1] : "";
+    uint16_t address = 0;
+    uint64_t count = 0;
+
+    if (command == "q" || command == "quit") {
+        return false;
+    } else if (command == "h" || command == "help") {
+        printCommands();
+    } else if ((command == "b" || command == "break") && !first.empty()) {
+        addBreakpoint(first, second);
+    } else if (command == "d" || command == "delete") {
+        if (parseAddress(first, address) && !debugger.removeBreakpoint(address)) {
+            std::cerr << "Error: No breakpoint at 0x" << hex(address, 3) << std::endl;
+        }
+    } else if (command == "w" || command == "watch") {
+        if (parseAddress(first, address)) debugger.addWatchpoint(address);
+    } else if (command == "unwatch") {
+        if (parseAddress(first, address) && !debugger.removeWatchpoint(address)) {
+            std::cerr << "Error: No watchpoint at 0x" << hex(address, 3) << std::endl;
+        }
+    } else if (command == "i" || command == "info") {
+        for (const Debugger::Breakpoint &breakpoint: debugger.getBreakpoints()) {
+            std::string condition = formatBreakCondition(breakpoint.condition);
+            std::cout << "break 0x" << hex(breakpoint.address, 3) << (condition.empty() ? "" : " ") << condition
+                      << '\n';
+        }
+        for (uint16_t watchpoint: debugger.getWatchpoints()) std::cout << "watch 0x" << hex(watchpoint, 3) << '\n';
+    } else if (command == "c" || command == "continue") {
+        count = DEFAULT_FRAMES;
+        if (first.empty() || parseNumber(first, UINT64_MAX, count)) {
+            debugger.resume();
+            runFrames(count);
+        }
+    } else if (command == "s" || command == "step") {
+        count = 1;
+        if (first.empty() || parseNumber(first, UINT64_MAX, count)) {
+            for (uint64_t i = 0; i < count; i++) {
+                debugger.step();
+                runFrames(DEFAULT_FRAMES);
+                if (debugger.getStop() != Debugger::Stop::Step) break;
+            }
+        }
+    } else if (command == "n" || command == "next") {
+        debugger.stepOver();
+        runFrames(DEFAULT_FRAMES);
+    } else if (command == "f" || command == "finish") {
+        if (debugger.stepOut()) {
+            runFrames(DEFAULT_FRAMES);
+        } else {
+            std::cerr << "Error: Not in a subroutine" << std::endl;
+        }
+    } else if (command == "r" || command == "regs") {
+        printRegisters();
+    } else if (command == "l" || command == "list") {
+        address = static_cast<uint16_t>(chip8.getPC() - 4);
+        count = 8;
+        if ((first.empty() || parseAddress(first, address)) && (second.empty() || parseNumber(second, 4096, count))) {
+            printListing(address, static_cast<unsigned int>(count));
+        }
+    } else if (command == "x") {
+        count = 16;
+        if (parseAddress(first, address) && (second.empty() || parseNumber(second, 65536, count))) {
+            printMemory(address, static_cast<unsigned int>(count));
+        }
+    } else if (command == "keys") {
+        if (parseNumber(first, 0xFFFF, count)) chip8.setKeys(static_cast<uint16_t>(count));
+    } else if (command == "screen") {
+        printScreen();
+    } else {
+        std::cerr << "Error: Unknown or incomplete command " << line << ", type help for the commands" << std::endl;
+    }
+    return true;
+}
+
+void Session::runFrames(uint64_t frames) {
+    try {
+        for (uint64_t done = 0; done < frames; done++) {
+            chip8.run(cyclesPerFrame - frameCycles, debugger);
+            if (debugger.getStop() != Debugger::Stop::None) {
+                frameCycles += debugger.getRunCycles();
+                printStop();
+                return;
+            }
+            frameCycles = 0;
+            chip8.tickTimers();
+            frame++;
+        }
+        std::cout << "no stop in " << frames << " frames\n";
+        printListing(chip8.getPC(), 1);
+    } catch (const std::exception &e) {
+        // The instruction that failed is only partly done
+        std::cerr << "Error: " << e.what() << " in frame " << frame << ", the machine state is not reliable"
+                  << std::endl;
+    }
+}
+
+void Session::printStop() const {
+    switch (debugger.getStop()) {
+        case Debugger::Stop::Breakpoint:
+            std::cout << "breakpoint";
+            break;
+        case Debugger::Stop::Watchpoint:
+            std::cout << "watchpoint: 0x" << hex(debugger.getWriterPC(), 3) << " wrote 0x"
+                      << hex(debugger.getWatchValue(), 2) << " to 0x" << hex(debugger.getWatchAddress(), 3);
+            break;
+        default:
+            std::cout << "step";
+            break;
+    }
+    std::cout << ", frame " << frame << " instruction " << frameCycles << '\n';
+    printListing(chip8.getPC(), 1);
+}
+
+void Session::printListing(uint16_t address, unsigned int count) const {
+    auto isBreakpoint = [this](uint16_t at) {
+        for (const Debugger::Breakpoint &breakpoint: debugger.getBreakpoints()) {
+            if (breakpoint.address == at) return true;
+        }
+        return false;
+    };
+    for (unsigned int i = 0; i < count; i++, address += 2) {
+        uint16_t opcode = opcodeAt(address);
+        std::cout << (address == chip8.getPC() ? '>' : ' ') << (isBreakpoint(address) ? '*' : ' ') << " 0x"
+                  << hex(address, 3) << "  " << hex(opcode, 4, true) << "  "
+                  << disassemble(opcode) << '\n';
+    }
+}
+
+void Session::printRegisters() const {
+    const std::array<uint8_t, 16> &registers = chip8.getRegisters();
+    for (unsigned int i = 0; i < registers.size(); i++) {
+        std::cout << 'V' << "0123456789ABCDEF"[i] << '=' << hex(registers[i], 2)
+                  << (i % 8 == 7 ? '\n' : ' ');
+    }
+    std::cout << "I=0x" << hex(chip8.getIndex(), 3) << " PC=0x" << hex(chip8.getPC(), 3)
+              << " DT=" << static_cast<int>(chip8.delayTimer) << " ST=" << static_cast<int>(chip8.soundTimer)
+              << " keys=" << hex(chip8.getKeys(), 4) << "\nstack:";
+    for (unsigned int i = 0; i < chip8.getStackPointer() && i < chip8.getStack().size(); i++) {
+        std::cout << " 0x" << hex(chip8.getStack()[i], 3);
+    }
+    std::cout << '\n';
+}
+
+void Session::printMemory(uint16_t address, unsigned int count) const {
+    for (unsigned int i = 0; i < count; i++) {
+        uint16_t at = static_cast<uint16_t>(address + i);
+        if (i % 16 == 0) std::cout << (i > 0 ? "\n" : "") << "0x" << hex(at, 3) << ':';
+        std::cout << ' ' << hex(chip8.readMemory(at), 2);
+    }
+    std::cout << '\n';
+}
+
+void Session::printScreen() const {
+    // XO-CHIP pixels only set in plane 1 show as 'o', set in both as '@'
+    const char symbols[] = ".#o@";
+    for (unsigned int y = 0; y < chip8.getHeight(); y++) {
+        for (unsigned int x = 0; x < chip8.getWidth(); x++) {
+            std::cout << symbols[chip8.getColor(x, y)];
+        }
+        std::cout << '\n';
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::ifstream file(options.romPath, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open ROM file " << options.romPath << std::endl;
+        return 1;
+    }
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    Session session(options);
+    if (!session.load(rom)) return 1;
+    for (const std::string &breakpoint: options.breakpoints) {
+        if (!session.addBreakpoint(breakpoint, "")) return 1;
+    }
+
+    std::cout << "seed " << options.seed << ", type help for the commands" << std::endl;
+    std::string line;
+    while (true) {
+        std::cout << "(chip8) " << std::flush;
+        if (!std::getline(std::cin, line) || !session.execute(line)) break;
+    }
+    std::cout << std::endl;
+    return 0;
+}
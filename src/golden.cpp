@@ -0,0 +1,297 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BatchRunner.h"
+#include "Chip8Jit.h"
+#include "Quirks.h"
+
+// Golden-frame regression runner: runs every test of a golden file headless
+// and in parallel, hashing the display and registers every frame, and
+// compares the hashes at each checkpoint with the stored ones. --update
+// stores the current hashes instead. --jit runs the tests through the
+// recompiler, which has to give the same hashes as the interpreter.
+//
+// A golden file has one line per test, followed by its checkpoints:
+//
+//     # ROM path relative to the golden file, then any of the settings
+//     test 5-quirks.ch8 quirks=schip frames=600 ipf=11 every=60 seed=1 input=20:0004,24:0000
+//     at 60 0123456789abcdef
+//     at 120 ...
+//
+// input lists FRAME:KEYS pairs, with the keypad bit mask in hex taking
+// effect at that frame. Each checkpoint hash covers every frame before it.
+
+namespace {
+
+struct Options {
+    std::string goldenPath = "roms/test-roms/golden.txt";
+    unsigned int threads = 0; // 0 = all hardware threads
+    bool update = false;
+    bool useJit = false;
+};
+
+struct GoldenTest {
+    std::string rom;
+    QuirkProfile quirks = QuirkProfile::Modern;
+    uint64_t frames = 600;
+    uint64_t cyclesPerFrame = 11;
+    uint64_t interval = 60;
+    unsigned int seed = 1;
+    std::vector<KeyEvent> input;
+    std::vector<uint64_t> expected; // Checkpoint hashes, from the file
+    size_t line{};                  // Line of the test in the file
+};
+
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --file FILE    Golden file (default roms/test-roms/golden.txt)\n"
+              << "  --update       Store the current hashes instead of comparing\n"
+              << "  --jit          Run through the x86-64 recompiler (modern quirks tests; the rest use the interpreter)\n"
+              << "  --threads N    Worker threads (default: all cores)\n";
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--file" && hasValue) {
+            options.goldenPath = argv[++i];
+        } else if (arg == "--update") {
+            options.update = true;
+        } else if (arg == "--jit") {
+            options.useJit = true;
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+        } else {
+            std::cerr << "Error: Unknown or incomplete option " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.update && options.useJit) {
+        std::cerr << "Error: --update stores the interpreter's hashes, it can't be combined with --jit" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool parseInput(const std::string &text, std::vector<KeyEvent> &input) {
+    std::istringstream list(text);
+    std::string event;
+    while (std::getline(list, event, ',')) {
+        size_t colon = event.find(':');
+        if (colon == std::string::npos) return false;
+        char *end = nullptr;
+        uint64_t frame = std::strtoull(event.c_str(), &end, 10);
+        if (end != event.c_str() + colon) return false;
+        uint64_t keys = std::strtoull(event.c_str() + colon + 1, &end, 16);
+        if (*end != '\0' || keys > 0xFFFF || (!input.empty() && frame < input.back().frame)) return false;
+        input.push_back({frame, static_cast<uint16_t>(keys)});
+    }
+    return true;
+}
+
+bool parseSetting(const std::string &setting, GoldenTest &test) {
+    size_t equals = setting.find('=');
+    if (equals == std::string::npos) return false;
+    std::string key = setting.substr(0, equals);
+    std::string value = setting.substr(equals + 1);
+    char *end = nullptr;
+    if (key == "quirks") return parseQuirkProfile(value, test.quirks);
+    if (key == "input") return parseInput(value, test.input);
+
+    uint64_t number = std::strtoull(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0') return false;
+    if (key == "frames") test.frames = number;
+    else if (key == "ipf") test.cyclesPerFrame = number;
+    else if (key == "every") test.interval = number;
+    else if (key == "seed") test.seed = static_cast<unsigned int>(number);
+    else return false;
+    return true;
+}
+
+// Read the tests and the file's lines, which --update writes back without the checkpoints
+bool readGolden(const std::string &path, std::vector<GoldenTest> &tests, std::vector<std::string> &lines) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open golden file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        lines.push_back(line);
+        std::istringstream fields(line);
+        std::string keyword;
+        if (!(fields >> keyword) || keyword[0] == '#') continue;
+
+        if (keyword == "test") {
+            GoldenTest test;
+            test.line = lines.size() - 1;
+            std::string setting;
+            if (!(fields >> test.rom)) {
+                std::cerr << "Error: " << path << ":" << lines.size() << ": test without a ROM" << std::endl;
+                return false;
+            }
+            while (fields >> setting) {
+                if (!parseSetting(setting, test)) {
+                    std::cerr << "Error: " << path << ":" << lines.size() << ": invalid setting " << setting
+                              << std::endl;
+                    return false;
+                }
+            }
+            if (test.frames == 0 || test.cyclesPerFrame == 0 || test.interval == 0) {
+                std::cerr << "Error: " << path << ":" << lines.size() << ": frames, ipf and every must not be 0"
+                          << std::endl;
+                return false;
+            }
+            tests.push_back(std::move(test));
+        } else if (keyword == "at" && !tests.empty()) {
+            uint64_t frame = 0;
+            std::string hash;
+            GoldenTest &test = tests.back();
+            if (!(fields >> frame >> hash) || frame != (test.expected.size() + 1) * test.interval) {
+                std::cerr << "Error: " << path << ":" << lines.size() << ": checkpoint out of order" << std::endl;
+                return false;
+            }
+            test.expected.push_back(std::strtoull(hash.c_str(), nullptr, 16));
+        } else {
+            std::cerr << "Error: " << path << ":" << lines.size() << ": unknown line" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string hex(uint64_t value) {
+    std::ostringstream text;
+    text << std::hex << std::setw(16) << std::setfill('0') << value;
+    return text.str();
+}
+
+bool writeGolden(const std::string &path, const std::vector<std::string> &lines, const std::vector<GoldenTest> &tests,
+                 const std::vector<BatchResult> &results) {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not write golden file " << path << std::endl;
+        return false;
+    }
+
+    size_t next = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+        std::istringstream fields(lines[i]);
+        std::string keyword;
+        if (fields >> keyword && keyword == "at") continue;
+        file << lines[i] << '\n';
+        if (next < tests.size() && tests[next].line == i) {
+            const GoldenTest &test = tests[next];
+            for (size_t checkpoint = 0; checkpoint < results[next].checkpoints.size(); checkpoint++) {
+                file << "at " << (checkpoint + 1) * test.interval << ' ' << hex(results[next].checkpoints[checkpoint])
+                     << '\n';
+            }
+            next++;
+        }
+    }
+    return static_cast<bool>(file);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (options.useJit && !Chip8Jit::isSupported()) {
+        std::cerr << "Error: The recompiler is not available on this platform" << std::endl;
+        return 1;
+    }
+
+    std::vector<GoldenTest> tests;
+    std::vector<std::string> lines;
+    if (!readGolden(options.goldenPath, tests, lines)) return 1;
+
+    // Every test gets its own copy of its ROM, which the jobs point into
+    std::filesystem::path romDir = std::filesystem::path(options.goldenPath).parent_path();
+    std::vector<std::vector<uint8_t>> roms(tests.size());
+    std::vector<BatchJob> jobs(tests.size());
+    for (size_t i = 0; i < tests.size(); i++) {
+        std::ifstream file(romDir / tests[i].rom, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Error: Could not open ROM file " << (romDir / tests[i].rom).string() << std::endl;
+            return 1;
+        }
+        roms[i].assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        jobs[i].rom = roms[i];
+        jobs[i].quirks = tests[i].quirks;
+        jobs[i].seed = tests[i].seed;
+        jobs[i].frames = tests[i].frames;
+        jobs[i].cyclesPerFrame = tests[i].cyclesPerFrame;
+        jobs[i].input = tests[i].input;
+        jobs[i].checkpointInterval = tests[i].interval;
+        jobs[i].useJit = options.useJit;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    BatchRunner runner(options.threads);
+    std::vector<BatchResult> results = runner.run(jobs);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (options.update) {
+        if (!writeGolden(options.goldenPath, lines, tests, results)) return 1;
+        std::cout << "updated " << tests.size() << " tests in " << options.goldenPath << std::endl;
+        return 0;
+    }
+
+    unsigned int failed = 0;
+    for (size_t i = 0; i < tests.size(); i++) {
+        const GoldenTest &test = tests[i];
+        const BatchResult &result = results[i];
+        std::string label = test.rom + " (" + quirkProfileName(test.quirks) + ")";
+
+        if (!result.error.empty()) {
+            std::cout << "FAIL " << label << ": " << result.error << '\n';
+            failed++;
+            continue;
+        }
+        if (test.expected.empty()) {
+            std::cout << "FAIL " << label << ": no golden hashes, run with --update\n";
+            failed++;
+            continue;
+        }
+        size_t checkpoint = 0;
+        while (checkpoint < test.expected.size() && checkpoint < result.checkpoints.size() &&
+               test.expected[checkpoint] == result.checkpoints[checkpoint]) {
+            checkpoint++;
+        }
+        if (checkpoint == test.expected.size() && checkpoint == result.checkpoints.size()) {
+            std::cout << "ok   " << label << '\n';
+            continue;
+        }
+        failed++;
+        std::cout << "FAIL " << label << ": ";
+        if (checkpoint < test.expected.size() && checkpoint < result.checkpoints.size()) {
+            std::cout << "differs between frames " << checkpoint * test.interval + 1 << " and "
+                      << (checkpoint + 1) * test.interval << " (expected " << hex(test.expected[checkpoint])
+                      << ", got " << hex(result.checkpoints[checkpoint]) << ")\n";
+        } else {
+            std::cout << result.checkpoints.size() << " checkpoints, the golden file has " << test.expected.size()
+                      << '\n';
+        }
+    }
+
+    std::cout << tests.size() << " tests, " << failed << " failed in " << seconds << " s" << std::endl;
+    return failed == 0 ? 0 : 2;
+}
@@ -0,0 +1,385 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "AudioEngine.h"
+#include "Chip8.h"
+#include "Chip8Jit.h"
+#include "FrameRecorder.h"
+#include "InputMovie.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "Upscaler.h"
+
+// Headless runner: executes a ROM at full host speed without SDL. Emulated
+// time is derived from the cycle count, so the 60Hz timers tick every
+// (ips / 60) instructions no matter how fast the host is.
+
+namespace {
+
+struct Options {
+    std::string romPath;
+    uint64_t maxCycles = 0;  // 0 = unlimited
+    uint64_t maxFrames = 0;  // 0 = unlimited
+    uint64_t ips = 660;      // Emulated instructions per second
+    int untilPC = -1;        // Stop once the PC reaches this address
+    bool untilIdle = false;  // Stop once the PC stops advancing (jump-to-self or FX0A with no input)
+    bool dumpDisplay = false;
+    bool useJit = false;     // Run through the x86-64 recompiler instead of the interpreter
+    unsigned int seed = std::random_device{}();
+    std::string recordPath;  // Write the run to this movie file
+    std::string replayPath;  // Replay this movie file and check every frame against it
+    bool profile = false;    // Count instructions and events and print a profile at the end
+    std::string wavPath;     // Render the buzzer to this WAV file
+    std::string tracePath;   // Record every instruction to this trace file
+    QuirkProfile quirks = QuirkProfile::Modern;
+    bool checked = true;     // Bounds check memory, stack and keypad accesses
+    std::string videoPath;   // Record every changed frame to this file
+    std::string imagePath;   // Write the final display to this PPM image
+    unsigned int scale = 5;  // Image size: hi-res pixels become scale x scale blocks, lo-res ones twice that
+    Chip8::Palette palette{0xFF000000, 0xFFFFFFFF, 0xFF808080, 0xFFC0C0C0};
+    ScaleFilter filter = ScaleFilter::None;
+};
+
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " <ROM_FILE> [options]\n"
+              << "  --cycles N      Stop after N instructions\n"
+              << "  --frames N      Stop after N frames (1/60 s of emulated time)\n"
+              << "  --ips N         Emulated instructions per second (default 660)\n"
+              << "  --until-pc ADDR Stop when the PC reaches ADDR (e.g. 0x2A4)\n"
+              << "  --until-idle    Stop when the PC stops advancing (how most test ROMs halt)\n"
+              << "  --dump          Print the final display as text\n"
+              << "  --jit           Use the x86-64 dynamic recompiler\n"
+              << "  --seed N        Seed for the random number generator (default: random)\n"
+              << "  --record FILE   Record the run as an input movie\n"
+              << "  --replay FILE   Replay an input movie, stopping at the first frame that differs\n"
+              << "  --profile       Print an opcode profile and the hottest loops at the end\n"
+              << "  --wav FILE      Render the buzzer to a WAV file (44.1kHz mono)\n"
+              << "  --trace FILE    Record every instruction and its effects to a trace file\n"
+              << "  --quirks NAME   Quirk profile: modern (default), vip, chip48, schip or xochip\n"
+              << "  --unchecked     Wrap out of range memory, stack and keypad accesses instead of stopping\n"
+              << "  --video FILE    Record every frame where the display changed (see chip8_recorder_export)\n"
+              << "  --image FILE    Write the final display to a PPM image\n"
+              << "  --scale N       Image scale, hi-res pixels become N x N (default 5, 640x320 images)\n"
+              << "  --palette P     Image colors: mono (default), amber, green, lcd or RRGGBB,RRGGBB,RRGGBB,RRGGBB\n"
+              << "  --filter NAME   Image filter: none (default), scanlines or scale2x\n";
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--cycles" && hasValue) {
+            options.maxCycles = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--frames" && hasValue) {
+            options.maxFrames = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--ips" && hasValue) {
+            options.ips = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--until-pc" && hasValue) {
+            options.untilPC = static_cast<int>(std::strtol(argv[++i], nullptr, 0));
+        } else if (arg == "--until-idle") {
+            options.untilIdle = true;
+        } else if (arg == "--dump") {
+            options.dumpDisplay = true;
+        } else if (arg == "--jit") {
+            options.useJit = true;
+        } else if (arg == "--seed" && hasValue) {
+            options.seed = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (arg == "--record" && hasValue) {
+            options.recordPath = argv[++i];
+        } else if (arg == "--replay" && hasValue) {
+            options.replayPath = argv[++i];
+        } else if (arg == "--profile") {
+            options.profile = true;
+        } else if (arg == "--wav" && hasValue) {
+            options.wavPath = argv[++i];
+        } else if (arg == "--trace" && hasValue) {
+            options.tracePath = argv[++i];
+        } else if (arg == "--quirks" && hasValue) {
+            if (!parseQuirkProfile(argv[++i], options.quirks)) return false;
+        } else if (arg == "--unchecked") {
+            options.checked = false;
+        } else if (arg == "--video" && hasValue) {
+            options.videoPath = argv[++i];
+        } else if (arg == "--image" && hasValue) {
+            options.imagePath = argv[++i];
+        } else if (arg == "--scale" && hasValue) {
+            options.scale = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+            if (options.scale == 0 || options.scale * 2 > Upscaler::MAX_SCALE) {
+                std::cerr << "Error: --scale must be between 1 and " << Upscaler::MAX_SCALE / 2 << std::endl;
+                return false;
+            }
+        } else if (arg == "--palette" && hasValue) {
+            if (!parsePalette(argv[++i], options.palette)) return false;
+        } else if (arg == "--filter" && hasValue) {
+            if (!parseScaleFilter(argv[++i], options.filter)) return false;
+        } else if (arg[0] != '-' && options.romPath.empty()) {
+            options.romPath = arg;
+        } else {
+            std::cerr << "Error: Unknown or incomplete option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (options.romPath.empty() || options.ips == 0) {
+        return false;
+    }
+    if (!options.recordPath.empty() && !options.replayPath.empty()) {
+        std::cerr << "Error: --record and --replay can't be combined" << std::endl;
+        return false;
+    }
+    if (options.profile && options.useJit) {
+        std::cerr << "Error: --profile only works with the interpreter" << std::endl;
+        return false;
+    }
+    if (!options.tracePath.empty() && (options.useJit || options.profile)) {
+        std::cerr << "Error: --trace only works with the interpreter and without --profile" << std::endl;
+        return false;
+    }
+    if (options.maxCycles == 0 && options.maxFrames == 0 && options.untilPC < 0 && !options.untilIdle &&
+        options.replayPath.empty()) {
+        std::cerr << "Error: No stop condition given, use --cycles, --frames, --until-pc, --until-idle or --replay"
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void dumpDisplay(const Chip8 &chip8) {
+    // XO-CHIP pixels only set in plane 1 show as 'o', set in both as '@'
+    const char symbols[] = ".#o@";
+    for (unsigned int y = 0; y < chip8.getHeight(); y++) {
+        for (unsigned int x = 0; x < chip8.getWidth(); x++) {
+            std::cout << symbols[chip8.getColor(x, y)];
+        }
+        std::cout << '\n';
+    }
+}
+
+// Binary PPM of the display scaled to the same size at either resolution
+bool writeImage(const Chip8 &chip8, const Options &options) {
+    unsigned int scale = chip8.isHires() ? options.scale : options.scale * 2;
+    unsigned int width = chip8.getWidth() * scale;
+    unsigned int height = chip8.getHeight() * scale;
+    std::vector<uint32_t> pixels(static_cast<size_t>(width) * height);
+    Upscaler(options.palette, options.filter).scale(chip8, scale, pixels.data(), width);
+
+    std::vector<char> rgb;
+    rgb.reserve(pixels.size() * 3);
+    for (uint32_t pixel: pixels) {
+        rgb.push_back(static_cast<char>(pixel >> 16));
+        rgb.push_back(static_cast<char>(pixel >> 8));
+        rgb.push_back(static_cast<char>(pixel));
+    }
+    std::ofstream file(options.imagePath, std::ios::binary);
+    file << "P6\n" << width << " " << height << "\n255\n";
+    file.write(rgb.data(), static_cast<std::streamsize>(rgb.size()));
+    if (!file) {
+        std::cerr << "Error: Could not write image " << options.imagePath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::ifstream file(options.romPath, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open ROM file " << options.romPath << std::endl;
+        return 1;
+    }
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // A replay takes the seed, speed, quirks and length of the recorded run
+    InputMovie movie;
+    bool replaying = !options.replayPath.empty();
+    if (replaying) {
+        if (!movie.load(options.replayPath)) {
+            return 1;
+        }
+        if (movie.frameCount() == 0) {
+            std::cerr << "Error: The movie has no frames" << std::endl;
+            return 1;
+        }
+        if (movie.romHash != InputMovie::hashROM(rom.data(), rom.size())) {
+            std::cerr << "Error: The movie was recorded with a different ROM" << std::endl;
+            return 1;
+        }
+        options.seed = movie.seed;
+        options.ips = movie.ips;
+        options.quirks = movie.quirks;
+        if (options.maxFrames == 0 || options.maxFrames > movie.frameCount()) {
+            options.maxFrames = movie.frameCount();
+        }
+    } else {
+        movie.seed = options.seed;
+        movie.ips = options.ips;
+        movie.quirks = options.quirks;
+        movie.romHash = InputMovie::hashROM(rom.data(), rom.size());
+    }
+
+    Chip8 chip8(options.seed);
+    chip8.setQuirks(options.quirks, options.checked);
+    if (!chip8.loadROM(rom.data(), rom.size())) {
+        return 1;
+    }
+
+    if (options.useJit && !Chip8Jit::isSupported()) {
+        std::cerr << "Error: The recompiler is not available on this platform" << std::endl;
+        return 1;
+    }
+    // Only map the recompiler's code buffer when it is used
+    std::optional<Chip8Jit> jit;
+    if (options.useJit) jit.emplace(chip8);
+    Profiler profiler;
+    TraceWriter trace(chip8);
+    bool tracing = !options.tracePath.empty();
+    if (tracing && !trace.open(options.tracePath)) {
+        return 1;
+    }
+    FrameRecorder video;
+    bool recordingVideo = !options.videoPath.empty();
+    if (recordingVideo) {
+        if (!video.open(options.videoPath)) return 1;
+        chip8.setFrameSink(&video);
+    }
+    // Rendered frame by frame in emulated time, so the buzzer events need no latency
+    AudioEngine audio;
+    std::vector<int16_t> samples;
+
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    bool stopped = false;
+    bool diverged = false;
+    auto start = std::chrono::steady_clock::now();
+
+    while (!stopped) {
+        uint64_t frameCycles = movie.cyclesInFrame(frames);
+        uint64_t cyclesBefore = cycles;
+        if (replaying) {
+            chip8.setKeys(movie.keysAt(frames));
+        }
+
+        if (options.maxCycles != 0 && cycles + frameCycles > options.maxCycles) {
+            frameCycles = options.maxCycles - cycles;
+        }
+
+        if (options.untilPC < 0 && !options.untilIdle) {
+            // Nothing to check between instructions, run the whole frame at once
+            if (options.useJit) {
+                jit->run(frameCycles);
+            } else if (options.profile) {
+                chip8.run(frameCycles, profiler);
+            } else if (tracing) {
+                chip8.run(frameCycles, trace);
+            } else {
+                chip8.run(frameCycles);
+            }
+            cycles += frameCycles;
+            if (options.maxCycles != 0 && cycles >= options.maxCycles) {
+                stopped = true;
+            }
+        } else {
+            for (uint64_t i = 0; i < frameCycles; i++) {
+                uint16_t pcBefore = chip8.getPC();
+                // The display wait holds the PC too, but isn't the program idling
+                bool waiting = chip8.isWaitingForTick();
+                if (options.useJit) {
+                    jit->run(1);
+                } else if (options.profile) {
+                    chip8.run(1, profiler);
+                } else if (tracing) {
+                    chip8.run(1, trace);
+                } else {
+                    chip8.cycle();
+                }
+                cycles++;
+
+                if ((options.maxCycles != 0 && cycles >= options.maxCycles) ||
+                    (options.untilPC >= 0 && chip8.getPC() == options.untilPC) ||
+                    (options.untilIdle && !waiting && chip8.getPC() == pcBefore)) {
+                    stopped = true;
+                    break;
+                }
+            }
+        }
+
+        if (!options.wavPath.empty()) {
+            uint64_t first = audio.frameStart(frames);
+            samples.resize(audio.frameStart(frames + 1));
+            audio.setBuzzer(first, chip8.soundTimer > 0);
+            audio.render(samples.data() + first, samples.size() - first);
+        }
+        chip8.tickTimers();
+        profiler.endFrame();
+
+        // Only whole frames can be compared with a movie
+        if (cycles - cyclesBefore == movie.cyclesInFrame(frames)) {
+            if (replaying && chip8.stateHash() != movie.frameHashes[frames]) {
+                std::cerr << "Error: Replay diverged at frame " << frames << std::endl;
+                diverged = true;
+                stopped = true;
+            } else if (!options.recordPath.empty()) {
+                movie.record(chip8.getKeys(), chip8.stateHash());
+            }
+        }
+        frames++;
+        if (options.maxFrames != 0 && frames >= options.maxFrames) {
+            stopped = true;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (options.dumpDisplay) {
+        dumpDisplay(chip8);
+    }
+    if (options.profile) {
+        profiler.printFlat(std::cout);
+        profiler.printHotLoops(std::cout, 5);
+    }
+    std::cout << "cycles: " << cycles << "\n"
+              << "frames: " << frames << "\n"
+              << "pc: 0x" << std::hex << chip8.getPC() << std::dec << "\n"
+              << "idle cycles skipped: " << chip8.getIdleCycles() << "\n"
+              << "host seconds: " << seconds << "\n"
+              << "instructions/second: " << (seconds > 0 ? cycles / seconds : 0) << std::endl;
+
+    if (replaying && !diverged) {
+        std::cout << "replay: " << frames << " frames match" << std::endl;
+    }
+    if (tracing) {
+        if (!trace.close()) return 1;
+        std::cout << "trace: " << trace.getRecords() << " instructions" << std::endl;
+    }
+    if (!options.recordPath.empty() && !movie.save(options.recordPath)) {
+        return 1;
+    }
+    if (recordingVideo) {
+        chip8.setFrameSink(nullptr);
+        if (!video.close(frames)) return 1;
+        std::cout << "video: " << video.getFrames() << " frames, " << video.getBytes() << " bytes" << std::endl;
+    }
+    if (!options.imagePath.empty() && !writeImage(chip8, options)) {
+        return 1;
+    }
+    if (!options.wavPath.empty() && !AudioEngine::writeWAV(options.wavPath, samples, audio.getSampleRate())) {
+        return 1;
+    }
+    return diverged ? 2 : 0;
+}
@@ -1,18 +1,56 @@
 #include <SDL2/SDL.h>
 #include <iostream>
-#include <chrono>
-#include <cmath>
-
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AudioEngine.h"
 #include "Chip8.h"
-
-// Audio settings
+#include "Debugger.h"
+#include "Disassembler.h"
+#include "FrameScheduler.h"
+#include "InputMovie.h"
+#include "RewindBuffer.h"
+#include "TripleBuffer.h"
+#include "Upscaler.h"
+
+// Audio settings, a 256 sample device buffer is under 6ms at 44.1kHz
 const int AMPLITUDE = 28000;
 const int SAMPLE_RATE = 44100;
+const int AUDIO_BUFFER = 256;
+
+// Display colors, unless --palette picks others
+const uint32_t ON_COLOR = 0xFFFFFFFF;
+const uint32_t OFF_COLOR = 0xFF000000;
+// XO-CHIP pixels set only in plane 1, and in both planes
+const uint32_t PLANE2_COLOR = 0xFF808080;
+const uint32_t BOTH_COLOR = 0xFFC0C0C0;
+const Chip8::Palette PALETTE{OFF_COLOR, ON_COLOR, PLANE2_COLOR, BOTH_COLOR};
+
+// A finished frame, handed from the emulation thread to the main thread
+struct Frame {
+    std::array<Chip8::Plane, Chip8::PLANES> display{};
+    bool hires{};
+};
 
 bool init();
 void cleanup();
-void updateDisplay();
-bool handleInput();
+void emulate();
+void runFrame();
+bool debugFrame();
+void showStop();
+void updateDisplay(const Frame &frame);
+void handleEvent(const SDL_Event &e);
 void audioCallback(void* userdata, Uint8* stream, int len);
 
 // Pointers to our window, renderer, and texture
@@ -22,122 +60,364 @@ SDL_Texture* texture{};
 
 Chip8 chip8;
 
+// Instructions per 60Hz frame, 11 gives the usual ~660Hz CPU speed
+unsigned int cyclesPerFrame = 11;
+// Let presenting the frame wait for the display's refresh
+bool vsync = false;
+
+// Set by the main thread, which handles SDL events, and read by the emulation thread
+std::atomic<bool> running{true};
+std::atomic<uint16_t> heldKeys{0};
+std::atomic<bool> rewinding{false};
+
+// Frames with a changed display, plus an SDL event to wake the main thread for each
+TripleBuffer<Frame> frames;
+Uint32 frameEvent{};
+
+// The frame currently in the texture. The texture is sized for hi-res,
+// lo-res frames use its top left quarter.
+Frame shown;
+
+// Expands frames into the texture. With --scale N that happens on the CPU:
+// hi-res pixels become N x N blocks and lo-res ones 2N x 2N, in a texture the
+// window shows 1:1, which --filter needs. Without it the texture is the
+// display's size and the renderer stretches it.
+Upscaler upscaler(PALETTE);
+unsigned int cpuScale = 0;
+
+// Buzzer, gated by the emulation thread and rendered by SDL's audio thread
+AudioEngine audio(SAMPLE_RATE, 440.0, AMPLITUDE, AUDIO_BUFFER);
+// Frames run so far, rewound ones included, which is the clock of the buzzer events
+uint64_t emulatedFrames = 0;
+
+// Five minutes of history, played back while Backspace is held
+RewindBuffer history;
+
+// Input movie written on exit with --record
+InputMovie movie;
+bool recording = false;
+
+// Debugger, with --debug or --break: F5 continues, F6 pauses, F11 steps, F10
+// steps over a call and Shift+F11 out of the current subroutine. Where it
+// stopped goes to the window title and stdout.
+enum class DebugCommand : uint8_t { None, Continue, Pause, Step, StepOver, StepOut };
+bool debugging = false;
+Debugger debugger(chip8);
+std::atomic<DebugCommand> debugCommand{DebugCommand::None};
+// Emulation thread only: stopped, and the instructions of the frame run before that
+bool paused = false;
+uint64_t frameCycles = 0;
+// Set by the emulation thread, which pushes debugEvent for the main thread to show it
+std::mutex titleMutex;
+std::string title;
+Uint32 debugEvent{};
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <ROM_FILE>" << std::endl;
+    unsigned int seed = std::random_device{}();
+    QuirkProfile quirks = QuirkProfile::Modern;
+    std::string recordPath;
+    Chip8::Palette palette = PALETTE;
+    ScaleFilter filter = ScaleFilter::None;
+    bool validArgs = argc >= 2;
+    for (int i = 2; validArgs && i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc) {
+            seed = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (arg == "--record" && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (arg == "--ipf" && i + 1 < argc) {
+            cyclesPerFrame = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+            validArgs = cyclesPerFrame > 0;
+        } else if (arg == "--vsync") {
+            vsync = true;
+        } else if (arg == "--quirks" && i + 1 < argc) {
+            validArgs = parseQuirkProfile(argv[++i], quirks);
+        } else if (arg == "--scale" && i + 1 < argc) {
+            cpuScale = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+            validArgs = cpuScale > 0 && cpuScale * 2 <= Upscaler::MAX_SCALE;
+        } else if (arg == "--palette" && i + 1 < argc) {
+            validArgs = parsePalette(argv[++i], palette);
+        } else if (arg == "--filter" && i + 1 < argc) {
+            validArgs = parseScaleFilter(argv[++i], filter);
+        } else if (arg == "--debug") {
+            debugging = true;
+        } else if (arg == "--break" && i + 1 < argc) {
+            debugging = true;
+            debugger.addBreakpoint(static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 0)));
+        } else {
+            validArgs = false;
+        }
+    }
+    if (!validArgs) {
+        std::cerr << "Usage: " << argv[0] << " <ROM_FILE> [--seed N] [--record MOVIE_FILE] [--ipf N] [--vsync]"
+                  << " [--quirks modern|vip|chip48|schip|xochip] [--scale N] [--palette NAME|COLORS]"
+                  << " [--filter none|scanlines|scale2x] [--debug] [--break ADDR]..." << std::endl;
+        return 1;
+    }
+    // Filters work on the CPU scaled pixels, at the default window size
+    if (filter != ScaleFilter::None && cpuScale == 0) cpuScale = 5;
+    upscaler.setPalette(palette);
+    upscaler.setFilter(filter);
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open ROM file " << argv[1] << std::endl;
         return 1;
     }
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
     if (!init()) return 1;
 
-    if (!chip8.loadROM(argv[1])) {
+    // Runs with the same seed and input are identical, which is what makes a recording replayable
+    chip8 = Chip8(seed);
+    chip8.setQuirks(quirks);
+    if (!chip8.loadROM(rom.data(), rom.size())) {
         return 1; // Exit if ROM loading fails
     }
+    movie.seed = seed;
+    movie.ips = cyclesPerFrame * 60;
+    movie.quirks = quirks;
+    movie.romHash = InputMovie::hashROM(rom.data(), rom.size());
+    recording = !recordPath.empty();
+
+    // Emulation gets a thread of its own, so a present that blocks (on vsync
+    // or a busy compositor) never holds up the next frame. Rendering stays on
+    // this thread, which SDL requires, and only wakes up for input and for
+    // frames where the display changed.
+    std::thread emulator(emulate);
 
-    auto lastFrameTime = std::chrono::high_resolution_clock::now();
+    SDL_Event e{};
+    while (running && SDL_WaitEvent(&e)) {
+        bool exposed = false;
+        do {
+            handleEvent(e);
+            exposed |= e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_EXPOSED;
+        } while (SDL_PollEvent(&e) != 0);
+
+        if (frames.update() || exposed) {
+            updateDisplay(frames.front());
+        }
+    }
+    running = false;
+    emulator.join();
 
-    bool running = true;
-    while (running) {
-        running = handleInput();
+    cleanup();
 
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastFrameTime).count();
+    if (!recordPath.empty() && !movie.save(recordPath)) {
+        return 1;
+    }
+    return 0;
+}
 
-        // 16.67 milliseconds ~60 Frames Per Second (60Hz)
-        if (dt >= 16.67f) {
-            lastFrameTime = currentTime;
+void emulate() {
+    // The timers tick once per emulated frame, so the scheduler keeps them at
+    // 60Hz. Between frames the thread sleeps instead of polling the clock.
+    FrameScheduler scheduler(60);
 
-            // Run the CPU 11 times per frame to achieve ~660Hz CPU speed (11 * 60 frames)
-            for (int i = 0; i < 11; i++) {
-                chip8.cycle();
-            }
+    while (running) {
+        unsigned int due = scheduler.waitForFrames();
 
-            // Update Chip8 timers and handle sound
-            if (chip8.delayTimer > 0) chip8.delayTimer--;
+        // Usually one frame, more when catching up after the host stalled
+        for (unsigned int i = 0; i < due; i++) {
+            runFrame();
+        }
 
-            if (chip8.soundTimer > 0) {
-                SDL_PauseAudio(0); // Play sound
-                chip8.soundTimer--;
-            } else {
-                SDL_PauseAudio(1); // Pause sound
-            }
+        // Frames that look the same as the last one are neither converted nor presented
+        if (chip8.getDirtyRows() != 0) {
+            chip8.clearDirtyRows();
+            frames.back().display = chip8.display;
+            frames.back().hires = chip8.isHires();
+            frames.publish();
 
-            updateDisplay();
+            SDL_Event e{};
+            e.type = frameEvent;
+            SDL_PushEvent(&e);
         }
     }
-
-    cleanup();
-    return 0;
 }
 
-void audioCallback(void* userdata, Uint8* stream, int len) {
-    static double phase = 0.0;
-    auto* buffer = (Sint16*)stream;
-    int length = len / sizeof(Sint16);
-
-    for (int i = 0; i < length; i++) {
-        buffer[i] = (Sint16)(AMPLITUDE * sin(phase));
-        phase += 2.0 * M_PI * 440.0 / SAMPLE_RATE; // 440 Hz tone
-        if (phase >= 2.0 * M_PI) {
-            phase -= 2.0 * M_PI;
+void runFrame() {
+    if (rewinding) {
+        if (history.pop(chip8)) {
+            // The frame never happened as far as the recording is concerned
+            movie.truncate(movie.frameCount() - 1);
         }
+        // Keep the keys that are actually held, not the recorded ones
+        chip8.setKeys(heldKeys);
+        audio.setBuzzer(audio.frameStart(emulatedFrames++), false);
+        frameCycles = 0;
+        return;
+    }
+
+    chip8.setKeys(heldKeys);
+    if (!debugging) {
+        history.push(chip8);
+        chip8.run(cyclesPerFrame);
+    } else if (!debugFrame()) {
+        // Stopped, the buzzer stays quiet until the frame goes on
+        audio.setBuzzer(audio.frameStart(emulatedFrames++), false);
+        return;
+    }
+
+    // The buzzer sounds for the frame if the sound timer is still running
+    audio.setBuzzer(audio.frameStart(emulatedFrames++), chip8.soundTimer > 0);
+    chip8.tickTimers();
+
+    if (recording) {
+        movie.record(chip8.getKeys(), chip8.stateHash());
     }
 }
 
-bool handleInput() {
+// Run the rest of the frame under the debugger, after the last command from
+// the keyboard. False if it is stopped before the end of the frame.
+bool debugFrame() {
+    DebugCommand command = debugCommand.exchange(DebugCommand::None);
+    switch (command) {
+        case DebugCommand::Continue: debugger.resume(); break;
+        case DebugCommand::Pause:
+        case DebugCommand::Step: debugger.step(); break;
+        case DebugCommand::StepOver: debugger.stepOver(); break;
+        case DebugCommand::StepOut:
+            // Outside a subroutine there is nothing to step out of
+            if (!debugger.stepOut()) command = DebugCommand::None;
+            break;
+        default: break;
+    }
+    if (command != DebugCommand::None) paused = false;
+    if (paused) return false;
+
+    if (frameCycles == 0) history.push(chip8);
+    chip8.run(cyclesPerFrame - frameCycles, debugger);
+    if (debugger.getStop() != Debugger::Stop::None) {
+        frameCycles += debugger.getRunCycles();
+        paused = true;
+        showStop();
+        return false;
+    }
+    frameCycles = 0;
+    return true;
+}
+
+void showStop() {
+    uint16_t pc = chip8.getPC();
+    uint16_t opcode = static_cast<uint16_t>((chip8.readMemory(pc) << 8) | chip8.readMemory(pc + 1));
+    std::ostringstream text;
+    switch (debugger.getStop()) {
+        case Debugger::Stop::Breakpoint: text << "Breakpoint"; break;
+        case Debugger::Stop::Watchpoint: text << "Watchpoint"; break;
+        default: text << "Step"; break;
+    }
+    text << " at 0x" << std::hex << std::setfill('0') << std::setw(3) << pc << ": " << disassemble(opcode);
+
+    std::cout << text.str() << '\n' << std::hex;
+    for (unsigned int i = 0; i < 16; i++) {
+        std::cout << 'V' << "0123456789ABCDEF"[i] << '=' << std::setw(2) << static_cast<int>(chip8.getRegisters()[i])
+                  << ' ';
+    }
+    std::cout << "I=" << std::setw(3) << chip8.getIndex() << std::dec << std::setfill(' ') << std::endl;
+
+    std::lock_guard<std::mutex> lock(titleMutex);
+    title = text.str();
     SDL_Event e{};
-    while (SDL_PollEvent(&e) != 0) {
-        if (e.type == SDL_QUIT) {
-            return false;
-        } else if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) {
-            // True if a key is pressed down, False if it was released
-            bool isDown = (e.type == SDL_KEYDOWN);
-
-            // The standard mapping from the original 16-key hex pad
-            switch (e.key.keysym.sym) {
-                case SDLK_1: chip8.keypad.at(0x1) = isDown; break;
-                case SDLK_2: chip8.keypad.at(0x2) = isDown; break;
-                case SDLK_3: chip8.keypad.at(0x3) = isDown; break;
-                case SDLK_4: chip8.keypad.at(0xC) = isDown; break;
-                case SDLK_q: chip8.keypad.at(0x4) = isDown; break;
-                case SDLK_w: chip8.keypad.at(0x5) = isDown; break;
-                case SDLK_e: chip8.keypad.at(0x6) = isDown; break;
-                case SDLK_r: chip8.keypad.at(0xD) = isDown; break;
-                case SDLK_a: chip8.keypad.at(0x7) = isDown; break;
-                case SDLK_s: chip8.keypad.at(0x8) = isDown; break;
-                case SDLK_d: chip8.keypad.at(0x9) = isDown; break;
-                case SDLK_f: chip8.keypad.at(0xE) = isDown; break;
-                case SDLK_z: chip8.keypad.at(0xA) = isDown; break;
-                case SDLK_x: chip8.keypad.at(0x0) = isDown; break;
-                case SDLK_c: chip8.keypad.at(0xB) = isDown; break;
-                case SDLK_v: chip8.keypad.at(0xF) = isDown; break;
-            }
+    e.type = debugEvent;
+    SDL_PushEvent(&e);
+}
+
+void audioCallback(void* userdata, Uint8* stream, int len) {
+    static_cast<AudioEngine*>(userdata)->render(reinterpret_cast<int16_t*>(stream), len / sizeof(int16_t));
+}
+
+void setKey(unsigned int key, bool isDown) {
+    uint16_t bit = static_cast<uint16_t>(1u << key);
+    if (isDown) {
+        heldKeys.fetch_or(bit);
+    } else {
+        heldKeys.fetch_and(static_cast<uint16_t>(~bit));
+    }
+}
+
+void handleEvent(const SDL_Event &e) {
+    if (e.type == SDL_QUIT) {
+        running = false;
+    } else if (e.type == debugEvent) {
+        std::lock_guard<std::mutex> lock(titleMutex);
+        SDL_SetWindowTitle(window, title.c_str());
+    } else if (debugging && e.type == SDL_KEYDOWN && e.key.keysym.sym >= SDLK_F5 && e.key.keysym.sym <= SDLK_F11) {
+        switch (e.key.keysym.sym) {
+            case SDLK_F5:
+                debugCommand = DebugCommand::Continue;
+                SDL_SetWindowTitle(window, "Monochrome Display");
+                break;
+            case SDLK_F6: debugCommand = DebugCommand::Pause; break;
+            case SDLK_F10: debugCommand = DebugCommand::StepOver; break;
+            case SDLK_F11:
+                debugCommand = (e.key.keysym.mod & KMOD_SHIFT) ? DebugCommand::StepOut : DebugCommand::Step;
+                break;
+        }
+    } else if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) {
+        // True if a key is pressed down, False if it was released
+        bool isDown = (e.type == SDL_KEYDOWN);
+
+        // The standard mapping from the original 16-key hex pad
+        switch (e.key.keysym.sym) {
+            case SDLK_1: setKey(0x1, isDown); break;
+            case SDLK_2: setKey(0x2, isDown); break;
+            case SDLK_3: setKey(0x3, isDown); break;
+            case SDLK_4: setKey(0xC, isDown); break;
+            case SDLK_q: setKey(0x4, isDown); break;
+            case SDLK_w: setKey(0x5, isDown); break;
+            case SDLK_e: setKey(0x6, isDown); break;
+            case SDLK_r: setKey(0xD, isDown); break;
+            case SDLK_a: setKey(0x7, isDown); break;
+            case SDLK_s: setKey(0x8, isDown); break;
+            case SDLK_d: setKey(0x9, isDown); break;
+            case SDLK_f: setKey(0xE, isDown); break;
+            case SDLK_z: setKey(0xA, isDown); break;
+            case SDLK_x: setKey(0x0, isDown); break;
+            case SDLK_c: setKey(0xB, isDown); break;
+            case SDLK_v: setKey(0xF, isDown); break;
+            case SDLK_BACKSPACE: rewinding = isDown; break;
         }
     }
-    return true;
 }
 
-void updateDisplay() {
-    // Update the texture
-    void* pixels;
-    int pitch;
-    SDL_LockTexture(texture, NULL, &pixels, &pitch);
-
-    // We take the void* from pixels and convert it to a uint32_t*
-    // This allows us to update pixel data much easier
-    auto* pixel_data = static_cast<uint32_t*>(pixels);
-    for (int y = 0; y < chip8.SCREEN_HEIGHT; ++y) {
-        for (int x = 0; x < chip8.SCREEN_WIDTH; ++x) {
-            // Sets pixel data to match chip8 display pixels.
-            // Pixels for chip 8 are on or off so we multiply by 255.
-            uint8_t gray = chip8.display[y][x] * 255;
-            pixel_data[y * (pitch / sizeof(uint32_t)) + x] = (0xFF << 24) | (gray << 16) | (gray << 8) | gray;
+void updateDisplay(const Frame &frame) {
+    unsigned int width = frame.hires ? Chip8::HIRES_WIDTH : Chip8::SCREEN_WIDTH;
+    unsigned int height = frame.hires ? Chip8::HIRES_HEIGHT : Chip8::SCREEN_HEIGHT;
+    unsigned int scale = cpuScale == 0 ? 1 : frame.hires ? cpuScale : cpuScale * 2;
+    // A change of resolution redraws everything
+    bool all = frame.hires != shown.hires;
+    shown.hires = frame.hires;
+
+    // Expand only the band of rows between the first and last that differ
+    // from the texture, straight into the locked texture
+    unsigned int first = height;
+    unsigned int last = 0;
+    for (unsigned int y = 0; y < height; y++) {
+        if (!all && frame.display[0][y] == shown.display[0][y] && frame.display[1][y] == shown.display[1][y]) continue;
+        shown.display[0][y] = frame.display[0][y];
+        shown.display[1][y] = frame.display[1][y];
+        first = std::min(first, y);
+        last = y;
+    }
+    if (first <= last) {
+        // Scale2x also changes the rows next to a changed one
+        first -= std::min(first, upscaler.reach());
+        last = std::min(last + upscaler.reach(), height - 1);
+        SDL_Rect rows{0, static_cast<int>(first * scale), static_cast<int>(width * scale),
+                      static_cast<int>((last - first + 1) * scale)};
+        void *locked = nullptr;
+        int pitch = 0;
+        if (SDL_LockTexture(texture, &rows, &locked, &pitch) == 0) {
+            upscaler.scaleRows(frame.display, width, height, scale, first, last, static_cast<uint32_t *>(locked),
+                               pitch / sizeof(uint32_t));
+            SDL_UnlockTexture(texture);
         }
     }
-    SDL_UnlockTexture(texture);
 
+    SDL_Rect source{0, 0, static_cast<int>(width * scale), static_cast<int>(height * scale)};
     SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderCopy(renderer, texture, &source, NULL);
     SDL_RenderPresent(renderer);
 }
 
@@ -147,39 +427,70 @@ bool init() {
         return false;
     }
 
-    window = SDL_CreateWindow("Monochrome Display", 100, 100, 640, 320, SDL_WINDOW_SHOWN);
+    unsigned int textureScale = std::max(cpuScale, 1u);
+    int windowWidth = cpuScale == 0 ? 640 : static_cast<int>(Chip8::HIRES_WIDTH * cpuScale);
+    int windowHeight = cpuScale == 0 ? 320 : static_cast<int>(Chip8::HIRES_HEIGHT * cpuScale);
+    window = SDL_CreateWindow("Monochrome Display", 100, 100, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
     if (!window) {
         std::cout << "Error creating window: " << SDL_GetError() << std::endl;
         return false;
     }
 
-    renderer = SDL_CreateRenderer(window, -1, 0);
+    renderer = SDL_CreateRenderer(window, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
     if (!renderer) {
         std::cout << "Error creating renderer: " << SDL_GetError() << std::endl;
         return false;
     }
 
+    SDL_RendererInfo info;
+    if (vsync && (SDL_GetRendererInfo(renderer, &info) != 0 || !(info.flags & SDL_RENDERER_PRESENTVSYNC))) {
+        std::cout << "Vsync is not available, presenting without it" << std::endl;
+        vsync = false;
+    }
+
     // Use nearest-neighbor scaling
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
 
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, chip8.SCREEN_WIDTH, chip8.SCREEN_HEIGHT);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                chip8.HIRES_WIDTH * textureScale, chip8.HIRES_HEIGHT * textureScale);
     if (!texture) {
         std::cout << "Error creating texture: " << SDL_GetError() << std::endl;
         return false;
     }
+    // Start from a blank screen, later frames only upload the rows that changed
+    void *locked = nullptr;
+    int pitch = 0;
+    if (SDL_LockTexture(texture, NULL, &locked, &pitch) != 0) {
+        std::cout << "Error locking texture: " << SDL_GetError() << std::endl;
+        return false;
+    }
+    upscaler.scaleRows(shown.display, Chip8::HIRES_WIDTH, Chip8::HIRES_HEIGHT, textureScale, 0, Chip8::HIRES_HEIGHT - 1,
+                       static_cast<uint32_t *>(locked), pitch / sizeof(uint32_t));
+    SDL_UnlockTexture(texture);
+
+    frameEvent = SDL_RegisterEvents(2);
+    if (frameEvent == static_cast<Uint32>(-1)) {
+        std::cout << "Error registering frame event: " << SDL_GetError() << std::endl;
+        return false;
+    }
+    debugEvent = frameEvent + 1;
 
     // Audio setup
-    SDL_AudioSpec want, have;
+    SDL_AudioSpec want;
     SDL_zero(want);
     want.freq = SAMPLE_RATE;
     want.format = AUDIO_S16;
     want.channels = 1;
-    want.samples = 2048;
+    want.samples = AUDIO_BUFFER;
     want.callback = audioCallback;
-    if (SDL_OpenAudio(&want, &have) < 0) {
+    want.userdata = &audio;
+    // NULL makes SDL convert if the device wants another format
+    if (SDL_OpenAudio(&want, NULL) < 0) {
         std::cout << "Error opening audio: " << SDL_GetError() << std::endl;
         return false;
     }
+    // The device plays all the time, silence included, so the buzzer is gated to the sample
+    SDL_PauseAudio(0);
 
     return true;
 }
@@ -0,0 +1,581 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "FrameRecorder.h"
+#include "Upscaler.h"
+
+// Recording exporter: turns a frame recording (chip8_headless --video or
+// chip8_batch --video-dir) into a PNG sequence or an animated GIF, scaled
+// with the same palettes and filters as the emulator. Both are written
+// without an image library: PNGs with uncompressed deflate blocks, GIFs
+// with their own LZW coder, only the part of each frame that changed.
+
+namespace {
+
+struct Options {
+    std::string inputPath;
+    std::string pngPrefix;  // Write PREFIX000123.png for every frame that changed
+    std::string gifPath;
+    bool allFrames = false; // Write a PNG for every frame, changed or not, for a 60fps video
+    bool verify = false;    // Decode every GIF frame again and compare it with what was encoded
+    unsigned int scale = 5; // Hi-res pixels become scale x scale blocks, lo-res ones twice that
+    Chip8::Palette palette{0xFF000000, 0xFFFFFFFF, 0xFF808080, 0xFFC0C0C0};
+    ScaleFilter filter = ScaleFilter::None;
+    uint64_t first = 0;     // First frame to export
+    uint64_t last = std::numeric_limits<uint64_t>::max();
+};
+
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " <RECORDING> (--png PREFIX | --gif FILE) [options]\n"
+              << "  --png PREFIX    Write PREFIX000000.png and on, named by frame number, for every changed frame\n"
+              << "  --all-frames    With --png, write every frame, for tools that expect 60 images per second\n"
+              << "  --gif FILE      Write an animated GIF\n"
+              << "  --verify        With --gif, decode every frame as a strict decoder would and check it\n"
+              << "  --from FRAME    First frame to export (default 0)\n"
+              << "  --to FRAME      Last frame to export (default: the end)\n"
+              << "  --scale N       Hi-res pixels become N x N (default 5, 640x320 images)\n"
+              << "  --palette P     mono (default), amber, green, lcd or RRGGBB,RRGGBB,RRGGBB,RRGGBB\n"
+              << "  --filter NAME   none (default), scanlines or scale2x\n";
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--png" && hasValue) {
+            options.pngPrefix = argv[++i];
+        } else if (arg == "--all-frames") {
+            options.allFrames = true;
+        } else if (arg == "--gif" && hasValue) {
+            options.gifPath = argv[++i];
+        } else if (arg == "--verify") {
+            options.verify = true;
+        } else if (arg == "--from" && hasValue) {
+            options.first = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--to" && hasValue) {
+            options.last = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--scale" && hasValue) {
+            options.scale = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+            if (options.scale == 0 || options.scale * 2 > Upscaler::MAX_SCALE) {
+                std::cerr << "Error: --scale must be between 1 and " << Upscaler::MAX_SCALE / 2 << std::endl;
+                return false;
+            }
+        } else if (arg == "--palette" && hasValue) {
+            if (!parsePalette(argv[++i], options.palette)) return false;
+        } else if (arg == "--filter" && hasValue) {
+            if (!parseScaleFilter(argv[++i], options.filter)) return false;
+        } else if (arg[0] != '-' && options.inputPath.empty()) {
+            options.inputPath = arg;
+        } else {
+            std::cerr << "Error: Unknown or incomplete option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (options.inputPath.empty()) return false;
+    if (options.pngPrefix.empty() == options.gifPath.empty()) {
+        std::cerr << "Error: Give either --png or --gif" << std::endl;
+        return false;
+    }
+    if (options.first > options.last) {
+        std::cerr << "Error: --from is after --to" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// A frame as indices into the exporter's colors, 128 * scale by 64 * scale
+struct Image {
+    unsigned int width{};
+    unsigned int height{};
+    std::vector<uint8_t> pixels;
+};
+
+// Scales frames and maps their pixels to color indices
+class Renderer {
+public:
+    explicit Renderer(const Options &options)
+        : upscaler(options.palette, options.filter), colors(upscaler.getColors()), scale(options.scale) {
+        image.width = Chip8::HIRES_WIDTH * scale;
+        image.height = Chip8::HIRES_HEIGHT * scale;
+        image.pixels.resize(static_cast<size_t>(image.width) * image.height);
+        argb.resize(image.pixels.size());
+    }
+
+    const std::vector<uint32_t> &getColors() const { return colors; }
+
+    const Image &render(const RecordedFrame &frame) {
+        // Both resolutions come out the same size
+        unsigned int width = frame.hires ? Chip8::HIRES_WIDTH : Chip8::SCREEN_WIDTH;
+        unsigned int height = frame.hires ? Chip8::HIRES_HEIGHT : Chip8::SCREEN_HEIGHT;
+        unsigned int factor = frame.hires ? scale : scale * 2;
+        upscaler.scaleRows(frame.display, width, height, factor, 0, height - 1, argb.data(), image.width);
+
+        uint32_t lastColor = colors[0];
+        uint8_t lastIndex = 0;
+        for (size_t i = 0; i < argb.size(); i++) {
+            if (argb[i] != lastColor) {
+                lastColor = argb[i];
+                lastIndex = static_cast<uint8_t>(std::find(colors.begin(), colors.end(), lastColor) - colors.begin());
+            }
+            image.pixels[i] = lastIndex;
+        }
+        return image;
+    }
+
+private:
+    Upscaler upscaler;
+    std::vector<uint32_t> colors;
+    unsigned int scale;
+    std::vector<uint32_t> argb;
+    Image image;
+};
+
+void put16le(std::vector<uint8_t> &out, unsigned int value) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+void put32be(std::vector<uint8_t> &out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(value >> shift));
+}
+
+bool writeFile(const std::string &path, const std::vector<uint8_t> &data) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+    if (!file) {
+        std::cerr << "Error: Could not write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+uint32_t crc32(const uint8_t *data, size_t size) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> entries{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+            entries[i] = crc;
+        }
+        return entries;
+    }();
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFF;
+}
+
+// Indexed PNGs with as few bits per pixel as the colors allow, in a zlib
+// stream of stored blocks
+class PngSequence {
+public:
+    PngSequence(const Options &options, const std::vector<uint32_t> &colors)
+        : prefix(options.pngPrefix), allFrames(options.allFrames), colors(colors) {
+        depth = colors.size() <= 2 ? 1 : colors.size() <= 4 ? 2 : colors.size() <= 16 ? 4 : 8;
+    }
+
+    // The frame shown from frame on, until the next one
+    bool add(const Image &image, uint64_t frame) {
+        if (pending && !flush(frame)) return false;
+        held = image;
+        start = frame;
+        pending = true;
+        return true;
+    }
+
+    bool finish(uint64_t endFrame) { return !pending || flush(std::max(endFrame, start + 1)); }
+
+    uint64_t getFiles() const { return files; }
+
+private:
+    bool flush(uint64_t end) {
+        std::vector<uint8_t> png = encode(held);
+        for (uint64_t frame = start; frame < (allFrames ? end : start + 1); frame++) {
+            std::ostringstream path;
+            path << prefix << std::setw(6) << std::setfill('0') << frame << ".png";
+            if (!writeFile(path.str(), png)) return false;
+            files++;
+        }
+        return true;
+    }
+
+    std::vector<uint8_t> encode(const Image &image) const {
+        // Rows of filter type 0 and the packed pixels, most significant bits first
+        size_t rowBytes = (static_cast<size_t>(image.width) * depth + 7) / 8;
+        std::vector<uint8_t> raw;
+        raw.reserve((rowBytes + 1) * image.height);
+        for (unsigned int y = 0; y < image.height; y++) {
+            raw.push_back(0);
+            const uint8_t *row = image.pixels.data() + static_cast<size_t>(y) * image.width;
+            unsigned int bits = 0;
+            unsigned int used = 0;
+            for (unsigned int x = 0; x < image.width; x++) {
+                bits = (bits << depth) | row[x];
+                used += depth;
+                if (used == 8) {
+                    raw.push_back(static_cast<uint8_t>(bits));
+                    bits = used = 0;
+                }
+            }
+            if (used > 0) raw.push_back(static_cast<uint8_t>(bits << (8 - used)));
+        }
+
+        std::vector<uint8_t> zlib = {0x78, 0x01};
+        for (size_t offset = 0; offset < raw.size(); offset += 65535) {
+            size_t length = std::min<size_t>(65535, raw.size() - offset);
+            zlib.push_back(offset + length >= raw.size() ? 1 : 0);
+            put16le(zlib, static_cast<unsigned int>(length));
+            put16le(zlib, static_cast<unsigned int>(~length & 0xFFFF));
+            zlib.insert(zlib.end(), raw.begin() + static_cast<std::ptrdiff_t>(offset),
+                        raw.begin() + static_cast<std::ptrdiff_t>(offset + length));
+        }
+        uint32_t a = 1;
+        uint32_t b = 0;
+        for (uint8_t byte: raw) {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        put32be(zlib, (b << 16) | a);
+
+        std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        std::vector<uint8_t> header;
+        put32be(header, image.width);
+        put32be(header, image.height);
+        header.insert(header.end(), {static_cast<uint8_t>(depth), 3, 0, 0, 0});
+        addChunk(png, "IHDR", header);
+        std::vector<uint8_t> palette;
+        for (uint32_t color: colors) {
+            palette.insert(palette.end(), {static_cast<uint8_t>(color >> 16), static_cast<uint8_t>(color >> 8),
+                                           static_cast<uint8_t>(color)});
+        }
+        addChunk(png, "PLTE", palette);
+        addChunk(png, "IDAT", zlib);
+        addChunk(png, "IEND", {});
+        return png;
+    }
+
+    static void addChunk(std::vector<uint8_t> &png, const char *type, const std::vector<uint8_t> &data) {
+        put32be(png, static_cast<uint32_t>(data.size()));
+        size_t start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data.begin(), data.end());
+        put32be(png, crc32(png.data() + start, png.size() - start));
+    }
+
+    std::string prefix;
+    bool allFrames;
+    std::vector<uint32_t> colors;
+    unsigned int depth;
+    Image held;
+    uint64_t start{};
+    bool pending{false};
+    uint64_t files{};
+};
+
+// Animated GIF with one global color table. Every frame after the first only
+// covers the rectangle that changed, over the frames before it. GIF delays are
+// in hundredths of a second, and players stretch anything under 2, so frames
+// shorter than that are dropped for the one after them.
+class GifWriter {
+public:
+    GifWriter(const Options &options, const std::vector<uint32_t> &colors)
+        : path(options.gifPath), verify(options.verify) {
+        while ((1u << tableBits) < colors.size()) tableBits++;
+        codeSize = std::max(tableBits, 2u);
+        table.assign(4096u << codeSize, 0);
+        header(colors);
+    }
+
+    bool add(const Image &image, uint64_t frame) {
+        uint64_t time = centiseconds(frame);
+        if (pending && time - heldTime >= 2 && !writeHeld(time - heldTime)) return false;
+        if (!pending || time - heldTime >= 2) heldTime = time;
+        held = image;
+        pending = true;
+        return true;
+    }
+
+    bool finish(uint64_t endFrame) {
+        uint64_t endTime = centiseconds(endFrame);
+        if (pending && !writeHeld(std::max<uint64_t>(endTime > heldTime ? endTime - heldTime : 0, 2))) return false;
+        out.push_back(0x3B);
+        return writeFile(path, out);
+    }
+
+    uint64_t getFrames() const { return frames; }
+
+private:
+    static uint64_t centiseconds(uint64_t frame) { return frame * 100 / 60; }
+
+    void header(const std::vector<uint32_t> &colors) {
+        out.insert(out.end(), {'G', 'I', 'F', '8', '9', 'a'});
+        // The size is only known with the first frame, it's patched in then
+        put16le(out, 0);
+        put16le(out, 0);
+        out.push_back(static_cast<uint8_t>(0xF0 | (tableBits - 1)));
+        out.push_back(0);
+        out.push_back(0);
+        for (unsigned int i = 0; i < (1u << tableBits); i++) {
+            uint32_t color = i < colors.size() ? colors[i] : 0;
+            out.insert(out.end(), {static_cast<uint8_t>(color >> 16), static_cast<uint8_t>(color >> 8),
+                                   static_cast<uint8_t>(color)});
+        }
+        // Loop forever
+        out.insert(out.end(), {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00,
+                               0x00, 0x00});
+    }
+
+    bool writeHeld(uint64_t delay) {
+        // The rectangle that differs from what is on screen, at least a pixel
+        unsigned int left = 0;
+        unsigned int top = 0;
+        unsigned int right = held.width;
+        unsigned int bottom = held.height;
+        if (frames == 0) {
+            out[6] = static_cast<uint8_t>(held.width);
+            out[7] = static_cast<uint8_t>(held.width >> 8);
+            out[8] = static_cast<uint8_t>(held.height);
+            out[9] = static_cast<uint8_t>(held.height >> 8);
+        } else {
+            auto row = [&](unsigned int y) { return held.pixels.begin() + static_cast<std::ptrdiff_t>(y) * held.width; };
+            auto shownRow = [&](unsigned int y) {
+                return shown.pixels.begin() + static_cast<std::ptrdiff_t>(y) * held.width;
+            };
+            while (top < bottom && std::equal(row(top), row(top + 1), shownRow(top))) top++;
+            while (bottom > top && std::equal(row(bottom - 1), row(bottom), shownRow(bottom - 1))) bottom--;
+            if (top == bottom) {
+                // Nothing changed, a frame still needs a pixel to carry its delay
+                top = 0;
+                bottom = 1;
+                right = 1;
+            } else {
+                left = held.width;
+                right = 0;
+                for (unsigned int y = top; y < bottom; y++) {
+                    for (unsigned int x = 0; x < held.width; x++) {
+                        if (row(y)[x] != shownRow(y)[x]) {
+                            left = std::min(left, x);
+                            right = std::max(right, x + 1);
+                        }
+                    }
+                }
+            }
+        }
+
+        delay = std::min<uint64_t>(delay, 0xFFFF);
+        // Graphic control: leave the frame in place, then the delay
+        out.insert(out.end(), {0x21, 0xF9, 0x04, 0x04});
+        put16le(out, static_cast<unsigned int>(delay));
+        out.insert(out.end(), {0x00, 0x00});
+        out.push_back(0x2C);
+        put16le(out, left);
+        put16le(out, top);
+        put16le(out, right - left);
+        put16le(out, bottom - top);
+        out.push_back(0);
+
+        rect.clear();
+        for (unsigned int y = top; y < bottom; y++) {
+            const uint8_t *row = held.pixels.data() + static_cast<size_t>(y) * held.width;
+            rect.insert(rect.end(), row + left, row + right);
+        }
+        compress();
+        if (verify && !decodes()) {
+            std::cerr << "Error: GIF frame " << frames << " does not decode to what was encoded" << std::endl;
+            return false;
+        }
+        shown = held;
+        frames++;
+        return true;
+    }
+
+    // LZW with variable-length codes, in sub-blocks of up to 255 bytes
+    void compress() {
+        unsigned int clear = 1u << codeSize;
+        unsigned int end = clear + 1;
+        unsigned int width = codeSize + 1;
+        unsigned int next = end + 1;
+        std::fill(table.begin(), table.end(), 0);
+
+        data.clear();
+        uint32_t bits = 0;
+        unsigned int used = 0;
+        auto put = [&](unsigned int code) {
+            bits |= code << used;
+            used += width;
+            while (used >= 8) {
+                data.push_back(static_cast<uint8_t>(bits));
+                bits >>= 8;
+                used -= 8;
+            }
+        };
+
+        put(clear);
+        unsigned int prefix = rect[0];
+        for (size_t i = 1; i < rect.size(); i++) {
+            unsigned int pixel = rect[i];
+            uint16_t &entry = table[(prefix << codeSize) | pixel];
+            if (entry != 0) {
+                prefix = entry;
+                continue;
+            }
+            put(prefix);
+            entry = static_cast<uint16_t>(next++);
+            // The decoder adds its entries a code later, so widen a code later
+            if (next > (1u << width) && width < 12) width++;
+            if (next == 4096) {
+                put(clear);
+                std::fill(table.begin(), table.end(), 0);
+                width = codeSize + 1;
+                next = end + 1;
+            }
+            prefix = pixel;
+        }
+        put(prefix);
+        // The decoder adds an entry for the last prefix too, and may widen before the end code
+        if (next == (1u << width) && width < 12) width++;
+        put(end);
+        if (used > 0) data.push_back(static_cast<uint8_t>(bits));
+
+        out.push_back(static_cast<uint8_t>(codeSize));
+        for (size_t offset = 0; offset < data.size(); offset += 255) {
+            size_t length = std::min<size_t>(255, data.size() - offset);
+            out.push_back(static_cast<uint8_t>(length));
+            out.insert(out.end(), data.begin() + static_cast<std::ptrdiff_t>(offset),
+                       data.begin() + static_cast<std::ptrdiff_t>(offset + length));
+        }
+        out.push_back(0);
+    }
+
+    // Decode data the way the GIF specification does, with the code widths
+    // and end code it asks for, and compare the pixels with rect
+    bool decodes() const {
+        unsigned int clear = 1u << codeSize;
+        unsigned int end = clear + 1;
+        unsigned int width = codeSize + 1;
+        unsigned int size = end + 1;
+        // Each code's prefix code and last pixel
+        std::vector<uint16_t> prefixes(4096);
+        std::vector<uint8_t> suffixes(4096);
+        std::vector<uint8_t> pixels;
+        std::vector<uint8_t> string;
+        size_t position = 0;
+        unsigned int previous = 4096;
+        while (true) {
+            if (position + width > data.size() * 8) return false;
+            unsigned int code = 0;
+            for (unsigned int bit = 0; bit < width; bit++, position++) {
+                code |= ((data[position / 8] >> (position % 8)) & 1u) << bit;
+            }
+            if (code == clear) {
+                width = codeSize + 1;
+                size = end + 1;
+                previous = 4096;
+                continue;
+            }
+            if (code == end) return pixels == rect;
+            if (code > size || (code == size && previous == 4096) || size > 4096) return false;
+
+            // The pixels of the code, last first
+            unsigned int c = code == size ? previous : code;
+            string.clear();
+            for (; c >= clear; c = prefixes[c]) string.push_back(suffixes[c]);
+            string.push_back(static_cast<uint8_t>(c));
+            std::reverse(string.begin(), string.end());
+            if (code == size) string.push_back(string[0]);
+            if (previous != 4096 && size < 4096) {
+                prefixes[size] = static_cast<uint16_t>(previous);
+                suffixes[size] = string[0];
+                size++;
+                if (size == (1u << width) && width < 12) width++;
+            }
+            pixels.insert(pixels.end(), string.begin(), string.end());
+            if (pixels.size() > rect.size()) return false;
+            previous = code;
+        }
+    }
+
+    std::string path;
+    bool verify;
+    unsigned int tableBits = 1;
+    unsigned int codeSize;
+    std::vector<uint16_t> table; // Code of every prefix code and pixel, 0 for none
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> rect;
+    std::vector<uint8_t> data;
+    Image held;
+    Image shown;
+    uint64_t heldTime{};
+    bool pending{false};
+    uint64_t frames{};
+};
+
+// Feed the frames from options.first to options.last to output, each from
+// the frame it appears on, or options.first for the one already shown then
+template <typename Output>
+bool exportFrames(FrameReader &reader, Renderer &renderer, Output &output, const Options &options) {
+    RecordedFrame frame;
+    RecordedFrame shown;
+    bool showing = false;
+    bool cut = false;
+    while (reader.next(frame)) {
+        if (frame.number > options.last) {
+            cut = true;
+            break;
+        }
+        if (showing && frame.number > options.first &&
+            !output.add(renderer.render(shown), std::max(shown.number, options.first))) {
+            return false;
+        }
+        shown = frame;
+        showing = true;
+    }
+    if (!showing) {
+        std::cerr << "Error: The recording has no frames before frame " << options.last + 1 << std::endl;
+        return false;
+    }
+    // options.last is below the end here, so one past it doesn't overflow
+    uint64_t end = std::max(reader.getEndFrame(), shown.number + 1);
+    if (cut || end - 1 > options.last) end = options.last + 1;
+    if (end <= options.first) {
+        std::cerr << "Error: The recording ends at frame " << end << ", before frame " << options.first << std::endl;
+        return false;
+    }
+    if (!output.add(renderer.render(shown), std::max(shown.number, options.first))) return false;
+    return output.finish(end);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    FrameReader reader;
+    if (!reader.open(options.inputPath)) return 1;
+    Renderer renderer(options);
+
+    if (!options.gifPath.empty()) {
+        GifWriter gif(options, renderer.getColors());
+        if (!exportFrames(reader, renderer, gif, options)) return 1;
+        std::cout << "gif: " << gif.getFrames() << " frames" << std::endl;
+    } else {
+        PngSequence png(options, renderer.getColors());
+        if (!exportFrames(reader, renderer, png, options)) return 1;
+        std::cout << "png: " << png.getFiles() << " files" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "RomCatalog.h"
+
+// ROM catalog tool: lists the ROMs of a directory or archive with their hashes
+// and metadata, looks one up, or packs the catalog into a single archive.
+
+namespace {
+
+struct Options {
+    std::string catalogPath;
+    std::string packPath; // Write an archive here instead of listing
+    std::string findKey;  // Only show this ROM
+    std::string indexPath; // Hash cache of a directory, instead of the one inside it
+    bool noCache = false;  // Hash every file and don't write a cache
+};
+
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " <DIRECTORY | ARCHIVE> [options]\n"
+              << "  --pack FILE    Write the ROMs and their metadata into an archive\n"
+              << "  --find KEY     Only show the ROM with this name or hash\n"
+              << "  --cache FILE   Cache a directory's hashes in FILE instead of inside the directory\n"
+              << "  --no-cache     Hash every ROM and leave the directory untouched\n";
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--pack" && hasValue) {
+            options.packPath = argv[++i];
+        } else if (arg == "--find" && hasValue) {
+            options.findKey = argv[++i];
+        } else if (arg == "--cache" && hasValue) {
+            options.indexPath = argv[++i];
+        } else if (arg == "--no-cache") {
+            options.noCache = true;
+        } else if (arg[0] != '-' && options.catalogPath.empty()) {
+            options.catalogPath = arg;
+        } else {
+            std::cerr << "Error: Unknown or incomplete option " << arg << std::endl;
+            return false;
+        }
+    }
+    return !options.catalogPath.empty();
+}
+
+void printRom(const RomInfo &rom) {
+    std::cout << std::hex << std::setfill('0') << std::setw(16) << rom.hash << std::dec << std::setfill(' ')
+              << ' ' << std::setw(5) << rom.data.size()
+              << ' ' << std::setw(6) << quirkProfileName(rom.quirks)
+              << ' ' << std::setw(5) << rom.ips
+              << ' ' << rom.name;
+    if (!rom.keyMap.empty()) std::cout << " keys=" << rom.keyMap;
+    std::cout << '\n';
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    RomCatalog catalog;
+    catalog.setIndexPath(options.indexPath);
+    catalog.setIndexCaching(!options.noCache);
+    if (!catalog.open(options.catalogPath)) return 1;
+
+    if (!options.packPath.empty()) {
+        if (!catalog.pack(options.packPath)) return 1;
+        std::cout << "packed " << catalog.getRoms().size() << " ROMs into " << options.packPath << std::endl;
+        return 0;
+    }
+
+    if (!options.findKey.empty()) {
+        const RomInfo *rom = catalog.lookup(options.findKey);
+        if (!rom) {
+            std::cerr << "Error: No ROM " << options.findKey << " in " << options.catalogPath << std::endl;
+            return 2;
+        }
+        printRom(*rom);
+        return 0;
+    }
+
+    for (const RomInfo &rom: catalog.getRoms()) printRom(rom);
+    std::cout << catalog.getRoms().size() << " ROMs" << std::endl;
+    return 0;
+}
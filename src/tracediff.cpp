@@ -0,0 +1,124 @@
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "Disassembler.h"
+#include "Trace.h"
+
+// Trace diff: reads two execution traces (chip8_headless --trace) side by
+// side and reports the first instruction where they differ, with the
+// instructions leading up to it.
+
+namespace {
+
+struct Options {
+    std::string paths[2];
+    unsigned int context = 8; // Instructions to show before the divergence
+};
+
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " <TRACE_A> <TRACE_B> [options]\n"
+              << "  --context N    Instructions to show before the first difference (default 8)\n";
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+    int paths = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--context" && hasValue) {
+            options.context = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (arg[0] != '-' && paths < 2) {
+            options.paths[paths++] = arg;
+        } else {
+            std::cerr << "Error: Unknown or incomplete option " << arg << std::endl;
+            return false;
+        }
+    }
+    return paths == 2;
+}
+
+// "1234: 0x2a4 D125 DRW V1, V2, 5  V3=0x10 I=0x2f0 [0x300]=0x01"
+void printRecord(const std::string &label, const TraceRecord &record) {
+    std::cout << label << std::dec << record.cycle << ": " << std::hex << "0x" << std::setw(3) << std::setfill('0')
+              << record.pc << ' ' << std::uppercase << std::setw(4) << record.opcode << std::nouppercase << ' '
+              << std::setfill(' ') << std::left << std::setw(18) << disassemble(record.opcode) << std::right;
+    for (unsigned int i = 0; i < 16; i++) {
+        if ((record.changedRegisters >> i) & 1) {
+            std::cout << " V" << std::uppercase << i << std::nouppercase << "=0x"
+                      << static_cast<int>(record.registers[i]);
+        }
+    }
+    if (record.changedIndex) std::cout << " I=0x" << record.index;
+    for (unsigned int i = 0; i < record.writeCount; i++) {
+        std::cout << " [0x" << record.writes[i].address << "]=0x" << static_cast<int>(record.writes[i].value);
+    }
+    std::cout << std::dec << '\n';
+}
+
+// Which parts of two records for the same instruction differ
+void printDifference(const TraceRecord &a, const TraceRecord &b) {
+    std::cout << "differs in:";
+    if (a.pc != b.pc) std::cout << " PC";
+    if (a.opcode != b.opcode) std::cout << " opcode";
+    for (unsigned int i = 0; i < 16; i++) {
+        if (a.registers[i] != b.registers[i]) std::cout << " V" << std::uppercase << std::hex << i << std::dec;
+    }
+    std::cout << std::nouppercase;
+    if (a.index != b.index) std::cout << " I";
+    if (a.writeCount != b.writeCount || a.writes != b.writes) std::cout << " memory writes";
+    std::cout << '\n';
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    TraceReader readers[2];
+    for (int i = 0; i < 2; i++) {
+        if (!readers[i].open(options.paths[i])) return 1;
+    }
+
+    std::deque<TraceRecord> history;
+    uint64_t compared = 0;
+    TraceRecord a;
+    TraceRecord b;
+    while (true) {
+        bool hasA = readers[0].next(a);
+        bool hasB = readers[1].next(b);
+        if (!hasA && !hasB) {
+            std::cout << "traces match: " << compared << " instructions compared" << std::endl;
+            break;
+        }
+        if (hasA && hasB && a == b) {
+            compared++;
+            history.push_back(a);
+            if (history.size() > options.context) history.pop_front();
+            continue;
+        }
+
+        for (const TraceRecord &record: history) printRecord("  ", record);
+        if (hasA && hasB) {
+            std::cout << "first difference at instruction " << a.cycle << ":\n";
+            printRecord("A ", a);
+            printRecord("B ", b);
+            printDifference(a, b);
+        } else {
+            const TraceRecord &longer = hasA ? a : b;
+            std::cout << options.paths[hasA ? 1 : 0] << " ends after " << longer.cycle << " instructions, "
+                      << options.paths[hasA ? 0 : 1] << " goes on:\n";
+            printRecord(hasA ? "A " : "B ", longer);
+        }
+        return 2;
+    }
+    return 0;
+}